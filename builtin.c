@@ -0,0 +1,87 @@
+// builtin.c
+// library functions whose meaning the compiler knows
+// Copyright (C) 2018: see LICENSE
+#include "builtin.h"
+#include "parser.h"
+#include "util.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool builtins_enabled = true;
+
+static char* BUILTINS[] = {"memcpy", "memset", "strlen", "strcmp", "abs"};
+
+#define NBUILTINS (sizeof(BUILTINS) / sizeof(*BUILTINS))
+
+static ywlist* defined;
+
+void defineFunList(ywlist* yl) {
+  defined = ywlistCreate();
+  for (ywiter* i = ywlistIter(yl); !ywiterEnd(i);)
+    ywlistAppend(defined, ((Ast*)ywiterNext(i))->fun_name);
+}
+
+bool isBuiltin(char* name) {
+  if (!builtins_enabled)
+    return false;
+  if (defined)
+    for (ywiter* i = ywlistIter(defined); !ywiterEnd(i);)
+      if (!strcmp(ywiterNext(i), name))
+        return false;
+  for (size_t i = 0; i < NBUILTINS; i++)
+    if (!strcmp(BUILTINS[i], name))
+      return true;
+  return false;
+}
+
+static Ast* argAt(Ast* call, int index) {
+  ywiter* i = ywlistIter(call->args);
+  for (int k = 0; k < index; k++)
+    ywiterNext(i);
+  return ywiterNext(i);
+}
+
+// characters of a string literal, or of its tail from a constant offset,
+// that holds no escape sequence
+static char* constString(Ast* ast) {
+  int offset = 0;
+  if (AST_GREF == ast->kind && AST_STRING == ast->gref->kind) {
+    offset = ast->gref_offset;
+    ast = ast->gref;
+  }
+  if (AST_STRING != ast->kind || strchr(ast->sval, '\\'))
+    return NULL;
+  if (offset < 0 || (int)strlen(ast->sval) < offset)
+    return NULL;
+  return ast->sval + offset;
+}
+
+/**
+ * strlen of a string literal is its length, strcmp of two literals -1, 0
+ * or 1 as they compare, and abs of a constant its absolute value.
+ */
+Ast* foldBuiltin(Ast* call) {
+  if (!isBuiltin(call->fun_name))
+    return NULL;
+  size_t nargs = ywlistLen(call->args);
+  if (!strcmp(call->fun_name, "strlen") && 1 == nargs) {
+    char* s = constString(argAt(call, 0));
+    return s ? createAstInt(strlen(s)) : NULL;
+  }
+  if (!strcmp(call->fun_name, "strcmp") && 2 == nargs) {
+    char* s = constString(argAt(call, 0));
+    char* t = constString(argAt(call, 1));
+    if (!s || !t)
+      return NULL;
+    int cmp = strcmp(s, t);
+    return createAstInt((0 < cmp) - (cmp < 0));
+  }
+  if (!strcmp(call->fun_name, "abs") && 1 == nargs) {
+    Ast* arg = argAt(call, 0);
+    if (AST_LITERAL != arg->kind || RT_INT != arg->rt_type->type || -2147483647 - 1 == arg->ival)
+      return NULL;
+    return createAstInt(abs(arg->ival));
+  }
+  return NULL;
+}
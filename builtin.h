@@ -0,0 +1,20 @@
+// builtin.h
+// library functions whose meaning the compiler knows
+// Copyright (C) 2018: see LICENSE
+#ifndef _YOWAIC_BUILTIN_H_
+#define _YOWAIC_BUILTIN_H_
+#include "parser.h"
+#include "util.h"
+#include <stdbool.h>
+
+// -fno-builtin calls memcpy, memset, strlen, strcmp and abs like any
+// other function
+extern bool builtins_enabled;
+
+// the functions of yl are defined in the file and no longer builtins
+void defineFunList(ywlist* yl);
+// whether a call of name means the library function of that name
+bool isBuiltin(char* name);
+// the constant a call of a builtin on constants gives, NULL when unknown
+Ast* foldBuiltin(Ast* call);
+#endif
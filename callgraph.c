@@ -0,0 +1,63 @@
+// callgraph.c
+// the calls between the functions of the file
+// Copyright (C) 2018: see LICENSE
+#include "pass.h"
+#include "ir.h"
+#include "util.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int indexOf(ywvec* funs, char* name) {
+  for (size_t i = 0; i < ywvecLen(funs); i++)
+    if (!strcmp(((IrFun*)ywvecGet(funs, i))->name, name))
+      return i;
+  return -1;
+}
+
+// visit the functions of the file fun calls before fun itself
+static void visit(ywvec* funs, int index, ywbits* seen, ywvec* order) {
+  if (ywbitsGet(seen, index))
+    return;
+  ywbitsSet(seen, index);
+  IrFun* fun = ywvecGet(funs, index);
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    for (size_t j = 0; j < ywvecLen(block->insns); j++) {
+      IrInsn* insn = ywvecGet(block->insns, j);
+      int callee = IR_CALL == insn->op ? indexOf(funs, insn->callee) : -1;
+      if (0 <= callee)
+        visit(funs, callee, seen, order);
+    }
+  }
+  ywvecPush(order, fun);
+}
+
+/**
+ * The functions of funs that are not static, and the static ones they
+ * call directly or through others. Callees come before their callers,
+ * but in a cycle of calls, and otherwise the order of funs is kept.
+ */
+ywvec* irLiveFuns(ywvec* funs) {
+  ywbits* seen = ywbitsCreate(ywvecLen(funs));
+  ywvec* order = ywvecCreate();
+  for (size_t i = 0; i < ywvecLen(funs); i++)
+    if (!((IrFun*)ywvecGet(funs, i))->ast->fun_static)
+      visit(funs, i, seen, order);
+  return order;
+}
+
+int irCallSites(ywvec* funs, char* name) {
+  int n = 0;
+  for (size_t i = 0; i < ywvecLen(funs); i++) {
+    IrFun* fun = ywvecGet(funs, i);
+    for (size_t j = 0; j < ywvecLen(fun->blocks); j++) {
+      IrBlock* block = ywvecGet(fun->blocks, j);
+      for (size_t k = 0; k < ywvecLen(block->insns); k++) {
+        IrInsn* insn = ywvecGet(block->insns, k);
+        n += IR_CALL == insn->op && !strcmp(insn->callee, name);
+      }
+    }
+  }
+  return n;
+}
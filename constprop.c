@@ -0,0 +1,104 @@
+// constprop.c
+// constant propagation and folding over the IR
+// Copyright (C) 2018: see LICENSE
+#include "pass.h"
+#include "ir.h"
+#include "util.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+// evaluate insn over constant operands, false when it cannot be folded
+static bool evalInsn(IrInsn* insn, long* result) {
+  if (!insn->dst || !insn->a || IRV_IMM != insn->a->kind)
+    return false;
+  long a = insn->a->imm;
+  if (IR_MOV == insn->op) {
+    *result = a;
+    return true;
+  }
+  if (IR_CAST == insn->op) {
+    *result = (IRT_I8 == insn->type) ? (signed char)a : (IRT_I32 == insn->type) ? (int)a : a;
+    return true;
+  }
+  if (!insn->b || IRV_IMM != insn->b->kind)
+    return false;
+  long b = insn->b->imm;
+  switch (insn->op) {
+  case IR_ADD:
+    *result = a + b;
+    return true;
+  case IR_SUB:
+    *result = a - b;
+    return true;
+  case IR_MUL:
+    *result = a * b;
+    return true;
+  case IR_DIV:
+    if (0 == b)
+      return false;
+    *result = a / b;
+    return true;
+  case IR_SHL:
+    *result = (unsigned long)a << b;
+    return true;
+  case IR_SHR:
+    *result = (unsigned long)a >> b;
+    return true;
+  case IR_SAR:
+    *result = a >> b;
+    return true;
+  case IR_LT:
+    *result = a < b;
+    return true;
+  case IR_LE:
+    *result = a <= b;
+    return true;
+  case IR_GT:
+    *result = a > b;
+    return true;
+  case IR_GE:
+    *result = a >= b;
+    return true;
+  case IR_EQ:
+    *result = a == b;
+    return true;
+  case IR_NE:
+    *result = a != b;
+    return true;
+  }
+  return false;
+}
+
+/**
+ * Every register has a single definition, so a register defined by an
+ * instruction over constants can be replaced by the folded constant
+ * everywhere. Iterate until nothing more folds.
+ */
+bool runConstProp(IrFun* fun) {
+  IrValue** consts = calloc(ywvecLen(fun->regs), sizeof(IrValue*));
+  bool changed = false;
+  for (bool again = true; again;) {
+    again = false;
+    for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+      IrBlock* block = ywvecGet(fun->blocks, i);
+      for (size_t j = 0; j < ywvecLen(block->insns);) {
+        IrInsn* insn = ywvecGet(block->insns, j);
+        IrValue** uses[IR_MAX_USES];
+        int nuses = irUses(insn, uses);
+        for (int k = 0; k < nuses; k++)
+          if (irIsReg(*uses[k]) && consts[(*uses[k])->reg])
+            *uses[k] = consts[(*uses[k])->reg];
+        long val;
+        if (IR_CALL != insn->op && evalInsn(insn, &val)) {
+          consts[insn->dst->reg] = irImm(insn->dst->type, val);
+          ywvecRemove(block->insns, j);
+          changed = again = true;
+          continue;
+        }
+        j++;
+      }
+    }
+  }
+  free(consts);
+  return changed;
+}
@@ -0,0 +1,164 @@
+// dce.c
+// remove unreachable blocks, dead instructions and dead stores
+// Copyright (C) 2018: see LICENSE
+#include "pass.h"
+#include "ir.h"
+#include "util.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+/**
+ * Turn branches and switches on constants into jumps and drop the blocks
+ * no longer reachable from the entry, such as code after a return or the
+ * body of an if whose condition is constant false.
+ */
+bool runSimplifyCfg(IrFun* fun) {
+  bool changed = false;
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrInsn* term = irTerminator(ywvecGet(fun->blocks, i));
+    if (IR_SWITCH == term->op) {
+      if (IRV_IMM != term->a->kind)
+        continue;
+      long k = term->a->imm - term->index;
+      bool hit = 0 <= k && k < (long)ywvecLen(term->cases);
+      term->target = hit ? ywvecGet(term->cases, k) : term->els;
+      term->cases = NULL;
+    } else if (IR_BR != term->op) {
+      continue;
+    } else if (IRV_IMM == term->a->kind) {
+      if (!term->a->imm)
+        term->target = term->els;
+    } else if (term->target != term->els) {
+      continue;
+    }
+    term->op = IR_JMP;
+    term->a = NULL;
+    term->els = NULL;
+    changed = true;
+  }
+  if (changed)
+    irInvalidate(fun, 0);
+  irRequire(fun, ANALYSIS_CFG);
+  for (size_t i = 0; i < ywvecLen(fun->blocks);) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    if (block->rpo < 0) {
+      ywvecRemove(fun->blocks, i);
+      changed = true;
+    } else {
+      i++;
+    }
+  }
+  return changed;
+}
+
+// slot whose address is only used to load from and store to it
+static bool isPrivateSlotAccess(IrInsn* insn, IrValue** use) {
+  return (IR_LOAD == insn->op || IR_STORE == insn->op) && use == &insn->a;
+}
+
+/**
+ * Remove stores to local slots that are never read: slots that are
+ * never loaded and whose address does not escape lose all their
+ * stores, and a store overwritten later in its block before any load of
+ * the slot is dropped.
+ */
+static bool removeDeadStores(IrFun* fun) {
+  size_t nslots = ywvecLen(fun->slots);
+  bool* escaped = calloc(nslots + 1, sizeof(bool));
+  bool* loaded = calloc(nslots + 1, sizeof(bool));
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    for (size_t j = 0; j < ywvecLen(block->insns); j++) {
+      IrInsn* insn = ywvecGet(block->insns, j);
+      IrValue** uses[IR_MAX_USES];
+      int nuses = irUses(insn, uses);
+      for (int k = 0; k < nuses; k++) {
+        if (IRV_SLOT != (*uses[k])->kind)
+          continue;
+        int id = ywvecIndex(fun->slots, (*uses[k])->slot);
+        if (!isPrivateSlotAccess(insn, uses[k]))
+          escaped[id] = true;
+        else if (IR_LOAD == insn->op)
+          loaded[id] = true;
+      }
+    }
+  }
+  bool changed = false;
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    for (size_t j = 0; j < ywvecLen(block->insns);) {
+      IrInsn* insn = ywvecGet(block->insns, j);
+      bool dead = false;
+      if (IR_STORE == insn->op && IRV_SLOT == insn->a->kind) {
+        int id = ywvecIndex(fun->slots, insn->a->slot);
+        dead = !escaped[id] && !loaded[id];
+        // overwritten by a later store of the block before being read
+        for (size_t k = j + 1; !dead && !escaped[id] && k < ywvecLen(block->insns); k++) {
+          IrInsn* next = ywvecGet(block->insns, k);
+          if (IR_LOAD == next->op && IRV_SLOT == next->a->kind &&
+              next->a->slot == insn->a->slot)
+            break;
+          if (IR_STORE == next->op && IRV_SLOT == next->a->kind &&
+              next->a->slot == insn->a->slot && next->a->slot_offset == insn->a->slot_offset &&
+              irTypeSize(next->type) >= irTypeSize(insn->type))
+            dead = true;
+        }
+      }
+      if (dead) {
+        ywvecRemove(block->insns, j);
+        changed = true;
+      } else {
+        j++;
+      }
+    }
+  }
+  // slots that are no longer mentioned at all do not need a frame slot
+  for (size_t i = nslots; i-- > 0;)
+    if (!escaped[i] && !loaded[i]) {
+      ywvecRemove(fun->slots, i);
+      changed = true;
+    }
+  free(escaped);
+  free(loaded);
+  return changed;
+}
+
+/**
+ * Remove instructions without side effects whose result is never used,
+ * such as expression statements like `1;` or `a;`, then dead stores.
+ */
+bool runDce(IrFun* fun) {
+  bool changed = false;
+  for (bool again = true; again;) {
+    again = false;
+    size_t nregs = ywvecLen(fun->regs);
+    int* uses = calloc(nregs + 1, sizeof(int));
+    for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+      IrBlock* block = ywvecGet(fun->blocks, i);
+      for (size_t j = 0; j < ywvecLen(block->insns); j++) {
+        IrValue** ops[IR_MAX_USES];
+        int nops = irUses(ywvecGet(block->insns, j), ops);
+        for (int k = 0; k < nops; k++)
+          if (irIsReg(*ops[k]))
+            uses[(*ops[k])->reg]++;
+      }
+    }
+    for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+      IrBlock* block = ywvecGet(fun->blocks, i);
+      for (size_t j = 0; j < ywvecLen(block->insns);) {
+        IrInsn* insn = ywvecGet(block->insns, j);
+        if (insn->dst && !uses[insn->dst->reg] && !irHasSideEffect(insn)) {
+          ywvecRemove(block->insns, j);
+          again = true;
+        } else {
+          j++;
+        }
+      }
+    }
+    free(uses);
+    if (removeDeadStores(fun))
+      again = true;
+    changed |= again;
+  }
+  return changed;
+}
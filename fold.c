@@ -0,0 +1,236 @@
+// fold.c
+// constant folding and algebraic simplification
+// Copyright (C) 2018: see LICENSE
+#include "fold.h"
+#include "builtin.h"
+#include "parser.h"
+#include "token.h"
+#include "util.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+static bool isLiteral(Ast* ast) {
+  return AST_LITERAL == ast->kind &&
+    (RT_CHAR == ast->rt_type->type || RT_INT == ast->rt_type->type);
+}
+
+static int literalValue(Ast* ast) {
+  return (RT_CHAR == ast->rt_type->type) ? ast->cval : ast->ival;
+}
+
+static bool isLiteralOf(Ast* ast, int val) {
+  return isLiteral(ast) && literalValue(ast) == val;
+}
+
+// an expression is pure when evaluating it can be dropped
+static bool isPure(Ast* ast) {
+  switch (ast->kind) {
+  case AST_LITERAL:
+  case AST_STRING:
+  case AST_LID:
+  case AST_LREF:
+  case AST_GID:
+  case AST_GREF:
+    return true;
+  case AST_ADDRESS:
+  case AST_DEREFERENCE:
+    return isPure(ast->operand);
+  case '+':
+  case '-':
+  case '*':
+  case '<':
+  case '>':
+  case TK_EQ_OP:
+    return isPure(ast->left) && isPure(ast->right);
+  default:
+    return false;
+  }
+}
+
+// evaluate op over two constants, false when the result is undefined
+static bool evalBop(int op, int a, int b, int* result) {
+  unsigned int ua = a, ub = b;
+  switch (op) {
+  case '+':
+    *result = ua + ub;
+    return true;
+  case '-':
+    *result = ua - ub;
+    return true;
+  case '*':
+    *result = ua * ub;
+    return true;
+  case '/':
+    if (0 == b || (-2147483647 - 1 == a && -1 == b))
+      return false;
+    *result = a / b;
+    return true;
+  case '<':
+    *result = a < b;
+    return true;
+  case '>':
+    *result = a > b;
+    return true;
+  case TK_EQ_OP:
+    *result = a == b;
+    return true;
+  }
+  return false;
+}
+
+static Ast* createLiteral(rt_t* rt_type, int val) {
+  if (RT_CHAR == rt_type->type)
+    return createAstChar(val);
+  return createAstInt(val);
+}
+
+// fold "array + constant" into a reference with a constant offset
+static Ast* foldPtrOffset(Ast* ast) {
+  if (!isLiteral(ast->right))
+    return ast;
+  Ast* base = ast->left;
+  int offset = literalValue(ast->right);
+  if ('-' == ast->kind)
+    offset = -offset;
+  else if ('+' != ast->kind)
+    return ast;
+  switch (base->kind) {
+  case AST_STRING:
+    return createAstGref(createPtrType(rt_char_t), base, offset);
+  case AST_GREF:
+    return createAstGref(base->rt_type, base->gref, base->gref_offset + offset);
+  case AST_LID:
+    if (RT_ARRAY != base->rt_type->type)
+      return ast;
+    return createAstLref(createPtrType(base->rt_type->ptr), base, offset);
+  case AST_LREF:
+    return createAstLref(base->rt_type, base->lref, base->lref_offset + offset);
+  }
+  return ast;
+}
+
+static Ast* foldBop(Ast* ast) {
+  if ('=' == ast->kind) {
+    if (AST_DEREFERENCE == ast->left->kind)
+      ast->left->operand = foldExpr(ast->left->operand);
+    ast->right = foldExpr(ast->right);
+    return ast;
+  }
+  ast->left = foldExpr(ast->left);
+  ast->right = foldExpr(ast->right);
+  Ast* l = ast->left;
+  Ast* r = ast->right;
+  if (RT_PTR == ast->rt_type->type || RT_ARRAY == ast->rt_type->type) {
+    if (isLiteralOf(r, 0) && RT_ARRAY != l->rt_type->type)
+      return l;
+    return foldPtrOffset(ast);
+  }
+  if (isLiteral(l) && isLiteral(r)) {
+    int val;
+    if (evalBop(ast->kind, literalValue(l), literalValue(r), &val) &&
+        (RT_CHAR != ast->rt_type->type || (signed char)val == val))
+      return createLiteral(ast->rt_type, val);
+    return ast;
+  }
+  switch (ast->kind) {
+  case '+':
+    if (isLiteralOf(r, 0))
+      return l;
+    if (isLiteralOf(l, 0))
+      return r;
+    break;
+  case '-':
+    if (isLiteralOf(r, 0))
+      return l;
+    break;
+  case '*':
+    if (isLiteralOf(r, 1))
+      return l;
+    if (isLiteralOf(l, 1))
+      return r;
+    if ((isLiteralOf(r, 0) && isPure(l)) || (isLiteralOf(l, 0) && isPure(r)))
+      return createLiteral(ast->rt_type, 0);
+    break;
+  case '/':
+    if (isLiteralOf(r, 1))
+      return l;
+    break;
+  }
+  return ast;
+}
+
+Ast* foldExpr(Ast* ast) {
+  if (!ast)
+    return NULL;
+  switch (ast->kind) {
+  case AST_LITERAL:
+  case AST_STRING:
+  case AST_LID:
+  case AST_LREF:
+  case AST_GID:
+  case AST_GREF:
+    return ast;
+  case AST_ADDRESS:
+    return ast;
+  case AST_DEREFERENCE:
+    ast->operand = foldExpr(ast->operand);
+    return ast;
+  case AST_FUN_CALL: {
+    ywlist* args = ywlistCreate();
+    for (ywiter* i = ywlistIter(ast->args); !ywiterEnd(i);)
+      ywlistAppend(args, foldExpr(ywiterNext(i)));
+    ast->args = args;
+    Ast* folded = foldBuiltin(ast);
+    return folded ? folded : ast;
+  }
+  case AST_DECLARATION:
+    ast->decl_init = foldExpr(ast->decl_init);
+    return ast;
+  case AST_ARRAY_INIT: {
+    ywlist* inits = ywlistCreate();
+    for (ywiter* i = ywlistIter(ast->array_init); !ywiterEnd(i);)
+      ywlistAppend(inits, foldExpr(ywiterNext(i)));
+    ast->array_init = inits;
+    return ast;
+  }
+  case AST_IF:
+    ast->s_cond = foldExpr(ast->s_cond);
+    ast->s_then = foldExpr(ast->s_then);
+    ast->s_else = foldExpr(ast->s_else);
+    return ast;
+  case AST_FOR:
+    ast->forinit = foldExpr(ast->forinit);
+    ast->forcond = foldExpr(ast->forcond);
+    ast->forstep = foldExpr(ast->forstep);
+    ast->forbody = foldExpr(ast->forbody);
+    return ast;
+  case AST_COMPOUND: {
+    ywlist* stmts = ywlistCreate();
+    for (ywiter* i = ywlistIter(ast->compound); !ywiterEnd(i);)
+      ywlistAppend(stmts, foldExpr(ywiterNext(i)));
+    ast->compound = stmts;
+    return ast;
+  }
+  case AST_RETURN:
+    ast->ret = foldExpr(ast->ret);
+    return ast;
+  case AST_SWITCH:
+    ast->sw_cond = foldExpr(ast->sw_cond);
+    ast->sw_body = foldExpr(ast->sw_body);
+    return ast;
+  case AST_CASE:
+  case AST_BREAK:
+    return ast;
+  default:
+    return foldBop(ast);
+  }
+}
+
+void foldFun(Ast* fun) {
+  fun->body = foldExpr(fun->body);
+}
+
+void foldFunList(ywlist* yl) {
+  for (ywiter* i = ywlistIter(yl); !ywiterEnd(i);)
+    foldFun(ywiterNext(i));
+}
@@ -0,0 +1,12 @@
+// fold.h
+// constant folding and algebraic simplification
+// Copyright (C) 2018: see LICENSE
+#ifndef _YOWAIC_FOLD_H_
+#define _YOWAIC_FOLD_H_
+#include "parser.h"
+#include "util.h"
+
+Ast* foldExpr(Ast* ast);
+void foldFun(Ast* fun);
+void foldFunList(ywlist* yl);
+#endif
@@ -2,466 +2,1014 @@
 // emit assembly language
 // Copyright (C) 2018: see LICENSE
 #include "generator.h"
+#include "ir.h"
 #include "parser.h"
-#include "token.h"
+#include "peephole.h"
+#include "regalloc.h"
 #include "util.h"
+#include <ctype.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
 extern ywlist* globals;
-extern ywlist* locals;
-static char* REGS[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+static char* REGS[] = {"%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9"};
+static char* REGS32[] = {"%edi", "%esi", "%edx", "%ecx", "%r8d", "%r9d"};
+static char* REGS8[] = {"%dil", "%sil", "%dl", "%cl", "%r8b", "%r9b"};
 
-int rtTypeSize(rt_t *rt_type) {
-  switch (rt_type->type) {
-  case RT_CHAR:
-    return 1;
-  case RT_INT:
-    return 4;
-  case RT_PTR:
-    return 8;
-  case RT_ARRAY:
-    return rtTypeSize(rt_type->ptr) * rt_type->size;
-  default:
-    error("internal error");
-  }
+// function being emitted
+static IrFun* fun;
+static RegAlloc* ra;
+static IrBlock* next_block;
+// label of the epilogue shared by every return
+static char* epilog;
+// virtual register whose value is still in %rax, or -1
+static int rax_holds;
+// number of uses of every virtual register
+static int* uses;
+// comparison or load emitted together with the branch that follows it
+static IrInsn* fused;
+// instructions defining virtual registers, by number, that are not
+// emitted but folded into the instruction right after them
+static IrInsn** folded;
+
+bool omit_frame_pointer = false;
+// bytes below the return address the prologue reserves, without %rbp
+static int frame_size;
+// distance from the frame base, where %rbp would point, down to %rsp
+static int rsp_offset;
+// functions called without setting %al
+static ywlist* fixed_arity = NULL;
+
+static char* format(char* fmt, ...) {
+  char buf[256];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(buf, sizeof(buf), fmt, args);
+  va_end(args);
+  return ywstrCopy(buf);
 }
 
-static void emitGload(rt_t* rt_type, char* label, int offset) {
-  if (RT_ARRAY == rt_type->type) {
-    printf("leaq %s(%%rip), %%rax\n\t", label);
-  if (offset)
-    printf("addq $%d, %%rax\n\t", rtTypeSize(rt_type->ptr) * offset);
-  return;
-  }
-  int size = rtTypeSize(rt_type);
-  switch (size) {
-  case 1:
-    printf("movq $0, %%rax\n\t"
-           "movb %s(%%rip), %%al", label);
-    if (offset)
-      printf("addq $%d, %%rax\n\t", offset * size);
-    printf("movb (%%rax), %%al\n\t");
+static char* frameBase() {
+  return omit_frame_pointer ? "%rsp" : "%rbp";
+}
+
+static int frameDisp(int disp) {
+  return omit_frame_pointer ? rsp_offset + disp : disp;
+}
+
+// memory at disp from the frame base, which is %rbp unless it is omitted
+static char* frameMem(int disp) {
+  return format("%d(%s)", frameDisp(disp), frameBase());
+}
+
+static char* slotMem(IrSlot* slot, int offset) {
+  return frameMem(offset - slot->offset);
+}
+
+// register or stack slot holding a virtual register
+static char* loc(IrValue* v) {
+  assert(IRV_REG == v->kind && !folded[v->reg]);
+  if (ra->reg[v->reg])
+    return ra->reg[v->reg];
+  if (!ra->spill[v->reg])
+    error("No location for %%%d in %s", v->reg, fun->name);
+  return slotMem(ra->spill[v->reg], 0);
+}
+
+static bool isImm32(long imm) {
+  return INT32_MIN <= imm && imm <= INT32_MAX;
+}
+
+// register allocated to a computed value, NULL if it is spilled or folded
+static char* regOf(IrValue* v) {
+  if (!irIsReg(v) || folded[v->reg])
+    return NULL;
+  return ra->reg[v->reg];
+}
+
+static bool isFolded(IrValue* v, int op) {
+  return irIsReg(v) && folded[v->reg] && op == folded[v->reg]->op;
+}
+
+static char* memOperand(IrValue* addr);
+
+// operand that an instruction can read directly, NULL for addresses
+// and constants that do not fit in 32 bits
+static char* operand(IrValue* v) {
+  if (IRV_IMM == v->kind)
+    return isImm32(v->imm) ? format("$%ld", v->imm) : NULL;
+  // a folded load of a whole register reads memory directly
+  if (isFolded(v, IR_LOAD))
+    return IRT_PTR == v->type ? memOperand(folded[v->reg]->a) : NULL;
+  if (IRV_REG == v->kind)
+    return loc(v);
+  return NULL;
+}
+
+static void load(IrValue* v, char* reg) {
+  switch (v->kind) {
+  case IRV_REG:
+    if (isFolded(v, IR_LOAD)) {
+      IrInsn* insn = folded[v->reg];
+      char* mem = memOperand(insn->a);
+      char* op = (IRT_I8 == insn->type) ? "movsbq" : (IRT_I32 == insn->type) ? "movslq" : "movq";
+      emit("%s %s, %s", op, mem, reg);
+      if (!strcmp("%rax", reg))
+        rax_holds = -1;
+      break;
+    }
+    if (!strcmp("%rax", reg) && v->reg == rax_holds)
+      return;
+    emit("movq %s, %s", loc(v), reg);
     break;
-  case 4:
-    printf("movl %s(%%rip), %%eax", label);
-    if (offset)
-      printf("addq $%d, %%rax\n\t", offset * size);
-    printf("movl (%%rax), %%eax\n\t");    
+  case IRV_IMM:
+    emit("%s $%ld, %s", isImm32(v->imm) ? "movq" : "movabsq", v->imm, reg);
     break;
-  case 8:
-    printf("movq %s(%%rip), %%rax", label);
-    if (offset)
-      printf("addq $%d, %%rax\n\t", offset * size);
-    printf("movq (%%rax), %%rax\n\t");    
+  case IRV_SYM:
+    if (v->sym_offset)
+      emit("leaq %s%+d(%%rip), %s", v->sym, v->sym_offset, reg);
+    else
+      emit("leaq %s(%%rip), %s", v->sym, reg);
+    break;
+  case IRV_SLOT:
+    emit("leaq %s, %s", slotMem(v->slot, v->slot_offset), reg);
     break;
-  default:
-    error("Unknown data size: %d", size);
   }
 }
 
-static void emitLload(Ast* var, int offset) {
-  if (RT_ARRAY == var->rt_type->type) {
-    printf("leaq -%d(%%rbp), %%rax\n\t", var->loffset);
-    return;
+// operand of an instruction whose other operand is in %rax
+static char* secondOperand(IrValue* v) {
+  char* op = operand(v);
+  if (op)
+    return op;
+  load(v, "%rcx");
+  return "%rcx";
+}
+
+// the result of the current instruction is in %rax
+static void storeResult(IrValue* dst) {
+  emit("movq %%rax, %s", loc(dst));
+  rax_holds = dst->reg;
+}
+
+/**
+ * Address base + index * scale + disp of base plus index, for a base
+ * in a register or a slot and an index in a register, maybe shifted by
+ * a folded shift, or a constant. NULL if it cannot be addressed so.
+ */
+static char* addressOf(IrValue* base, IrValue* index) {
+  if (IRV_IMM == base->kind || isFolded(base, IR_SHL)) {
+    IrValue* t = base;
+    base = index;
+    index = t;
   }
-  int size = rtTypeSize(var->rt_type);
-  switch (size) {
-  case 1:
-    printf("movl %0, %%eax\n\t");
-    printf("movb -%d(%%rbp), %%al\n\t", var->loffset);
-    break;
-  case 4:
-    printf("movl -%d(%%rbp), %%eax\n\t", var->loffset);
-    break;
-  case 8:
-    printf("movq -%d(%%rbp), %%rax\n\t", var->loffset);
-    break;
-  default:
-    error("Unknown data size: %s: %d", astToS(var));
+  int disp = 0;
+  char* base_reg = regOf(base);
+  if (IRV_SLOT == base->kind) {
+    disp = frameDisp(base->slot_offset - base->slot->offset);
+    base_reg = frameBase();
+  }
+  if (!base_reg)
+    return NULL;
+  if (IRV_IMM == index->kind)
+    return isImm32(disp + index->imm) ? format("%ld(%s)", disp + index->imm, base_reg) : NULL;
+  int scale = 1;
+  if (isFolded(index, IR_SHL)) {
+    scale = 1 << folded[index->reg]->b->imm;
+    index = folded[index->reg]->a;
   }
-  if (offset)
-    printf("addq $%d, %%rax\n\t", var->loffset * size);
+  if (!regOf(index))
+    return NULL;
+  char* scaled = (1 == scale) ? regOf(index) : format("%s,%d", regOf(index), scale);
+  return disp ? format("%d(%s,%s)", disp, base_reg, scaled) : format("(%s,%s)", base_reg, scaled);
 }
 
-static void emitGsave(Ast* var, int offset) {
-  assert(RT_ARRAY != var->rt_type->type);
-  char* reg;
-  printf("pushq %%rbx\n\t");
-  printf("movq %s(%%rip), %%rbx\n\t", var->glabel);
-  int size = rtTypeSize(var->rt_type);
-  switch (size) {
-  case 1:
-    printf("movb %%al, %d(%%rbp)\n\t", offset * size);
-    break;
-  case 4:
-    printf("movl %%eax, %d(%%rbp)\n\t", offset * size);
-    break;
-  case 8:
-    printf("movq %%rax, %d(%%rbp)\n\t", offset * size);
-    break;
-  default:
-    error("Unknown data size: %d", size);
+// memory operand for an address, using %rax when it has to be computed
+static char* memOperand(IrValue* addr) {
+  if (isFolded(addr, IR_ADD))
+    return addressOf(folded[addr->reg]->a, folded[addr->reg]->b);
+  if (regOf(addr))
+    return format("(%s)", regOf(addr));
+  if (IRV_SLOT == addr->kind)
+    return slotMem(addr->slot, addr->slot_offset);
+  if (IRV_SYM == addr->kind)
+    return addr->sym_offset ? format("%s%+d(%%rip)", addr->sym, addr->sym_offset)
+                            : format("%s(%%rip)", addr->sym);
+  load(addr, "%rax");
+  return "(%rax)";
+}
+
+// low bytes of a 64-bit register according to type
+static char* sizedReg(char* reg, int type) {
+  if (IRT_PTR == type)
+    return reg;
+  // %r8 to %r15
+  if (isdigit(reg[2]))
+    return format("%s%c", reg, (IRT_I8 == type) ? 'b' : 'd');
+  // %rsi and %rdi
+  if ('i' == reg[3])
+    return format((IRT_I8 == type) ? "%%%cil" : "%%e%ci", reg[2]);
+  // %rax, %rbx, %rcx and %rdx
+  return format((IRT_I8 == type) ? "%%%cl" : "%%e%cx", reg[2]);
+}
+
+// instruction suffix for the width of type
+static char suffix(int type) {
+  return (IRT_I8 == type) ? 'b' : (IRT_I32 == type) ? 'l' : 'q';
+}
+
+// sign extend the low bytes of %rax according to type
+static void extendRax(int type) {
+  if (IRT_I8 == type)
+    emit("movsbq %%al, %%rax");
+  else if (IRT_I32 == type)
+    emit("movslq %%eax, %%rax");
+}
+
+/**
+ * Copy every src[i] to dst[i] as if all at once: a move waits until no
+ * other pending move reads its destination, and a cycle of moves is
+ * broken by parking one source in %rax. One side of each move is a register.
+ */
+static void emitParallelMoves(char** dst, char** src, int n) {
+  bool* done = calloc(n + 1, sizeof(bool));
+  for (int left = n; left > 0;) {
+    bool progress = false;
+    for (int i = 0; i < n; i++) {
+      if (done[i])
+        continue;
+      bool blocked = false;
+      for (int j = 0; j < n; j++)
+        if (!done[j] && j != i && !strcmp(src[j], dst[i]))
+          blocked = true;
+      if (blocked)
+        continue;
+      if (strcmp(src[i], dst[i]))
+        emit("movq %s, %s", src[i], dst[i]);
+      done[i] = true;
+      left--;
+      progress = true;
+    }
+    if (progress)
+      continue;
+    for (int i = 0; i < n; i++)
+      if (!done[i]) {
+        char* parked = src[i];
+        emit("movq %s, %%rax", parked);
+        for (int j = 0; j < n; j++)
+          if (!done[j] && !strcmp(src[j], parked))
+            src[j] = "%rax";
+        break;
+      }
   }
-  printf("popq %%rbx\n\t");
+  free(done);
+  rax_holds = -1;
 }
 
-static void emitLsave(rt_t* rt_type, int loffset, int offset) {
-  int size = rtTypeSize(rt_type);
-  switch (size) {
-  case 1:
-    printf("movb %%al, -%d(%%rbp)\n\t", loffset + offset * size);
-    break;
-  case 4:
-    printf("movl %%eax, -%d(%%rbp)\n\t", loffset + offset * size);
-    break;
-  case 8:
-    printf("movq %%rax, -%d(%%rbp)\n\t", loffset + offset * size);
-  }
-}
-  
-  
-static void emitPtrArith(int op, Ast* LHS, Ast* RHS) {
-  assert(RT_PTR == LHS->rt_type->type || RT_ARRAY == LHS->rt_type->type);
-  emitExpr(LHS);
-  printf("pushq %%rax\n\t");
-  emitExpr(RHS);
-  int shift = rtTypeSize(LHS->rt_type->ptr);
-  if (1 < shift)
-    printf("imulq $%d, %%rax\n\t", shift);
-  printf("movq %%rax, %%rbx\n\t"
-         "popq %%rax\n\t"
-         "addq %%rbx, %%rax\n\t");
-}
-
-static void emitDereference(Ast* var, Ast* value) {
-  emitExpr(var->operand);
-  printf("push %%rax\n\t");
-  emitExpr(value);
-  printf("pop %%rcx\n\t");
-  switch (rtTypeSize(var->operand->rt_type)) {
-  case 1:
-    printf("movb %%al, (%%rcx)\n\t");
-    break;
-  case 4:
-    printf("movl %%eax, (%%rcx)\n\t");
-    break;
-  case 8:
-    printf("movq %%rax, (%%rcx)\n\t");
-    break;
+static void emitParams() {
+  IrValue* params[sizeof(REGS) / sizeof(*REGS)] = {NULL};
+  IrBlock* entry = ywvecGet(fun->blocks, 0);
+  for (size_t i = 0; i < ywvecLen(entry->insns); i++) {
+    IrInsn* insn = ywvecGet(entry->insns, i);
+    if (IR_PARAM == insn->op)
+      params[insn->index] = insn->dst;
+  }
+  // values live sign extended to 64 bits
+  for (int i = 0; i < fun->nparams; i++) {
+    if (!params[i])
+      continue;
+    if (IRT_I8 == params[i]->type)
+      emit("movsbq %s, %s", REGS8[i], REGS[i]);
+    else if (IRT_I32 == params[i]->type)
+      emit("movslq %s, %s", REGS32[i], REGS[i]);
   }
+  // incoming registers may be allocated to other parameters
+  char* dst[sizeof(REGS) / sizeof(*REGS)];
+  char* src[sizeof(REGS) / sizeof(*REGS)];
+  int n = 0;
+  for (int i = 0; i < fun->nparams; i++)
+    if (params[i]) {
+      dst[n] = loc(params[i]);
+      src[n++] = REGS[i];
+    }
+  emitParallelMoves(dst, src, n);
 }
 
-static void emitAssign(Ast* var, Ast* value) {
-  emitExpr(value);
-  switch (var->kind) {
-  case AST_LID:
-    emitLsave(var->rt_type, var->loffset, 0);
-    break;
-  case AST_LREF:
-    emitLsave(var->lref->rt_type, var->lref->loffset, var->loffset);
-    break;
-  case AST_GID:
-    emitGsave(var, 0);
-    break;
-  case AST_GREF:
-    emitGsave(var->gref, var->gref_offset);
-    break;
-  case AST_DEREFERENCE:
-    emitDereference(var, value);
-    break;
+static char* SETCC[] = {"setl", "setle", "setg", "setge", "sete", "setne"};
+// jump taken when the comparison holds and when it does not
+static char* JCC[][2] = {
+  {"jl", "jge"}, {"jle", "jg"}, {"jg", "jle"}, {"jge", "jl"}, {"je", "jne"}, {"jne", "je"},
+};
+
+static bool isCompare(IrInsn* insn) {
+  return IR_LT <= insn->op && insn->op <= IR_NE;
+}
+
+// a comparison or load whose only use is the branch right after it
+static bool isFusable(IrInsn* insn, IrInsn* next) {
+  return (isCompare(insn) || IR_LOAD == insn->op) && IR_BR == next->op &&
+    insn->dst == next->a && 1 == uses[insn->dst->reg];
+}
+
+static bool isScale(IrValue* v) {
+  return v && IRV_IMM == v->kind && 1 <= v->imm && v->imm <= 3;
+}
+
+static bool reads(IrInsn* insn, IrValue* v) {
+  IrValue** ops[IR_MAX_USES];
+  int nops = irUses(insn, ops);
+  for (int k = 0; k < nops; k++)
+    if (*ops[k] == v)
+      return true;
+  return false;
+}
+
+// an addition, read once, giving the address next loads or stores
+static bool isFoldableAddress(IrInsn* add, IrInsn* next) {
+  return IR_ADD == add->op && !irIsVector(add->type) && 1 == uses[add->dst->reg] &&
+    (IR_LOAD == next->op || IR_STORE == next->op) && !irIsVector(next->type) &&
+    add->dst == next->a && addressOf(add->a, add->b);
+}
+
+/**
+ * Whether insn is folded into next, the instruction after it: a load
+ * read once by next as an operand, an addition giving the address next
+ * accesses, or a shift by 1 to 3 scaling the index of an addition
+ * that is folded or computed by lea.
+ */
+static bool isFoldable(IrInsn* insn, IrInsn* next, IrInsn* after) {
+  if (!insn->dst || irIsVector(insn->type) || 1 != uses[insn->dst->reg] || !reads(next, insn->dst))
+    return false;
+  switch (insn->op) {
+  case IR_LOAD:
+    if (IR_CALL == next->op || IR_COPY == next->op || IR_BR == next->op ||
+        IR_REDUCE == next->op || irIsVector(next->type))
+      return false;
+    return IRV_REG != insn->a->kind || regOf(insn->a) || isFolded(insn->a, IR_ADD);
+  case IR_ADD:
+    return isFoldableAddress(insn, next);
+  case IR_SHL: {
+    if (!isScale(insn->b) || !regOf(insn->a) || IR_ADD != next->op || irIsVector(next->type))
+      return false;
+    folded[insn->dst->reg] = insn;
+    bool ret = addressOf(next->a, next->b) &&
+      (regOf(next->dst) || (after && isFoldableAddress(next, after)));
+    folded[insn->dst->reg] = NULL;
+    return ret;
+  }
   default:
-    error("Unexpected kind %d", astToS(var));
+    return false;
   }
 }
 
-static void emitCompare(Ast* a, Ast* b) {
-  emitExpr(a);
-  printf("pushq %%rax\n\t");
-  emitExpr(b);
-  printf("popq %%rcx\n\t"
-         "cmpq %%rax, %%rcx\n\t"
-         "setl %%al\n\t"
-         "movzb %%al, %%eax\n\t"
-         );
+// jump to target when jcc is taken and to els otherwise
+static void emitBranch(char* jcc, char* jncc, IrBlock* target, IrBlock* els) {
+  if (target == next_block) {
+    emit("%s %s", jncc, els->label);
+    return;
+  }
+  emit("%s %s", jcc, target->label);
+  if (els != next_block)
+    emit("jmp %s", els->label);
 }
 
-static void emitBinop(Ast *ast) {
-  if ('=' == ast->kind) {
-    emitAssign(ast->left, ast->right);
-    return;
+/**
+ * Jump through a table in .rodata of the offsets of the case blocks from
+ * the table, which keeps the code position independent. Subtracting the
+ * first case value maps values below it to large unsigned ones, so one
+ * comparison sends every value outside the table to the default.
+ */
+static void emitSwitch(IrInsn* insn) {
+  char* table = createNextLabel();
+  load(insn->a, "%rax");
+  if (insn->index)
+    emit("subq $%d, %%rax", insn->index);
+  emit("cmpq $%d, %%rax", (int)ywvecLen(insn->cases) - 1);
+  emit("ja %s", insn->els->label);
+  emit("leaq %s(%%rip), %%rdx", table);
+  emit("movslq (%%rdx,%%rax,4), %%rax");
+  emit("addq %%rdx, %%rax");
+  emit("jmp *%%rax");
+  emit(".section .rodata");
+  emit(".p2align 2");
+  emit("%s:", table);
+  for (size_t i = 0; i < ywvecLen(insn->cases); i++)
+    emit(".long %s-%s", ((IrBlock*)ywvecGet(insn->cases, i))->label, table);
+  emit(".text");
+  rax_holds = -1;
+}
+
+// set the flags for the condition of a branch and return its jumps
+static char** emitCondition(IrValue* cond) {
+  static char* truthy[] = {"jne", "je"};
+  if (fused && fused->dst == cond) {
+    IrInsn* insn = fused;
+    fused = NULL;
+    if (IR_LOAD == insn->op) {
+      char* mem = memOperand(insn->a);
+      emit("cmp%c $0, %s", suffix(insn->type), mem);
+      return truthy;
+    }
+    char* left = "%rax";
+    if (regOf(insn->a) && insn->a->reg != rax_holds)
+      left = regOf(insn->a);
+    else
+      load(insn->a, "%rax");
+    emit("cmpq %s, %s", secondOperand(insn->b), left);
+    return JCC[insn->op - IR_LT];
   }
-  if (RT_PTR == ast->rt_type->type || RT_ARRAY == ast->rt_type->type) {
-    emitPtrArith(ast->kind, ast->left, ast->right);
-    return;
+  if (cond->reg == rax_holds)
+    emit("test %%rax, %%rax");
+  else if (ra->reg[cond->reg])
+    emit("test %s, %s", ra->reg[cond->reg], ra->reg[cond->reg]);
+  else
+    emit("cmpq $0, %s", loc(cond));
+  return truthy;
+}
+
+static void emitFrameTeardown() {
+  for (size_t i = 0; i < ywvecLen(ra->callee_saved); i++)
+    emit("movq %s, %s", frameMem(-8 * (int)(i + 1)), ywvecGet(ra->callee_saved, i));
+  if (!omit_frame_pointer)
+    emit("leave");
+  else if (frame_size)
+    emit("addq $%d, %%rsp", frame_size);
+}
+
+void emitFixedArity(char* fun_name) {
+  if (!fixed_arity)
+    fixed_arity = ywlistCreate();
+  ywlistAppend(fixed_arity, fun_name);
+}
+
+static bool isFixedArity(char* callee) {
+  if (!fixed_arity)
+    return false;
+  for (ywiter* i = ywlistIter(fixed_arity); !ywiterEnd(i);)
+    if (!strcmp(ywiterNext(i), callee))
+      return true;
+  return false;
+}
+
+/**
+ * Arguments go straight to their registers: values in registers or
+ * spill slots are moved all at once, so an argument may sit in the
+ * register of another one, then constants and addresses are loaded.
+ * Values live across the call are never in caller-saved registers.
+ */
+static void emitCall(IrInsn* insn) {
+  size_t nargs = ywvecLen(insn->args);
+  if (nargs > sizeof(REGS) / sizeof(*REGS))
+    error("Too many arguments: %s", insn->callee);
+  char* dst[sizeof(REGS) / sizeof(*REGS)];
+  char* src[sizeof(REGS) / sizeof(*REGS)];
+  int n = 0;
+  for (size_t i = 0; i < nargs; i++) {
+    IrValue* arg = ywvecGet(insn->args, i);
+    if (irIsReg(arg)) {
+      dst[n] = REGS[i];
+      src[n++] = loc(arg);
+    }
   }
-  char *op;
-  switch (ast->kind) {
-  case '<':
-    emitCompare(ast->left, ast->right);
-    return;
-  case '>':
-    emitCompare(ast->right, ast->left);
+  emitParallelMoves(dst, src, n);
+  for (size_t i = 0; i < nargs; i++) {
+    IrValue* arg = ywvecGet(insn->args, i);
+    if (!irIsReg(arg))
+      load(arg, REGS[i]);
+  }
+  char* callee = strcmp("printf", insn->callee) ? insn->callee : format("%s@plt", insn->callee);
+  // a tail call leaves the frame first and the callee returns to our caller
+  // variadic callees read the number of vector registers used from %al
+  bool set_al = !isFixedArity(insn->callee);
+  if (insn->tail) {
+    emitFrameTeardown();
+    if (set_al)
+      emit("movl $0, %%eax");
+    emit("jmp %s", callee);
     return;
-  case '+':
-    op = "add";
-    break;
-  case '-':
-    op = "sub";
-    break;
-  case '*':
-    op = "imul";
-    break;
-  case '/':
-    op = "idiv";
-    break;
-  default:
-    error("emitBinop: invalid operator %s", astToS(ast));
-  }
-  emitExpr(ast->left);
-  printf("push %%rax\n\t");
-  emitExpr(ast->right);
-  if (ast->kind == '/') {
-    printf("movq %%rax, %%rcx\n\t");
-    printf("popq %%rax\n\t");
-    printf("movl $0, %%edx\n\t");
-    printf("idivq %%rcx\n\t");
-  } else {
-    printf("popq %%rcx\n\t");
-    printf("%s %%rcx, %%rax\n\t", op);
   }
+  if (set_al)
+    emit("movl $0, %%eax");
+  emit("call %s", callee);
+  extendRax(insn->type);
+  storeResult(insn->dst);
 }
 
-void emitExpr(Ast *ast) {
-  switch (ast->kind) {
-  case AST_LITERAL:
-    switch (ast->rt_type->type) {
-    case RT_CHAR:
-      printf("movq $%d, %%rax\n\t", ast->cval);
-      break;
-    case RT_INT:
-      printf("movl $%d, %%eax\n\t", ast->ival);
-      break;
-    case RT_ARRAY:
-      printf("leaq .s%d(%%rip), %%rax\n\t", ast->slabel);
+static void emitEpilog() {
+  emitFrameTeardown();
+  emit("ret");
+}
+
+/**
+ * Vector values live in %xmm registers, %xmm15 is scratch. SSE2 only
+ * compares for greater and equal, so less swaps the operands and the
+ * other comparisons add 1 to the opposite mask, while the lanes of all
+ * ones of a mask are negated into 1.
+ */
+static void emitVectorInsn(IrInsn* insn) {
+  char lane = (IRT_V16I8 == insn->type) ? 'b' : 'd';
+  char* dst = insn->dst ? loc(insn->dst) : NULL;
+  switch (insn->op) {
+  case IR_SPLAT:
+    if (irIsImm(insn->a, 0)) {
+      emit("pxor %s, %s", dst, dst);
       break;
-    default:
-      error("AST_LITERAL error");
-    } break;
-  case AST_STRING:
-    printf("leaq %s(%%rip), %%rax\n\t", ast->slabel);
-    break;
-  case AST_LID:
-    emitLload(ast, 0);
-    break;
-  case AST_LREF:
-    assert(AST_LID == ast->lref->kind);
-    emitLload(ast->lref, ast->lref_offset);
-    break;
-  case AST_GID:
-    emitGload(ast->rt_type, ast->glabel, 0);
-    break;
-  case AST_GREF:
-    if (AST_STRING == ast->gref->kind) {
-      printf("leaq %s(%%rip), %%rax\n\t", ast->gref->slabel);
+    }
+    load(insn->a, "%rax");
+    if ('b' == lane) {
+      emit("movzbl %%al, %%eax");
+      emit("imull $0x01010101, %%eax, %%eax");
+    }
+    emit("movd %%eax, %s", dst);
+    emit("pshufd $0, %s, %s", dst, dst);
+    break;
+  case IR_REDUCE: {
+    char* src = loc(insn->a);
+    emit("pshufd $0x4e, %s, %%xmm15", src);
+    emit("paddd %s, %%xmm15", src);
+    emit("movd %%xmm15, %%eax");
+    emit("pshufd $0x55, %%xmm15, %%xmm15");
+    emit("movd %%xmm15, %%ecx");
+    emit("addl %%ecx, %%eax");
+    emit("movslq %%eax, %%rax");
+    storeResult(insn->dst);
+    return;
+  }
+  case IR_LOAD:
+    emit("movdqu %s, %s", memOperand(insn->a), dst);
+    break;
+  case IR_STORE:
+    emit("movdqu %s, %s", loc(insn->b), memOperand(insn->a));
+    break;
+  case IR_ADD:
+  case IR_SUB:
+    emit("movdqa %s, %s", loc(insn->a), dst);
+    emit("%s%c %s, %s", (IR_ADD == insn->op) ? "padd" : "psub", lane, loc(insn->b), dst);
+    break;
+  default: {
+    // a > b for lt, ge, gt and le, a == b for eq and ne
+    bool swap = IR_LT == insn->op || IR_GE == insn->op;
+    bool negate = IR_GE == insn->op || IR_LE == insn->op || IR_NE == insn->op;
+    char* cmp = (IR_EQ == insn->op || IR_NE == insn->op) ? "pcmpeq" : "pcmpgt";
+    emit("movdqa %s, %s", loc(swap ? insn->b : insn->a), dst);
+    emit("%s%c %s, %s", cmp, lane, loc(swap ? insn->a : insn->b), dst);
+    if (negate) {
+      emit("pcmpeq%c %%xmm15, %%xmm15", lane);
+      emit("psub%c %%xmm15, %s", lane, dst);
     } else {
-      assert(AST_GID == ast->gref->kind);
-      emitGload(ast->gref->rt_type, ast->gref->glabel, ast->gref_offset);
+      emit("pxor %%xmm15, %%xmm15");
+      emit("psub%c %s, %%xmm15", lane, dst);
+      emit("movdqa %%xmm15, %s", dst);
     }
     break;
-  case AST_FUN_CALL:
-    for (int i = 1; i < ywlistLen(ast->args); i++)
-      printf("push %%%s\n\t", REGS[i]);
-    for (ywiter* i = ywlistIter(ast->args); !ywiterEnd(i);) {
-      emitExpr(ywiterNext(i));
-      printf("pushq %%rax\n\t");
+  }
+  }
+  rax_holds = -1;
+}
+
+// copies from this size up use the string instructions
+#define MIN_REP_COPY 256
+
+// memory at a constant offset from an address held in reg unless it is
+// a slot or a symbol
+static char* blockMem(IrValue* addr, int offset, char* reg) {
+  if (IRV_SLOT == addr->kind)
+    return slotMem(addr->slot, addr->slot_offset + offset);
+  if (IRV_SYM == addr->kind)
+    return memOperand(irSym(addr->sym, addr->sym_offset + offset));
+  return format("%d(%s)", offset, reg);
+}
+
+static bool inRegister(IrValue* addr) {
+  return IRV_SLOT != addr->kind && IRV_SYM != addr->kind;
+}
+
+/**
+ * Copy or fill a block 16 bytes at a time through %xmm15 and finish it
+ * with narrower moves, between addresses in registers, slots or
+ * symbols. Large blocks use rep movsb or rep stosb, keeping %rsi and %rdi
+ * in %rax and %rdx meanwhile.
+ */
+static void emitCopy(IrInsn* insn) {
+  int n = insn->index;
+  bool fill = !insn->b || IRV_IMM == insn->b->kind;
+  long byte = insn->b && fill ? insn->b->imm & 255 : 0;
+  rax_holds = -1;
+  if (MIN_REP_COPY <= n) {
+    emit("movq %%rdi, %%rdx");
+    if (!fill)
+      emit("movq %%rsi, %%rax");
+    // either address may be in %rdi or %rsi
+    load(insn->a, "%rcx");
+    if (!fill)
+      load(insn->b, "%rsi");
+    emit("movq %%rcx, %%rdi");
+    emit("movl $%d, %%ecx", n);
+    if (!fill) {
+      emit("rep movsb");
+      emit("movq %%rax, %%rsi");
+    } else {
+      if (byte)
+        emit("movl $%ld, %%eax", byte);
+      else
+        emit("xorl %%eax, %%eax");
+      emit("rep stosb");
+    }
+    emit("movq %%rdx, %%rdi");
+    return;
+  }
+  char* to = regOf(insn->a) ? regOf(insn->a) : "%rdx";
+  char* from = !fill && regOf(insn->b) ? regOf(insn->b) : "%rcx";
+  if (inRegister(insn->a) && !regOf(insn->a))
+    load(insn->a, to);
+  if (!fill && inRegister(insn->b) && !regOf(insn->b))
+    load(insn->b, from);
+  // the byte repeated in every byte of %rax, and of %xmm15 for 16 bytes
+  if (byte)
+    emit("movabsq $%lu, %%rax", (unsigned long)byte * 0x0101010101010101UL);
+  if (fill && 16 <= n && byte) {
+    emit("movq %%rax, %%xmm15");
+    emit("punpcklqdq %%xmm15, %%xmm15");
+  } else if (fill && 16 <= n) {
+    emit("pxor %%xmm15, %%xmm15");
+  }
+  int at = 0;
+  for (; at + 16 <= n; at += 16) {
+    if (!fill)
+      emit("movdqu %s, %%xmm15", blockMem(insn->b, at, from));
+    emit("movdqu %%xmm15, %s", blockMem(insn->a, at, to));
+  }
+  for (int width = 8; width; width /= 2)
+    for (; at + width <= n; at += width) {
+      char suffix = (8 == width) ? 'q' : (4 == width) ? 'l' : (2 == width) ? 'w' : 'b';
+      char* reg = (8 == width) ? "%rax" : (4 == width) ? "%eax" : (2 == width) ? "%ax" : "%al";
+      if (fill && !byte) {
+        emit("mov%c $0, %s", suffix, blockMem(insn->a, at, to));
+        continue;
+      }
+      if (!fill)
+        emit("mov%c %s, %s", suffix, blockMem(insn->b, at, from), reg);
+      emit("mov%c %s, %s", suffix, reg, blockMem(insn->a, at, to));
     }
-    for (int i = ywlistLen(ast->args) - 1; i >= 0; i--)
-      printf("pop %%%s\n\t", REGS[i]);
-    printf("movq $0, %%rax\n\t");
-    printf("call %s", ast->fun_name);
-    if (!strcmp("printf", ast->fun_name))
-      printf("@plt");
-    printf("\n\t");
-    for (int i = ywlistLen(ast->args) - 1; i > 0; i--)
-      printf("pop %%%s\n\t", REGS[i]);
+}
+
+static void emitInsn(IrInsn* insn) {
+  if (irIsVector(insn->type) || IR_REDUCE == insn->op) {
+    emitVectorInsn(insn);
+    return;
+  }
+  switch (insn->op) {
+  case IR_PARAM:
+    rax_holds = -1;
     break;
-    case AST_DECLARATION:
-      if (AST_ARRAY_INIT == ast->decl_init->kind) {
-        int i = 0;
-        for (ywiter* iter = ywlistIter(ast->decl_init->array_init); !ywiterEnd(iter);) {
-          emitExpr(ywiterNext(iter));
-          emitLsave(ast->decl_var->rt_type->ptr,ast->decl_var->loffset, -i);
-          i++;
-        }
-      } else if (RT_ARRAY == ast->decl_var->rt_type->type) {
-        assert(AST_STRING == ast->decl_init->kind);
-        int i = 0;
-        for (char* p = ast->decl_init->sval; *p; p++, i++)
-          printf("movb $%d, -%d(%%rbp)\n\t", *p, ast->decl_var->loffset - i);
-        printf("movb $0, -%d(%%rbp)\n\t", ast->decl_var->loffset - i);
-      } else if (ast->decl_init->kind == AST_STRING) {
-        emitGload(ast->decl_init->rt_type, ast->decl_init->slabel, 0);
-        emitLsave(ast->decl_var->rt_type, ast->decl_var->loffset, 0);
-      } else {
-        emitExpr(ast->decl_init);
-        emitLsave(ast->decl_var->rt_type, ast->decl_var->loffset, 0);
+  case IR_MOV:
+    if (regOf(insn->a) && regOf(insn->dst) && insn->a->reg != rax_holds) {
+      emit("movq %s, %s", regOf(insn->a), regOf(insn->dst));
+      break;
+    }
+    load(insn->a, "%rax");
+    storeResult(insn->dst);
+    break;
+  case IR_MUL:
+    // multiplication by 3, 5 or 9 left over from strength reduction
+    if (IRV_IMM == insn->b->kind && (3 == insn->b->imm || 5 == insn->b->imm || 9 == insn->b->imm)) {
+      if (regOf(insn->a) && regOf(insn->dst)) {
+        emit("leaq (%s,%s,%ld), %s", regOf(insn->a), regOf(insn->a), insn->b->imm - 1,
+             regOf(insn->dst));
+        break;
       }
+      load(insn->a, "%rax");
+      emit("leaq (%%rax,%%rax,%ld), %%rax", insn->b->imm - 1);
+      storeResult(insn->dst);
       break;
-  case AST_ADDRESS:
-    if (AST_LID != ast->operand->kind)
-      error("AST_ADDRESS");
-    printf("lea -%d(%%rbp), %%rax\n\t", ast->operand->loffset);
-    break;
-  case AST_DEREFERENCE:
-    if (RT_PTR != ast->operand->rt_type->type)
-      error("AST_DEREFERENCE");
-    emitExpr(ast->operand);
-    char *reg;
-    switch (rtTypeSize(ast->operand->rt_type->ptr)) {
-    case 1: reg = "%bl";  break;
-    case 4: reg = "%ebx"; break;
-    case 8: reg = "%rbx"; break;
-    default: error("AST_DEREFERENCE");
     }
-    printf("movl $0, %%ebx\n\t");
-    printf("mov (%%rax), %s\n\t", reg);
-    printf("movq %%rbx, %%rax\n\t");
+    // fall through
+  case IR_ADD:
+  case IR_SUB: {
+    // sums of registers and constants go straight to the result register
+    char* addr = NULL;
+    if (IR_ADD == insn->op)
+      addr = addressOf(insn->a, insn->b);
+    else if (IR_SUB == insn->op && IRV_IMM == insn->b->kind)
+      addr = addressOf(insn->a, irImm(insn->b->type, -insn->b->imm));
+    if (addr && regOf(insn->dst)) {
+      emit("leaq %s, %s", addr, regOf(insn->dst));
+      break;
+    }
+    char* op = (IR_ADD == insn->op) ? "addq" : (IR_SUB == insn->op) ? "subq" : "imulq";
+    load(insn->a, "%rax");
+    emit("%s %s, %%rax", op, secondOperand(insn->b));
+    storeResult(insn->dst);
     break;
-  case AST_IF:
-    emitExpr(ast->s_cond);
-    char* ne = createNextLabel();
-    printf("test %%rax, %%rax\n\t");
-    printf("je %s\n\t", ne);
-    /*
-    emitCompoundStatement(ast->s_then->compound);
-    if (ast->s_else) {
-      char* end = createNextLabel();
-      printf("jmp %s\n\t", end);
-      printf("%s:\n\t", ne);
-      emitCompoundStatement(ast->s_else->compound);
-      printf("%s:\n\t", end);
+  }
+  case IR_SHL:
+  case IR_SHR:
+  case IR_SAR: {
+    if (IR_SHL == insn->op && isScale(insn->b) && regOf(insn->a) && regOf(insn->dst)) {
+      emit("leaq (,%s,%ld), %s", regOf(insn->a), 1L << insn->b->imm, regOf(insn->dst));
+      break;
+    }
+    char* op = (IR_SHL == insn->op) ? "shlq" : (IR_SHR == insn->op) ? "shrq" : "sarq";
+    load(insn->a, "%rax");
+    if (IRV_IMM == insn->b->kind) {
+      emit("%s $%ld, %%rax", op, insn->b->imm);
     } else {
-      printf("%s:\n\t", ne);
+      load(insn->b, "%rcx");
+      emit("%s %%cl, %%rax", op);
     }
-    */
-    emitCompoundStatement(ast->s_then->compound);
-    if (ast->s_else) {
-      char* end = createNextLabel();
-      printf("jmp %s\n\t", end);
-      printf("%s:\n\t", ne);
-      emitCompoundStatement(ast->s_else->compound);
-      printf("%s:\n\t", end);
+    storeResult(insn->dst);
+    break;
+  }
+  case IR_DIV:
+    load(insn->a, "%rax");
+    load(insn->b, "%rcx");
+    emit("cqto");
+    emit("idivq %%rcx");
+    storeResult(insn->dst);
+    break;
+  case IR_LT:
+  case IR_LE:
+  case IR_GT:
+  case IR_GE:
+  case IR_EQ:
+  case IR_NE:
+    load(insn->a, "%rax");
+    emit("cmpq %s, %%rax", secondOperand(insn->b));
+    emit("%s %%al", SETCC[insn->op - IR_LT]);
+    emit("movzb %%al, %%eax");
+    storeResult(insn->dst);
+    break;
+  case IR_CAST:
+    load(insn->a, "%rax");
+    extendRax(insn->type);
+    storeResult(insn->dst);
+    break;
+  case IR_LOAD: {
+    char* mem = memOperand(insn->a);
+    if (IRT_I8 == insn->type)
+      emit("movsbq %s, %%rax", mem);
+    else if (IRT_I32 == insn->type)
+      emit("movslq %s, %%rax", mem);
+    else
+      emit("movq %s, %%rax", mem);
+    storeResult(insn->dst);
+    break;
+  }
+  case IR_STORE: {
+    char* val;
+    char* mem;
+    if (IRV_IMM == insn->b->kind) {
+      mem = memOperand(insn->a);
+      val = format("$%ld", insn->b->imm);
+    } else if (regOf(insn->b)) {
+      mem = memOperand(insn->a);
+      val = sizedReg(regOf(insn->b), insn->type);
+    } else if (IRV_REG == insn->a->kind) {
+      load(insn->b, "%rcx");
+      mem = memOperand(insn->a);
+      val = sizedReg("%rcx", insn->type);
     } else {
-      printf("%s:\n\t", ne);
+      load(insn->b, "%rax");
+      mem = memOperand(insn->a);
+      val = sizedReg("%rax", insn->type);
     }
+    emit("mov%c %s, %s", suffix(insn->type), val, mem);
+    rax_holds = -1;
+    break;
+  }
+  case IR_COPY:
+    emitCopy(insn);
     break;
-  case AST_FOR:
-    if (ast->forinit)
-      emitExpr(ast->forinit);
-    char* begin = createNextLabel();
-    char* end = createNextLabel();
-    printf("%s:\n\t", begin);
-    if (ast->forcond) {
-      emitExpr(ast->forcond);
-      printf("test %%rax, %%rax\n\t");
-      printf("je %s\n\t", end);
+  case IR_CALL:
+    emitCall(insn);
+    break;
+  case IR_JMP:
+    if (insn->target != next_block)
+      emit("jmp %s", insn->target->label);
+    break;
+  case IR_BR: {
+    if (IRV_IMM == insn->a->kind) {
+      IrBlock* taken = insn->a->imm ? insn->target : insn->els;
+      if (taken != next_block)
+        emit("jmp %s", taken->label);
+      break;
     }
-    emitCompoundStatement(ast->forbody->compound);
-    if (ast->forstep)
-      emitExpr(ast->forstep);
-    printf("jmp %s\n\t", begin);
-    printf("%s:\n\t", end);
+    char** jcc = emitCondition(insn->a);
+    emitBranch(jcc[0], jcc[1], insn->target, insn->els);
     break;
-  case AST_COMPOUND:
-    emitCompoundStatement(ast->compound);
+  }
+  case IR_SWITCH:
+    emitSwitch(insn);
     break;
-  case AST_RETURN:
-    emitExpr(ast->ret);
-    printf("leave\n\t"
-           "ret\n");
+  case IR_RET:
+    load(insn->a, "%rax");
+    if (next_block)
+      emit("jmp %s", epilog);
     break;
   default:
-    emitBinop(ast);
+    error("Unknown IR instruction %d", insn->op);
   }
 }
 
+// length of the character or escape sequence at s as spelled in a literal
+static int escapeLength(char* s) {
+  if ('\\' != *s)
+    return 1;
+  int n = 2;
+  if ('x' == s[1])
+    while (isxdigit(s[n]))
+      n++;
+  else if ('0' <= s[1] && s[1] <= '7')
+    while (n < 4 && '0' <= s[n] && s[n] <= '7')
+      n++;
+  return n;
+}
+
+// bytes before the end of owner that spells str, or -1 if there is none
+static int suffixOffset(char* owner, char* str) {
+  char* suffix = owner + strlen(owner) - strlen(str);
+  if (suffix < owner || strcmp(suffix, str))
+    return -1;
+  int bytes = 0;
+  char* p = owner;
+  for (; p < suffix; p += escapeLength(p))
+    bytes++;
+  // a suffix starting inside an escape sequence spells other bytes
+  return (p == suffix) ? bytes : -1;
+}
+
+static int compareLength(const void* a, const void* b) {
+  return strlen((*(Ast**)b)->sval) - strlen((*(Ast**)a)->sval);
+}
+
+/**
+ * String literals go to a mergeable section once each: a literal equal
+ * to the end of a longer one, or to another occurrence, is a label into
+ * it, and the linker merges equal strings across objects.
+ */
 void emitDataSection() {
-  if (!globals) return;
-  printf("\t.data\n");
-  for (ywiter* i = ywlistIter(globals); !ywiterEnd(i);) {
-    Ast* p = ywiterNext(i);
-    assert(AST_STRING == p->kind);
-    printf("%s:\n\t", p->slabel);
-    printf(".string \"%s\"\n", p->sval);
-  }
-  printf("\t");
-}
-
-static int ceil8(int n) {
-  int rem = n % 8;
-  return (0 == rem) ? n : n - rem + 8;
-}
-
-void emitAsmHeader() {
-  int offset = 0;
-  for (ywiter* i = ywlistIter(locals); !ywiterEnd(i);) {
-    Ast* p = ywiterNext(i);
-    offset += ceil8(rtTypeSize(p->rt_type));
-    p->loffset = offset;
-  }
-  emitDataSection();
-  printf(".text\n\t"
-         ".global mymain\n"
-         "mymain:\n\t"
-         "pushq %%rbp\n\t"
-         "movq %%rsp, %%rbp\n\t");
-  if (locals)
-    printf("subq $%d, %%rsp\n\t", offset);
-}
-
-void emitCompoundStatement(ywlist* yl) {
-  for (ywiter* i = ywlistIter(yl); !ywiterEnd(i);) {
-    emitExpr(ywiterNext(i));
-  }
-}
-
-static void emitFunProlog(Ast* fun) {
-  if (ywlistLen(fun->params) > sizeof(REGS) / sizeof(*REGS))
-    error("Parameter list too long: %s", fun->fun_name);
-  printf(".text\n\t"
-         ".global %s\n"
-         "%s:\n\t", fun->fun_name, fun->fun_name);
-  printf("pushq %%rbp\n\t"
-         "movq %%rsp, %%rbp\n\t");
-  int off = 0;
-  int ri = 0;
-  for (ywiter* i = ywlistIter(fun->params); !ywiterEnd(i); ri++) {
-    printf("push %%%s\n\t", REGS[ri]);
-    Ast* p = ywiterNext(i);
-    off += ceil8(rtTypeSize(p->rt_type));
-    p->loffset = off;
-  }
-  for (ywiter* i = ywlistIter(fun->locals); !ywiterEnd(i);) {
-    Ast* p = ywiterNext(i);
-    off += ceil8(rtTypeSize(p->rt_type));
-    p->loffset = off;
-  }
-  if (off)
-    printf("subq $%d, %%rsp\n\t", off);
-}
-
-static void emitFunEpilog(void) {
-  printf("leave\n\t"
-         "ret\n");
-}
-
-void emitFun(Ast* fun) {
-  assert(AST_FUN_DEFINE == fun->kind);
-  emitFunProlog(fun);
-  emitCompoundStatement(fun->body->compound);
-  emitFunEpilog();
+  int n = ywlistLen(globals);
+  if (n) {
+    Ast** strs = malloc(n * sizeof(Ast*));
+    bool* pooled = calloc(n, sizeof(bool));
+    int i = 0;
+    for (ywiter* iter = ywlistIter(globals); !ywiterEnd(iter);) {
+      strs[i] = ywiterNext(iter);
+      assert(AST_STRING == strs[i]->kind);
+      i++;
+    }
+    qsort(strs, n, sizeof(Ast*), compareLength);
+    emit(".section .rodata.str1.1,\"aMS\",@progbits,1");
+    for (i = 0; i < n; i++) {
+      int j = 0;
+      int offset = -1;
+      for (; j < i && offset < 0; j++)
+        if (!pooled[j])
+          offset = suffixOffset(strs[j]->sval, strs[i]->sval);
+      if (0 <= offset) {
+        pooled[i] = true;
+        if (offset)
+          emit(".set %s, %s+%d", strs[i]->slabel, strs[j - 1]->slabel, offset);
+        else
+          emit(".set %s, %s", strs[i]->slabel, strs[j - 1]->slabel);
+        continue;
+      }
+      emit("%s:", strs[i]->slabel);
+      emit(".string \"%s\"", strs[i]->sval);
+    }
+    free(strs);
+    free(pooled);
+  }
+  if (!ir_rodata)
+    return;
+  emit(".section .rodata");
+  emit(".p2align 4");
+  for (size_t i = 0; i < ywvecLen(ir_rodata); i++) {
+    IrData* data = ywvecGet(ir_rodata, i);
+    emit("%s:", data->label);
+    for (int at = 0; at < data->size; at += 16) {
+      ywstr* ys = ywstrCreate(".byte ");
+      for (int k = at; k < data->size && k < at + 16; k++)
+        ywstrAppendFormat(ys, "%s%d", (k == at) ? "" : ",", (unsigned char)data->bytes[k]);
+      emit("%s", ywstrGet(ys));
+    }
+  }
+}
+
+/**
+ * Lay the frame out below the saved callee saved registers: locals first,
+ * then the spill slots of the register allocator.
+ */
+static int layoutFrame() {
+  int offset = 8 * ywvecLen(ra->callee_saved);
+  for (size_t i = 0; i < ywvecLen(fun->slots); i++) {
+    IrSlot* slot = ywvecGet(fun->slots, i);
+    offset += ceil8(slot->size);
+    slot->offset = offset;
+  }
+  for (size_t i = 0; i < ywvecLen(ra->slots); i++) {
+    IrSlot* slot = ywvecGet(ra->slots, i);
+    offset += ceil8(slot->size);
+    slot->offset = offset;
+  }
+  return (offset + 15) / 16 * 16;
+}
+
+// bytes below %rsp a function may use without moving it, in the System V ABI
+#define RED_ZONE_SIZE 128
+
+// a function making no calls, other than tail calls that leave with its frame
+static bool isLeaf() {
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    for (size_t j = 0; j < ywvecLen(block->insns); j++) {
+      IrInsn* insn = ywvecGet(block->insns, j);
+      if (IR_CALL == insn->op && !insn->tail)
+        return false;
+    }
+  }
+  return true;
+}
+
+static void emitFunProlog(bool optimize) {
+  if (fun->nparams > sizeof(REGS) / sizeof(*REGS))
+    error("Parameter list too long: %s", fun->name);
+  emit(".text");
+  // static functions stay local to the object file
+  if (!fun->ast->fun_static)
+    emit(".global %s", fun->name);
+  emit("%s:", fun->name);
+  int frame = layoutFrame();
+  // leaf functions keep a small frame in the red zone below %rsp
+  bool red_zone = optimize && isLeaf() && frame + 8 <= RED_ZONE_SIZE;
+  if (omit_frame_pointer) {
+    // the return address leaves %rsp 8 bytes off the 16-byte alignment
+    frame_size = red_zone ? 0 : frame + 8;
+    rsp_offset = frame_size - 8;
+    if (frame_size)
+      emit("subq $%d, %%rsp", frame_size);
+  } else {
+    emit("pushq %%rbp");
+    emit("movq %%rsp, %%rbp");
+    if (frame && !red_zone)
+      emit("subq $%d, %%rsp", frame);
+  }
+  for (size_t i = 0; i < ywvecLen(ra->callee_saved); i++)
+    emit("movq %s, %s", ywvecGet(ra->callee_saved, i), frameMem(-8 * (int)(i + 1)));
+  if (fun->nparams)
+    emitParams();
+}
+
+static void countUses() {
+  uses = calloc(ywvecLen(fun->regs) + 1, sizeof(int));
+  folded = calloc(ywvecLen(fun->regs) + 1, sizeof(IrInsn*));
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    for (size_t j = 0; j < ywvecLen(block->insns); j++) {
+      IrValue** ops[IR_MAX_USES];
+      int nops = irUses(ywvecGet(block->insns, j), ops);
+      for (int k = 0; k < nops; k++)
+        if (irIsReg(*ops[k]))
+          uses[(*ops[k])->reg]++;
+    }
+  }
+}
+
+void emitFun(IrFun* ir, bool optimize) {
+  fun = ir;
+  ra = allocateRegisters(fun, optimize);
+  epilog = createNextLabel();
+  countUses();
+  emitFunProlog(optimize);
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    next_block = (i + 1 < ywvecLen(fun->blocks)) ? ywvecGet(fun->blocks, i + 1) : NULL;
+    // pad a loop header to 16 bytes unless that takes more than 10
+    if (block->align)
+      emit(".p2align 4,,10");
+    emit("%s:", block->label);
+    rax_holds = -1;
+    for (size_t j = 0; j < ywvecLen(block->insns); j++) {
+      IrInsn* insn = ywvecGet(block->insns, j);
+      // conditions are evaluated straight into the flags at -O1 and above
+      if (optimize && j + 1 < ywvecLen(block->insns) &&
+          isFusable(insn, ywvecGet(block->insns, j + 1))) {
+        fused = insn;
+        continue;
+      }
+      if (optimize && j + 1 < ywvecLen(block->insns) &&
+          isFoldable(insn, ywvecGet(block->insns, j + 1),
+                     j + 2 < ywvecLen(block->insns) ? ywvecGet(block->insns, j + 2) : NULL)) {
+        folded[insn->dst->reg] = insn;
+        continue;
+      }
+      emitInsn(insn);
+    }
+  }
+  emit("%s:", epilog);
+  emitEpilog();
 }
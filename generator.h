@@ -3,12 +3,16 @@
 // Copyright (C) 2018: see LICENSE
 #ifndef _YOWAIC_GENERATOR_H_
 #define _YOWAIC_GENERATOR_H_
+#include "ir.h"
 #include "parser.h"
 #include "util.h"
-void emitExpr(Ast *ast);
-void emitCompoundStatement(ywlist* yl);
-void emitAsmHeader();
+#include <stdbool.h>
+// address the frame from %rsp and keep %rbp free
+extern bool omit_frame_pointer;
+
+// declare a function whose calls need not set %al
+void emitFixedArity(char* fun_name);
 void emitDataSection();
-void emitFun(Ast* fun);
+// without optimize every virtual register lives on the stack
+void emitFun(IrFun* fun, bool optimize);
 #endif
-
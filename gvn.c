@@ -0,0 +1,197 @@
+// gvn.c
+// common subexpression elimination by value numbering over the dominator tree
+// Copyright (C) 2018: see LICENSE
+#include "pass.h"
+#include "ir.h"
+#include "util.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+static IrFun* fun;
+// value replacing every use of a register, by number
+static IrValue** repl;
+// pure instructions of the dominators of the current block, innermost last
+static ywvec* avail;
+// loads and stores since the last block with several predecessors whose
+// memory was not written since, so it still holds their value
+static ywvec* memory;
+static ywbits* escaped;
+static int* bases;
+
+static bool sameValue(IrValue* a, IrValue* b) {
+  if (!a || !b)
+    return a == b;
+  if (a->kind != b->kind)
+    return false;
+  switch (a->kind) {
+  case IRV_REG:
+    return a->reg == b->reg;
+  case IRV_IMM:
+    return a->imm == b->imm;
+  case IRV_SYM:
+    return !strcmp(a->sym, b->sym) && a->sym_offset == b->sym_offset;
+  default:
+    return a->slot == b->slot && a->slot_offset == b->slot_offset;
+  }
+}
+
+static bool isCommutative(int op) {
+  return IR_ADD == op || IR_MUL == op || IR_EQ == op || IR_NE == op;
+}
+
+static bool sameExpr(IrInsn* x, IrInsn* y) {
+  if (x->op != y->op || x->type != y->type || x->dst->type != y->dst->type)
+    return false;
+  if (sameValue(x->a, y->a) && sameValue(x->b, y->b))
+    return true;
+  return isCommutative(x->op) && sameValue(x->a, y->b) && sameValue(x->b, y->a);
+}
+
+// computes a value from its operands alone
+static bool isPure(IrInsn* insn) {
+  if (!insn->dst || irHasSideEffect(insn))
+    return false;
+  return (IR_ADD <= insn->op && insn->op <= IR_REDUCE) || IR_MOV == insn->op;
+}
+
+static IrInsn* find(ywvec* insns, IrInsn* insn) {
+  for (size_t i = ywvecLen(insns); i-- > 0;) {
+    IrInsn* other = ywvecGet(insns, i);
+    if (sameExpr(other, insn))
+      return other;
+  }
+  return NULL;
+}
+
+// forget the loads and stores whose memory write may change
+static void kill(IrInsn* write) {
+  for (size_t i = 0; i < ywvecLen(memory);) {
+    IrInsn* known = ywvecGet(memory, i);
+    if (irMayClobber(write, known, escaped) &&
+        (IR_CALL == write->op || !irRestrictDisjoint(bases, write->a, known->a)))
+      ywvecRemove(memory, i);
+    else
+      i++;
+  }
+}
+
+// value read by a load of type from memory store wrote, if known
+static IrValue* storedValue(IrInsn* store, int type) {
+  IrValue* v = store->b;
+  if (IRV_IMM == v->kind)
+    return irImm(type, IRT_I8 == type ? (signed char)v->imm : IRT_I32 == type ? (int)v->imm : v->imm);
+  return v->type == type ? v : NULL;
+}
+
+// value the memory access reads or writes holds now, if known
+static IrValue* lookup(IrInsn* access) {
+  for (size_t i = ywvecLen(memory); i-- > 0;) {
+    IrInsn* known = ywvecGet(memory, i);
+    if (known->type != access->type || !sameValue(known->a, access->a))
+      continue;
+    return IR_LOAD == known->op ? known->dst : storedValue(known, access->type);
+  }
+  return NULL;
+}
+
+static void replaceUses(IrInsn* insn) {
+  IrValue** uses[IR_MAX_USES];
+  int nuses = irUses(insn, uses);
+  for (int k = 0; k < nuses; k++)
+    if (irIsReg(*uses[k]) && repl[(*uses[k])->reg])
+      *uses[k] = repl[(*uses[k])->reg];
+}
+
+static bool isLoopHeader(IrBlock* block) {
+  for (size_t i = 0; i < ywvecLen(fun->loops); i++)
+    if (((IrLoop*)ywvecGet(fun->loops, i))->header == block)
+      return true;
+  return false;
+}
+
+// a copy of a value of its own type
+static bool isCopy(IrInsn* insn) {
+  return IR_MOV == insn->op && (IRV_IMM == insn->a->kind || insn->a->type == insn->dst->type);
+}
+
+static bool numberBlock(IrBlock* block, ywvec* known) {
+  bool changed = false;
+  size_t depth = ywvecLen(avail);
+  memory = known;
+  for (size_t j = 0; j < ywvecLen(block->insns);) {
+    IrInsn* insn = ywvecGet(block->insns, j);
+    replaceUses(insn);
+    IrValue* same = NULL;
+    if (isCopy(insn)) {
+      same = insn->a;
+    } else if (isPure(insn)) {
+      IrInsn* other = find(avail, insn);
+      same = other ? other->dst : NULL;
+    } else if (IR_LOAD == insn->op) {
+      same = lookup(insn);
+    } else if (IR_STORE == insn->op && sameValue(lookup(insn), insn->b)) {
+      // the memory already holds the value
+      ywvecRemove(block->insns, j);
+      changed = true;
+      continue;
+    }
+    if (same) {
+      repl[insn->dst->reg] = same;
+      ywvecRemove(block->insns, j);
+      changed = true;
+      continue;
+    }
+    if (isPure(insn))
+      ywvecPush(avail, insn);
+    else if (IR_LOAD == insn->op)
+      ywvecPush(memory, insn);
+    if (IR_STORE == insn->op || IR_COPY == insn->op || IR_CALL == insn->op)
+      kill(insn);
+    if (IR_STORE == insn->op)
+      ywvecPush(memory, insn);
+    j++;
+  }
+  // a block whose only predecessor is this one starts with what it knows,
+  // unless that is a loop header, which rotation copies
+  bool pass_on = !isLoopHeader(block);
+  for (size_t i = 0; i < ywvecLen(block->dom_children); i++) {
+    IrBlock* child = ywvecGet(block->dom_children, i);
+    ywvec* inherited = ywvecCreate();
+    for (size_t k = 0; pass_on && 1 == ywvecLen(child->preds) && k < ywvecLen(known); k++)
+      ywvecPush(inherited, ywvecGet(known, k));
+    changed |= numberBlock(child, inherited);
+  }
+  while (ywvecLen(avail) > depth)
+    ywvecPop(avail);
+  return changed;
+}
+
+/**
+ * Replace pure instructions computing the same operation over the same
+ * operands as one of a dominating block by its result, and copies by the
+ * value they copy. A load reads the value of an earlier load or store of
+ * the same address in its block, or in the blocks before it that it is the
+ * only successor of, unless a store, copy or call that may write the
+ * memory comes between. Writes through a restrict qualified parameter
+ * keep what is known of other memory. A store of the value the memory
+ * holds goes away.
+ */
+bool runGvn(IrFun* ir) {
+  fun = ir;
+  irRequire(fun, ANALYSIS_CFG | ANALYSIS_DOM | ANALYSIS_LOOPS);
+  repl = calloc(ywvecLen(fun->regs) + 1, sizeof(IrValue*));
+  avail = ywvecCreate();
+  escaped = irEscapedSlots(fun);
+  bases = irAddressBases(fun);
+  bool changed = numberBlock(ywvecGet(fun->blocks, 0), ywvecCreate());
+  // unreachable blocks are not in the dominator tree
+  for (size_t i = 0; changed && i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    for (size_t j = 0; j < ywvecLen(block->insns); j++)
+      replaceUses(ywvecGet(block->insns, j));
+  }
+  free(repl);
+  free(bases);
+  return changed;
+}
@@ -0,0 +1,198 @@
+// inline.c
+// substitute the bodies of small functions of the file at their calls
+// Copyright (C) 2018: see LICENSE
+#include "pass.h"
+#include "ir.h"
+#include "util.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool inline_enabled = true;
+
+// largest callee inlined at -O1 and -O2, three times that if declared inline
+#define INLINE_SIZE_O1 12
+#define INLINE_SIZE_O2 30
+// callers stop growing by inlining at this size
+#define MAX_CALLER_SIZE 2000
+
+static int funSize(IrFun* fun) {
+  int size = 0;
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    for (size_t j = 0; j < ywvecLen(block->insns); j++)
+      if (IR_PARAM != ((IrInsn*)ywvecGet(block->insns, j))->op)
+        size++;
+  }
+  return size;
+}
+
+static bool callsItself(IrFun* fun) {
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    for (size_t j = 0; j < ywvecLen(block->insns); j++) {
+      IrInsn* insn = ywvecGet(block->insns, j);
+      if (IR_CALL == insn->op && !strcmp(insn->callee, fun->name))
+        return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * The callee of a call worth inlining: a function of this file taking
+ * as many arguments as passed, not recursive and small enough, or
+ * static and called from nowhere else, so no copy of it is left.
+ */
+static IrFun* inlineCandidate(IrFun* caller, IrInsn* call, ywvec* funs, int level) {
+  IrFun* callee = NULL;
+  for (size_t i = 0; i < ywvecLen(funs); i++) {
+    IrFun* fun = ywvecGet(funs, i);
+    if (!strcmp(fun->name, call->callee))
+      callee = fun;
+  }
+  if (!callee || callee == caller || callee->nparams != (int)ywvecLen(call->args) ||
+      callsItself(callee))
+    return NULL;
+  int limit = (2 <= level) ? INLINE_SIZE_O2 : INLINE_SIZE_O1;
+  if (callee->ast->fun_inline)
+    limit *= 3;
+  if (callee->ast->fun_static && 1 == irCallSites(funs, callee->name))
+    return callee;
+  return funSize(callee) <= limit ? callee : NULL;
+}
+
+static IrValue* mapSlot(IrValue* v, IrSlot** slots) {
+  if (!v || IRV_SLOT != v->kind)
+    return v;
+  return irSlotAddr(slots[v->slot->id], v->slot_offset);
+}
+
+static int compareRpo(const void* a, const void* b) {
+  return (*(IrBlock**)a)->rpo - (*(IrBlock**)b)->rpo;
+}
+
+/**
+ * Split the block of call after it and put copies of the blocks of callee
+ * in between. Parameters become copies of the arguments and returns
+ * store the result to a new slot, read where the call was.
+ */
+static IrBlock* inlineCall(IrFun* fun, IrBlock* block, IrInsn* call, IrFun* callee) {
+  irRequire(callee, ANALYSIS_CFG);
+  int at = ywvecIndex(block->insns, call);
+  if (call->tail) {
+    call->tail = false;
+    call->dst = irNewReg(fun, call->type);
+    ywvecInsert(block->insns, at + 1, irNewInsn(IR_RET, IRT_VOID, NULL, call->dst, NULL));
+  }
+  IrBlock* rest = irNewBlock(fun);
+  ywvecPop(fun->blocks);
+  ywvecInsert(fun->blocks, ywvecIndex(fun->blocks, block) + 1, rest);
+  IrSlot* result = NULL;
+  if (call->dst) {
+    result = irNewSlot(fun, "ret", NULL, irTypeSize(call->type));
+    ywvecPush(rest->insns,
+              irNewInsn(IR_LOAD, call->type, call->dst, irSlotAddr(result, 0), NULL));
+  }
+  while (at + 1 < (int)ywvecLen(block->insns)) {
+    ywvecPush(rest->insns, ywvecGet(block->insns, at + 1));
+    ywvecRemove(block->insns, at + 1);
+  }
+  ywvecPop(block->insns);
+
+  IrSlot** slots = calloc(callee->slot_seq + 1, sizeof(IrSlot*));
+  for (size_t i = 0; i < ywvecLen(callee->slots); i++) {
+    IrSlot* slot = ywvecGet(callee->slots, i);
+    slots[slot->id] = irNewSlot(fun, slot->name, slot->var, slot->size);
+    slots[slot->id]->align = slot->align;
+  }
+  // reachable blocks of the callee, laid out in its order before rest
+  size_t nblocks = 0;
+  IrBlock** order = malloc(ywvecLen(callee->blocks) * sizeof(IrBlock*));
+  IrBlock** copies = calloc(callee->block_seq + 1, sizeof(IrBlock*));
+  int pos = ywvecIndex(fun->blocks, rest);
+  for (size_t i = 0; i < ywvecLen(callee->blocks); i++) {
+    IrBlock* orig = ywvecGet(callee->blocks, i);
+    if (orig->rpo < 0)
+      continue;
+    order[nblocks++] = orig;
+    copies[orig->id] = irNewBlock(fun);
+    ywvecPop(fun->blocks);
+    ywvecInsert(fun->blocks, pos++, copies[orig->id]);
+  }
+  // definitions are copied before their uses
+  qsort(order, nblocks, sizeof(IrBlock*), compareRpo);
+  IrValue** map = calloc(ywvecLen(callee->regs) + 1, sizeof(IrValue*));
+  for (size_t i = 0; i < nblocks; i++) {
+    IrBlock* copy = copies[order[i]->id];
+    for (size_t j = 0; j < ywvecLen(order[i]->insns); j++) {
+      IrInsn* insn = irCloneInsn(fun, ywvecGet(order[i]->insns, j), map);
+      insn->a = mapSlot(insn->a, slots);
+      insn->b = mapSlot(insn->b, slots);
+      for (size_t k = 0; insn->args && k < ywvecLen(insn->args); k++)
+        ywvecSet(insn->args, k, mapSlot(ywvecGet(insn->args, k), slots));
+      if (insn->target)
+        insn->target = copies[insn->target->id];
+      if (insn->els)
+        insn->els = copies[insn->els->id];
+      for (size_t k = 0; insn->cases && k < ywvecLen(insn->cases); k++)
+        ywvecSet(insn->cases, k, copies[((IrBlock*)ywvecGet(insn->cases, k))->id]);
+      if (insn->tail) {
+        // the result of a tail call is returned through the result slot
+        insn->tail = false;
+        insn->dst = irNewReg(fun, insn->type);
+        ywvecPush(copy->insns, insn);
+        insn = irNewInsn(IR_RET, IRT_VOID, NULL, insn->dst, NULL);
+      }
+      if (IR_PARAM == insn->op) {
+        IrValue* arg = ywvecGet(call->args, insn->index);
+        // narrower parameters see the argument converted to their type
+        insn->op = (IRT_PTR != insn->type && arg->type != insn->type) ? IR_CAST : IR_MOV;
+        insn->a = arg;
+      } else if (IR_RET == insn->op) {
+        if (result)
+          ywvecPush(copy->insns,
+                    irNewInsn(IR_STORE, call->type, NULL, irSlotAddr(result, 0), insn->a));
+        insn = irNewInsn(IR_JMP, IRT_VOID, NULL, NULL, NULL);
+        insn->target = rest;
+      }
+      ywvecPush(copy->insns, insn);
+    }
+  }
+  IrInsn* jmp = irNewInsn(IR_JMP, IRT_VOID, NULL, NULL, NULL);
+  jmp->target = copies[((IrBlock*)ywvecGet(callee->blocks, 0))->id];
+  ywvecPush(block->insns, jmp);
+  free(slots);
+  free(order);
+  free(copies);
+  free(map);
+  irInvalidate(fun, 0);
+  return rest;
+}
+
+/**
+ * Inline calls to small functions of funs in fun. Code copied from a
+ * callee is not looked at again, so recursion through several
+ * functions stops after one level.
+ */
+bool irInlineCalls(IrFun* fun, ywvec* funs, int level) {
+  if (!inline_enabled || level < 1)
+    return false;
+  bool changed = false;
+  ywvec* work = ywvecCreate();
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++)
+    ywvecPush(work, ywvecGet(fun->blocks, i));
+  for (size_t i = 0; i < ywvecLen(work); i++) {
+    IrBlock* block = ywvecGet(work, i);
+    for (size_t j = 0; j < ywvecLen(block->insns); j++) {
+      IrInsn* insn = ywvecGet(block->insns, j);
+      IrFun* callee = IR_CALL == insn->op ? inlineCandidate(fun, insn, funs, level) : NULL;
+      if (!callee || MAX_CALLER_SIZE < funSize(fun))
+        continue;
+      ywvecPush(work, inlineCall(fun, block, insn, callee));
+      changed = true;
+      break;
+    }
+  }
+  return changed;
+}
@@ -0,0 +1,438 @@
+// ir.c
+// three-address intermediate representation
+// Copyright (C) 2018: see LICENSE
+#include "ir.h"
+#include "parser.h"
+#include "util.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+IrValue* irImm(int type, long imm) {
+  IrValue* ret = malloc(sizeof(IrValue));
+  ret->kind = IRV_IMM;
+  ret->type = type;
+  ret->imm = imm;
+  return ret;
+}
+
+IrValue* irSym(char* sym, int offset) {
+  IrValue* ret = malloc(sizeof(IrValue));
+  ret->kind = IRV_SYM;
+  ret->type = IRT_PTR;
+  ret->sym = sym;
+  ret->sym_offset = offset;
+  return ret;
+}
+
+IrValue* irSlotAddr(IrSlot* slot, int offset) {
+  IrValue* ret = malloc(sizeof(IrValue));
+  ret->kind = IRV_SLOT;
+  ret->type = IRT_PTR;
+  ret->slot = slot;
+  ret->slot_offset = offset;
+  return ret;
+}
+
+IrValue* irNewReg(IrFun* fun, int type) {
+  IrValue* ret = malloc(sizeof(IrValue));
+  ret->kind = IRV_REG;
+  ret->type = type;
+  ret->reg = ywvecLen(fun->regs);
+  ywvecPush(fun->regs, ret);
+  return ret;
+}
+
+IrSlot* irNewSlot(IrFun* fun, char* name, Ast* var, int size) {
+  IrSlot* ret = malloc(sizeof(IrSlot));
+  ret->id = fun->slot_seq++;
+  ret->name = name;
+  ret->var = var;
+  ret->size = size;
+  ret->align = 8;
+  ret->offset = 0;
+  ywvecPush(fun->slots, ret);
+  return ret;
+}
+
+IrBlock* irNewBlock(IrFun* fun) {
+  IrBlock* ret = malloc(sizeof(IrBlock));
+  ret->id = fun->block_seq++;
+  ret->label = createNextLabel();
+  ret->insns = ywvecCreate();
+  ret->preds = ywvecCreate();
+  ret->succs = ywvecCreate();
+  ret->idom = NULL;
+  ret->dom_children = ywvecCreate();
+  ret->rpo = -1;
+  ret->live_in = NULL;
+  ret->live_out = NULL;
+  ret->no_vectorize = false;
+  ret->align = false;
+  ywvecPush(fun->blocks, ret);
+  return ret;
+}
+
+IrInsn* irNewInsn(int op, int type, IrValue* dst, IrValue* a, IrValue* b) {
+  IrInsn* ret = malloc(sizeof(IrInsn));
+  ret->op = op;
+  ret->type = type;
+  ret->dst = dst;
+  ret->a = a;
+  ret->b = b;
+  ret->index = 0;
+  ret->callee = NULL;
+  ret->args = NULL;
+  ret->target = NULL;
+  ret->els = NULL;
+  ret->cases = NULL;
+  ret->tail = false;
+  ret->likely = 0;
+  return ret;
+}
+
+static IrValue* mapValue(IrValue* v, IrValue** map) {
+  return (irIsReg(v) && map[v->reg]) ? map[v->reg] : v;
+}
+
+IrInsn* irCloneInsn(IrFun* fun, IrInsn* insn, IrValue** map) {
+  IrInsn* ret = irNewInsn(insn->op, insn->type, NULL, NULL, NULL);
+  *ret = *insn;
+  if (insn->a)
+    ret->a = mapValue(insn->a, map);
+  if (insn->b)
+    ret->b = mapValue(insn->b, map);
+  if (insn->args) {
+    ret->args = ywvecCreate();
+    for (size_t i = 0; i < ywvecLen(insn->args); i++)
+      ywvecPush(ret->args, mapValue(ywvecGet(insn->args, i), map));
+  }
+  if (insn->cases) {
+    ret->cases = ywvecCreate();
+    for (size_t i = 0; i < ywvecLen(insn->cases); i++)
+      ywvecPush(ret->cases, ywvecGet(insn->cases, i));
+  }
+  if (insn->dst) {
+    ret->dst = irNewReg(fun, insn->dst->type);
+    map[insn->dst->reg] = ret->dst;
+  }
+  return ret;
+}
+
+IrFun* irNewFun(char* name, Ast* ast) {
+  IrFun* ret = malloc(sizeof(IrFun));
+  ret->name = name;
+  ret->ast = ast;
+  ret->nparams = 0;
+  ret->blocks = ywvecCreate();
+  ret->block_seq = 0;
+  ret->slots = ywvecCreate();
+  ret->slot_seq = 0;
+  ret->regs = ywvecCreate();
+  ret->loops = ywvecCreate();
+  ret->valid = 0;
+  return ret;
+}
+
+bool irIsReg(IrValue* v) {
+  return v && IRV_REG == v->kind;
+}
+
+bool irIsImm(IrValue* v, long imm) {
+  return v && IRV_IMM == v->kind && v->imm == imm;
+}
+
+bool irIsTerminator(IrInsn* insn) {
+  return IR_JMP == insn->op || IR_BR == insn->op || IR_SWITCH == insn->op || IR_RET == insn->op ||
+         (IR_CALL == insn->op && insn->tail);
+}
+
+bool irHasSideEffect(IrInsn* insn) {
+  switch (insn->op) {
+  case IR_STORE:
+  case IR_COPY:
+  case IR_CALL:
+  case IR_JMP:
+  case IR_BR:
+  case IR_SWITCH:
+  case IR_RET:
+    return true;
+  case IR_DIV:
+    // division by zero traps
+    return IRV_IMM != insn->b->kind || 0 == insn->b->imm;
+  default:
+    return false;
+  }
+}
+
+IrInsn* irTerminator(IrBlock* block) {
+  size_t n = ywvecLen(block->insns);
+  if (!n)
+    return NULL;
+  IrInsn* last = ywvecGet(block->insns, n - 1);
+  return irIsTerminator(last) ? last : NULL;
+}
+
+bool irLoopContains(IrLoop* loop, IrBlock* block) {
+  return block->id < loop->members->length && ywbitsGet(loop->members, block->id);
+}
+
+ywbits* irEscapedSlots(IrFun* fun) {
+  ywbits* ret = ywbitsCreate(fun->slot_seq);
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    for (size_t j = 0; j < ywvecLen(block->insns); j++) {
+      IrInsn* insn = ywvecGet(block->insns, j);
+      IrValue** uses[IR_MAX_USES];
+      int nuses = irUses(insn, uses);
+      for (int k = 0; k < nuses; k++)
+        if (IRV_SLOT == (*uses[k])->kind &&
+            !((IR_LOAD == insn->op || IR_STORE == insn->op) && uses[k] == &insn->a))
+          ywbitsSet(ret, (*uses[k])->slot->id);
+    }
+  }
+  return ret;
+}
+
+/**
+ * A store, copy or call may change the memory read by load unless the
+ * load reads a slot whose address never escapes and the write is to
+ * another slot or through a pointer.
+ */
+bool irMayClobber(IrInsn* write, IrInsn* load, ywbits* escaped) {
+  IrValue* from = load->a;
+  bool private = IRV_SLOT == from->kind && !ywbitsGet(escaped, from->slot->id);
+  if (IR_CALL == write->op)
+    return !private;
+  IrValue* to = write->a;
+  if (IRV_SLOT == from->kind && IRV_SLOT == to->kind)
+    return from->slot == to->slot;
+  if (IRV_SYM == from->kind)
+    // string literals are only written through pointers
+    return IRV_SLOT != to->kind;
+  return !private && !(IRV_SLOT == to->kind && !ywbitsGet(escaped, to->slot->id));
+}
+
+static bool isRestrictParam(IrFun* fun, int index) {
+  ywiter* i = ywlistIter(fun->ast->params);
+  for (int k = 0; k < index && !ywiterEnd(i); k++)
+    ywiterNext(i);
+  return !ywiterEnd(i) && ((Ast*)ywiterNext(i))->rt_type->restricted;
+}
+
+// registers whose base is not computed yet
+#define BASE_PENDING -4
+
+static int addressBase(int* bases, IrValue* v) {
+  if (IRV_SLOT == v->kind || IRV_SYM == v->kind)
+    return IR_BASE_LOCAL;
+  return irIsReg(v) ? bases[v->reg] : IR_BASE_UNKNOWN;
+}
+
+static int baseOf(IrFun* fun, IrInsn** defs, int* bases, IrValue* v) {
+  int base = addressBase(bases, v);
+  if (BASE_PENDING != base)
+    return base;
+  bases[v->reg] = base = IR_BASE_UNKNOWN;
+  IrInsn* def = defs[v->reg];
+  if (!def || IRT_PTR != def->type)
+    return base;
+  if (IR_PARAM == def->op) {
+    base = isRestrictParam(fun, def->index) ? def->index : IR_BASE_PARAM;
+  } else if (IR_MOV == def->op) {
+    base = baseOf(fun, defs, bases, def->a);
+  } else if (IR_ADD == def->op || IR_SUB == def->op) {
+    // the base of an address is added an offset whose base is unknown
+    int a = baseOf(fun, defs, bases, def->a);
+    int b = baseOf(fun, defs, bases, def->b);
+    if (IR_BASE_UNKNOWN == b)
+      base = a;
+    else if (IR_ADD == def->op && IR_BASE_UNKNOWN == a)
+      base = b;
+  }
+  bases[v->reg] = base;
+  return base;
+}
+
+int* irAddressBases(IrFun* fun) {
+  size_t nregs = ywvecLen(fun->regs);
+  IrInsn** defs = calloc(nregs + 1, sizeof(IrInsn*));
+  int* bases = malloc((nregs + 1) * sizeof(int));
+  for (size_t r = 0; r <= nregs; r++)
+    bases[r] = BASE_PENDING;
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    for (size_t j = 0; j < ywvecLen(block->insns); j++) {
+      IrInsn* insn = ywvecGet(block->insns, j);
+      if (insn->dst)
+        defs[insn->dst->reg] = insn;
+    }
+  }
+  for (size_t r = 0; r < nregs; r++)
+    baseOf(fun, defs, bases, ywvecGet(fun->regs, r));
+  free(defs);
+  return bases;
+}
+
+/**
+ * The object a restrict qualified parameter points to is only accessed
+ * through pointers based on it while the function runs, and other
+ * parameters, locals and literals are other objects.
+ */
+bool irRestrictDisjoint(int* bases, IrValue* a, IrValue* b) {
+  int x = addressBase(bases, a);
+  int y = addressBase(bases, b);
+  return x != y && (0 <= x || 0 <= y) && IR_BASE_UNKNOWN != x && IR_BASE_UNKNOWN != y;
+}
+
+int irUses(IrInsn* insn, IrValue** uses[IR_MAX_USES]) {
+  int n = 0;
+  if (insn->a)
+    uses[n++] = &insn->a;
+  if (insn->b)
+    uses[n++] = &insn->b;
+  if (insn->args)
+    for (size_t i = 0; i < ywvecLen(insn->args); i++)
+      uses[n++] = (IrValue**)&insn->args->elements[i];
+  return n;
+}
+
+int irTypeOf(rt_t* rt_type) {
+  switch (rt_type->type) {
+  case RT_CHAR:
+    return IRT_I8;
+  case RT_INT:
+    return IRT_I32;
+  case RT_PTR:
+  case RT_ARRAY:
+    return IRT_PTR;
+  }
+  return IRT_VOID;
+}
+
+int irTypeSize(int type) {
+  switch (type) {
+  case IRT_I8:
+    return 1;
+  case IRT_I32:
+    return 4;
+  case IRT_PTR:
+    return 8;
+  case IRT_V16I8:
+  case IRT_V4I32:
+    return 16;
+  }
+  error("Unknown IR type %d", type);
+}
+
+bool irIsVector(int type) {
+  return IRT_V16I8 == type || IRT_V4I32 == type;
+}
+
+int irLaneType(int type) {
+  return (IRT_V16I8 == type) ? IRT_I8 : IRT_I32;
+}
+
+static char* IR_TYPE_NAMES[] = {"void", "i8", "i32", "ptr", "v16i8", "v4i32"};
+
+static char* IR_OP_NAMES[] = {
+  "param", "mov", "add", "sub", "mul", "div", "shl", "shr", "sar", "lt", "le", "gt",
+  "ge", "eq", "ne", "cast", "splat", "reduce", "load", "store", "copy", "call", "jmp", "br",
+  "switch", "ret",
+};
+
+static void irValueToSBuffer(IrValue* v, ywstr* ys) {
+  switch (v->kind) {
+  case IRV_REG:
+    ywstrAppendFormat(ys, "%%%d", v->reg);
+    break;
+  case IRV_IMM:
+    ywstrAppendFormat(ys, "%ld", v->imm);
+    break;
+  case IRV_SYM:
+    ywstrAppendFormat(ys, "&%s", v->sym);
+    if (v->sym_offset)
+      ywstrAppendFormat(ys, "%+d", v->sym_offset);
+    break;
+  case IRV_SLOT:
+    ywstrAppendFormat(ys, "&%s", v->slot->name);
+    if (v->slot_offset)
+      ywstrAppendFormat(ys, "%+d", v->slot_offset);
+    break;
+  }
+}
+
+static void irInsnToSBuffer(IrInsn* insn, ywstr* ys) {
+  ywstrAppendFormat(ys, "  ");
+  if (insn->dst) {
+    irValueToSBuffer(insn->dst, ys);
+    ywstrAppendFormat(ys, ":%s = ", IR_TYPE_NAMES[insn->dst->type]);
+  }
+  if (insn->tail)
+    ywstrAppendFormat(ys, "tail ");
+  ywstrAppendFormat(ys, "%s", IR_OP_NAMES[insn->op]);
+  switch (insn->op) {
+  case IR_LOAD:
+  case IR_STORE:
+  case IR_CAST:
+    ywstrAppendFormat(ys, ".%s", IR_TYPE_NAMES[insn->type]);
+    break;
+  case IR_PARAM:
+  case IR_COPY:
+    ywstrAppendFormat(ys, " %d", insn->index);
+    break;
+  case IR_CALL:
+    ywstrAppendFormat(ys, " %s(", insn->callee);
+    for (size_t i = 0; i < ywvecLen(insn->args); i++) {
+      if (i)
+        ywstrAppendFormat(ys, ", ");
+      irValueToSBuffer(ywvecGet(insn->args, i), ys);
+    }
+    ywstrAppend(ys, ')');
+    break;
+  }
+  if (insn->a) {
+    ywstrAppend(ys, ' ');
+    irValueToSBuffer(insn->a, ys);
+  }
+  if (insn->b) {
+    ywstrAppendFormat(ys, ", ");
+    irValueToSBuffer(insn->b, ys);
+  }
+  if (insn->target)
+    ywstrAppendFormat(ys, "%sB%d", insn->a ? ", " : " ", insn->target->id);
+  if (insn->els)
+    ywstrAppendFormat(ys, ", B%d", insn->els->id);
+  if (insn->likely)
+    ywstrAppendFormat(ys, " likely B%d", (0 < insn->likely ? insn->target : insn->els)->id);
+  if (insn->cases) {
+    ywstrAppendFormat(ys, " [%d:", insn->index);
+    for (size_t i = 0; i < ywvecLen(insn->cases); i++)
+      ywstrAppendFormat(ys, " B%d", ((IrBlock*)ywvecGet(insn->cases, i))->id);
+    ywstrAppend(ys, ']');
+  }
+  ywstrAppend(ys, '\n');
+}
+
+char* irFunToS(IrFun* fun) {
+  ywstr* ys = ywstrCreate("");
+  ywstrAppendFormat(ys, "fun %s {\n", fun->name);
+  for (size_t i = 0; i < ywvecLen(fun->slots); i++) {
+    IrSlot* slot = ywvecGet(fun->slots, i);
+    ywstrAppendFormat(ys, "  slot %s[%d]\n", slot->name, slot->size);
+  }
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    ywstrAppendFormat(ys, "B%d:", block->id);
+    if (ywvecLen(block->preds)) {
+      ywstrAppendFormat(ys, " ; preds");
+      for (size_t j = 0; j < ywvecLen(block->preds); j++)
+        ywstrAppendFormat(ys, " B%d", ((IrBlock*)ywvecGet(block->preds, j))->id);
+    }
+    ywstrAppend(ys, '\n');
+    for (size_t j = 0; j < ywvecLen(block->insns); j++)
+      irInsnToSBuffer(ywvecGet(block->insns, j), ys);
+  }
+  ywstrAppendFormat(ys, "}\n");
+  return ywstrGet(ys);
+}
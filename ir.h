@@ -0,0 +1,239 @@
+// ir.h
+// three-address intermediate representation
+// Copyright (C) 2018: see LICENSE
+#ifndef _YOWAIC_IR_H_
+#define _YOWAIC_IR_H_
+#include "parser.h"
+#include "util.h"
+#include <stdbool.h>
+
+// type of IR value, every value lives in a 64-bit register but vectors,
+// which live in 16-byte SSE registers
+enum {
+  IRT_VOID,
+  IRT_I8,
+  IRT_I32,
+  IRT_PTR,
+  IRT_V16I8,
+  IRT_V4I32,
+};
+
+// kind of IR value
+enum {
+  IRV_REG,
+  IRV_IMM,
+  IRV_SYM,
+  IRV_SLOT,
+};
+
+// a stack allocated object: a local variable or a spilled register
+typedef struct IrSlot {
+  int id;
+  char* name;
+  Ast* var;
+  int size;
+  int align;
+  // offset below %rbp, assigned by the generator
+  int offset;
+} IrSlot;
+
+typedef struct IrValue {
+  int kind;
+  int type;
+  union {
+    // Virtual register
+    int reg;
+    // Integer constant
+    long imm;
+    // Address of a label
+    struct {
+      char* sym;
+      int sym_offset;
+    };
+    // Address of a frame slot
+    struct {
+      IrSlot* slot;
+      int slot_offset;
+    };
+  };
+} IrValue;
+
+// kind of IR instruction
+enum {
+  IR_PARAM,
+  IR_MOV,
+  IR_ADD,
+  IR_SUB,
+  IR_MUL,
+  IR_DIV,
+  IR_SHL,
+  IR_SHR,
+  IR_SAR,
+  IR_LT,
+  IR_LE,
+  IR_GT,
+  IR_GE,
+  IR_EQ,
+  IR_NE,
+  IR_CAST,
+  IR_SPLAT,
+  IR_REDUCE,
+  IR_LOAD,
+  IR_STORE,
+  IR_COPY,
+  IR_CALL,
+  IR_JMP,
+  IR_BR,
+  IR_SWITCH,
+  IR_RET,
+};
+
+/**
+ * dst = a op b
+ * IR_SHL, IR_SHR, IR_SAR: shifts of the full 64-bit register
+ * IR_PARAM: dst = incoming argument number index
+ * IR_CAST:  dst = a truncated to type and sign extended again
+ * IR_SPLAT: dst = vector of type with a in every lane
+ * IR_REDUCE: dst = sum of the lanes of the vector a
+ * Arithmetic and comparisons of vector type work lane by lane, a
+ * comparison giving 1 or 0 in each lane.
+ * IR_LOAD:  dst = *a, type is the width of the memory access
+ * IR_STORE: *a = b, type is the width of the memory access
+ * IR_COPY:  index bytes at a = those at b, or zeros without b
+ * IR_CALL:  dst = callee(args...), or return callee(args...) ending the
+ *           block when tail is set
+ * IR_JMP:   goto target
+ * IR_BR:    if (a) goto target else goto els
+ * IR_SWITCH: goto cases[a - index] if a - index is within cases, else
+ *           goto els
+ * IR_RET:   return a
+ */
+typedef struct IrInsn {
+  int op;
+  int type;
+  IrValue* dst;
+  IrValue* a;
+  IrValue* b;
+  int index;
+  char* callee;
+  ywvec* args;
+  struct IrBlock* target;
+  struct IrBlock* els;
+  // blocks of IR_SWITCH, by value from index up
+  ywvec* cases;
+  bool tail;
+  // for IR_BR, 1 when target is the likely successor, -1 when els is
+  int likely;
+} IrInsn;
+
+typedef struct IrBlock {
+  int id;
+  char* label;
+  ywvec* insns;
+  // filled by the CFG analysis
+  ywvec* preds;
+  ywvec* succs;
+  // filled by the dominator analysis
+  struct IrBlock* idom;
+  ywvec* dom_children;
+  int rpo;
+  // filled by the liveness analysis
+  ywbits* live_in;
+  ywbits* live_out;
+  // header of a loop that stays scalar, such as the one finishing the
+  // iterations left over by a vectorized loop
+  bool no_vectorize;
+  // loop header placed at a 16-byte boundary by the layout pass
+  bool align;
+} IrBlock;
+
+// natural loop, filled by the loop analysis
+typedef struct IrLoop {
+  IrBlock* header;
+  // blocks of the loop, the header first, in layout order
+  ywvec* blocks;
+  // bit set of the ids of the blocks
+  ywbits* members;
+  // blocks with a back edge to the header
+  ywvec* latches;
+  // the only block outside the loop jumping to the header, if any
+  IrBlock* preheader;
+  // innermost enclosing loop
+  struct IrLoop* parent;
+  int depth;
+} IrLoop;
+
+typedef struct IrFun {
+  char* name;
+  Ast* ast;
+  int nparams;
+  // blocks[0] is the entry block
+  ywvec* blocks;
+  int block_seq;
+  ywvec* slots;
+  int slot_seq;
+  // every virtual register, indexed by its number
+  ywvec* regs;
+  // filled by the loop analysis, inner loops first
+  ywvec* loops;
+  // bit set of analyses that are up to date
+  unsigned valid;
+} IrFun;
+
+// constant image of a local array initializer, placed in .rodata
+typedef struct IrData {
+  char* label;
+  char* bytes;
+  int size;
+} IrData;
+
+// images of the initializers of every function lowered so far
+extern ywvec* ir_rodata;
+
+IrValue* irImm(int type, long imm);
+IrValue* irSym(char* sym, int offset);
+IrValue* irSlotAddr(IrSlot* slot, int offset);
+IrValue* irNewReg(IrFun* fun, int type);
+IrSlot* irNewSlot(IrFun* fun, char* name, Ast* var, int size);
+IrBlock* irNewBlock(IrFun* fun);
+IrInsn* irNewInsn(int op, int type, IrValue* dst, IrValue* a, IrValue* b);
+// copy of insn defining fresh registers, mapping registers through map
+IrInsn* irCloneInsn(IrFun* fun, IrInsn* insn, IrValue** map);
+IrFun* irNewFun(char* name, Ast* ast);
+
+bool irIsReg(IrValue* v);
+bool irIsImm(IrValue* v, long imm);
+bool irIsTerminator(IrInsn* insn);
+bool irHasSideEffect(IrInsn* insn);
+IrInsn* irTerminator(IrBlock* block);
+bool irLoopContains(IrLoop* loop, IrBlock* block);
+// slots, by id, whose address is used other than to load or store them
+ywbits* irEscapedSlots(IrFun* fun);
+// whether a store, copy or call may change the memory load reads
+bool irMayClobber(IrInsn* write, IrInsn* load, ywbits* escaped);
+// what an address is computed from, other than the number of a restrict
+// qualified pointer parameter
+enum {
+  IR_BASE_UNKNOWN = -1,
+  // a slot or label of the function
+  IR_BASE_LOCAL = -2,
+  // a parameter not qualified restrict
+  IR_BASE_PARAM = -3,
+};
+// what every register, by number, is computed from by adding offsets
+int* irAddressBases(IrFun* fun);
+// whether memory at addresses a and b never overlaps because one of them
+// is based on a restrict qualified parameter the other is not based on
+bool irRestrictDisjoint(int* bases, IrValue* a, IrValue* b);
+#define IR_MAX_USES 8
+// collect pointers to the operands an instruction reads, returns how many
+int irUses(IrInsn* insn, IrValue** uses[IR_MAX_USES]);
+int irTypeOf(rt_t* rt_type);
+int irTypeSize(int type);
+bool irIsVector(int type);
+// type of the lanes of a vector type
+int irLaneType(int type);
+
+IrFun* irLowerFun(Ast* fun);
+char* irFunToS(IrFun* fun);
+#endif
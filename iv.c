@@ -0,0 +1,327 @@
+// iv.c
+// induction variable strength reduction
+// Copyright (C) 2018: see LICENSE
+#include "pass.h"
+#include "ir.h"
+#include "util.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+/**
+ * A basic induction variable is a local whose only store in a loop is
+ * `store &s, (load &s) + step`, executed on every iteration.
+ */
+typedef struct Iv {
+  IrSlot* slot;
+  long step;
+  IrBlock* block;
+  IrInsn* store;
+  // the pointer kept equal to base + s * scale, once one is derived
+  IrSlot* ptr;
+  IrValue* base;
+  long scale;
+} Iv;
+
+// function being optimized, defining instruction and block of every register
+static IrFun* fun;
+static IrInsn** def;
+static IrBlock** def_block;
+static size_t nregs;
+
+static void findDefs() {
+  nregs = ywvecLen(fun->regs);
+  def = calloc(nregs + 1, sizeof(IrInsn*));
+  def_block = calloc(nregs + 1, sizeof(IrBlock*));
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    for (size_t j = 0; j < ywvecLen(block->insns); j++) {
+      IrInsn* insn = ywvecGet(block->insns, j);
+      if (insn->dst) {
+        def[insn->dst->reg] = insn;
+        def_block[insn->dst->reg] = block;
+      }
+    }
+  }
+}
+
+// registers created by this pass are neither invariant nor loads
+static IrInsn* defOf(IrValue* v) {
+  return irIsReg(v) && (size_t)v->reg <= nregs ? def[v->reg] : NULL;
+}
+
+static bool isInvariant(IrValue* v, IrLoop* loop) {
+  if (!irIsReg(v))
+    return true;
+  IrInsn* insn = defOf(v);
+  return insn && !irLoopContains(loop, def_block[v->reg]);
+}
+
+// load of the whole of slot, or NULL
+static IrInsn* slotLoad(IrValue* v, IrSlot* slot) {
+  IrInsn* insn = defOf(v);
+  if (!insn || IR_LOAD != insn->op || IRT_I32 != insn->type || IRV_SLOT != insn->a->kind ||
+      insn->a->slot != slot || insn->a->slot_offset)
+    return NULL;
+  return insn;
+}
+
+static bool isSlotStore(IrInsn* insn, IrSlot* slot) {
+  return IR_STORE == insn->op && IRV_SLOT == insn->a->kind && insn->a->slot == slot;
+}
+
+static bool dominatesLatches(IrBlock* block, IrLoop* loop) {
+  for (size_t i = 0; i < ywvecLen(loop->latches); i++)
+    if (!irDominates(block, ywvecGet(loop->latches, i)))
+      return false;
+  return true;
+}
+
+// basic induction variable stored by insn, or NULL
+static Iv* basicIv(IrInsn* insn, IrBlock* block, IrLoop* loop, ywbits* escaped, ywvec* stores) {
+  if (IR_STORE != insn->op || IRT_I32 != insn->type || IRV_SLOT != insn->a->kind ||
+      insn->a->slot_offset || ywbitsGet(escaped, insn->a->slot->id))
+    return NULL;
+  IrSlot* slot = insn->a->slot;
+  for (size_t i = 0; i < ywvecLen(stores); i++) {
+    IrInsn* other = ywvecGet(stores, i);
+    if (other != insn && isSlotStore(other, slot))
+      return NULL;
+  }
+  IrInsn* add = defOf(insn->b);
+  if (!add || IR_ADD != add->op)
+    return NULL;
+  IrValue* step = add->b;
+  IrInsn* load = slotLoad(add->a, slot);
+  if (!load) {
+    step = add->a;
+    load = slotLoad(add->b, slot);
+  }
+  if (!load || IRV_IMM != step->kind || block != def_block[load->dst->reg] ||
+      !dominatesLatches(block, loop))
+    return NULL;
+  Iv* iv = calloc(1, sizeof(Iv));
+  iv->slot = slot;
+  iv->step = step->imm;
+  iv->block = block;
+  iv->store = insn;
+  return iv;
+}
+
+static void insertBefore(IrBlock* block, IrInsn* pos, IrInsn* insn) {
+  ywvecInsert(block->insns, ywvecIndex(block->insns, pos), insn);
+}
+
+static void insertAfter(IrBlock* block, IrInsn* pos, IrInsn* insn) {
+  ywvecInsert(block->insns, ywvecIndex(block->insns, pos) + 1, insn);
+}
+
+static IrValue* emitBefore(IrBlock* block, IrInsn* pos, int op, int type, IrValue* a, IrValue* b) {
+  IrValue* dst = irNewReg(fun, type);
+  insertBefore(block, pos, irNewInsn(op, type, dst, a, b));
+  return dst;
+}
+
+// base + index * scale computed at the end of the preheader
+static IrValue* scaledAddress(IrLoop* loop, IrValue* base, IrValue* index, long scale) {
+  IrBlock* pre = loop->preheader;
+  IrInsn* term = irTerminator(pre);
+  if (IRV_IMM == index->kind && IRV_SLOT == base->kind)
+    return irSlotAddr(base->slot, base->slot_offset + index->imm * scale);
+  if (IRV_IMM == index->kind && IRV_SYM == base->kind)
+    return irSym(base->sym, base->sym_offset + index->imm * scale);
+  IrValue* offset = index;
+  int k = 0;
+  while (1L << k < scale)
+    k++;
+  if (1L << k == scale && k)
+    offset = emitBefore(pre, term, IR_SHL, IRT_PTR, index, irImm(IRT_I32, k));
+  else if (1 != scale)
+    offset = emitBefore(pre, term, IR_MUL, IRT_PTR, index, irImm(IRT_I32, scale));
+  return emitBefore(pre, term, IR_ADD, IRT_PTR, base, offset);
+}
+
+/**
+ * add base, (load &s) * scale, in a block where s is not stored between
+ * the load and the add, gives the scale of a derived induction variable
+ */
+static long derivedScale(IrInsn* add, IrBlock* block, Iv* iv, IrLoop* loop, IrValue** base) {
+  if (IR_ADD != add->op || IRT_PTR != add->type)
+    return 0;
+  IrValue* index = add->b;
+  *base = add->a;
+  if (!isInvariant(*base, loop)) {
+    index = add->a;
+    *base = add->b;
+  }
+  if (!isInvariant(*base, loop) || !irIsReg(index))
+    return 0;
+  long scale = 1;
+  IrInsn* load = slotLoad(index, iv->slot);
+  IrInsn* mul = defOf(index);
+  if (!load && mul && (IR_MUL == mul->op || IR_SHL == mul->op) && IRV_IMM == mul->b->kind &&
+      (IR_MUL == mul->op ? 0 < mul->b->imm : 0 <= mul->b->imm && mul->b->imm < 32)) {
+    scale = (IR_MUL == mul->op) ? mul->b->imm : 1L << mul->b->imm;
+    load = slotLoad(mul->a, iv->slot);
+  }
+  if (!load || block != def_block[load->dst->reg] || block != def_block[index->reg])
+    return 0;
+  if (block == iv->block) {
+    int at = ywvecIndex(block->insns, iv->store);
+    if (ywvecIndex(block->insns, load) < at && at < ywvecIndex(block->insns, add))
+      return 0;
+  }
+  return scale;
+}
+
+/**
+ * Keep base + s * scale in a new pointer slot, set in the preheader and
+ * advanced by step * scale right after s is stored, and read it instead
+ * of recomputing the address.
+ */
+static void reduceDerived(IrLoop* loop, Iv* iv, IrInsn* add, IrValue* base, long scale) {
+  if (!iv->ptr) {
+    iv->ptr = irNewSlot(fun, "iv", NULL, 8);
+    iv->base = base;
+    iv->scale = scale;
+    IrBlock* pre = loop->preheader;
+    IrInsn* term = irTerminator(pre);
+    IrValue* init = emitBefore(pre, term, IR_LOAD, IRT_I32, irSlotAddr(iv->slot, 0), NULL);
+    insertBefore(pre, term, irNewInsn(IR_STORE, IRT_PTR, NULL, irSlotAddr(iv->ptr, 0),
+                                      scaledAddress(loop, base, init, scale)));
+    IrValue* old = irNewReg(fun, IRT_PTR);
+    IrValue* next = irNewReg(fun, IRT_PTR);
+    IrInsn* store = irNewInsn(IR_STORE, IRT_PTR, NULL, irSlotAddr(iv->ptr, 0), next);
+    insertAfter(iv->block, iv->store, store);
+    insertBefore(iv->block, store,
+                 irNewInsn(IR_LOAD, IRT_PTR, old, irSlotAddr(iv->ptr, 0), NULL));
+    insertBefore(iv->block, store,
+                 irNewInsn(IR_ADD, IRT_PTR, next, old, irImm(IRT_I32, iv->step * scale)));
+  }
+  add->op = IR_LOAD;
+  add->a = irSlotAddr(iv->ptr, 0);
+  add->b = NULL;
+}
+
+/**
+ * Loads of s may only remain in the increment, in comparisons with
+ * invariants that decide a branch and before the loop. Then the
+ * comparisons can test the pointer instead and s is no longer needed.
+ */
+static bool replaceTests(IrLoop* loop, Iv* iv) {
+  int* uses = calloc(ywvecLen(fun->regs) + 1, sizeof(int));
+  IrInsn** user = calloc(ywvecLen(fun->regs) + 1, sizeof(IrInsn*));
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    for (size_t j = 0; j < ywvecLen(block->insns); j++) {
+      IrInsn* insn = ywvecGet(block->insns, j);
+      IrValue** ops[IR_MAX_USES];
+      int nops = irUses(insn, ops);
+      for (int k = 0; k < nops; k++)
+        if (irIsReg(*ops[k])) {
+          uses[(*ops[k])->reg]++;
+          user[(*ops[k])->reg] = insn;
+        }
+    }
+  }
+  IrInsn* increment = def[iv->store->b->reg];
+  ywvec* tests = ywvecCreate();
+  bool ok = true;
+  for (size_t i = 0; ok && i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    for (size_t j = 0; ok && j < ywvecLen(block->insns); j++) {
+      IrInsn* load = ywvecGet(block->insns, j);
+      if (!load->dst || slotLoad(load->dst, iv->slot) != load)
+        continue;
+      if (!irLoopContains(loop, block)) {
+        ok = irDominates(block, loop->preheader);
+        continue;
+      }
+      IrInsn* use = user[load->dst->reg];
+      if (1 != uses[load->dst->reg])
+        ok = false;
+      else if (use == increment)
+        ok = 1 == uses[increment->dst->reg];
+      else if (IR_LT <= use->op && use->op <= IR_NE && 1 == uses[use->dst->reg] &&
+               IR_BR == user[use->dst->reg]->op &&
+               isInvariant(use->a == load->dst ? use->b : use->a, loop))
+        ywvecPush(tests, load);
+      else
+        ok = false;
+    }
+  }
+  if (ok && ywvecLen(tests)) {
+    for (size_t i = 0; i < ywvecLen(tests); i++) {
+      IrInsn* load = ywvecGet(tests, i);
+      IrInsn* cmp = user[load->dst->reg];
+      IrValue** bound = (cmp->a == load->dst) ? &cmp->b : &cmp->a;
+      *bound = scaledAddress(loop, iv->base, *bound, iv->scale);
+      load->type = IRT_PTR;
+      load->dst->type = IRT_PTR;
+      load->a = irSlotAddr(iv->ptr, 0);
+    }
+    ywvecRemove(iv->block->insns, ywvecIndex(iv->block->insns, iv->store));
+  }
+  free(uses);
+  free(user);
+  return ok && ywvecLen(tests);
+}
+
+bool runIvStrengthReduction(IrFun* ir) {
+  fun = ir;
+  irRequire(fun, ANALYSIS_LOOPS);
+  findDefs();
+  ywbits* escaped = irEscapedSlots(fun);
+  bool changed = false;
+  ywvec* reduced = ywvecCreate();
+  ywvec* reduced_loops = ywvecCreate();
+  for (size_t i = 0; i < ywvecLen(fun->loops); i++) {
+    IrLoop* loop = ywvecGet(fun->loops, i);
+    if (!loop->preheader)
+      continue;
+    ywvec* stores = ywvecCreate();
+    for (size_t j = 0; j < ywvecLen(loop->blocks); j++) {
+      IrBlock* block = ywvecGet(loop->blocks, j);
+      for (size_t k = 0; k < ywvecLen(block->insns); k++) {
+        IrInsn* insn = ywvecGet(block->insns, k);
+        if (IR_STORE == insn->op)
+          ywvecPush(stores, insn);
+      }
+    }
+    for (size_t j = 0; j < ywvecLen(loop->blocks); j++) {
+      IrBlock* block = ywvecGet(loop->blocks, j);
+      for (size_t k = 0; k < ywvecLen(block->insns); k++) {
+        Iv* iv = basicIv(ywvecGet(block->insns, k), block, loop, escaped, stores);
+        if (!iv)
+          continue;
+        for (size_t m = 0; m < ywvecLen(loop->blocks); m++) {
+          IrBlock* user = ywvecGet(loop->blocks, m);
+          for (size_t n = 0; n < ywvecLen(user->insns); n++) {
+            IrInsn* add = ywvecGet(user->insns, n);
+            IrValue* base;
+            long scale = derivedScale(add, user, iv, loop, &base);
+            if (0 < scale && (!iv->ptr || (scale == iv->scale && base == iv->base))) {
+              reduceDerived(loop, iv, add, base, scale);
+              changed = true;
+            }
+          }
+        }
+        if (iv->ptr) {
+          ywvecPush(reduced, iv);
+          ywvecPush(reduced_loops, loop);
+        }
+      }
+    }
+  }
+  // with the addresses gone, the variable may only be left in its tests
+  if (changed) {
+    runDce(fun);
+    free(def);
+    free(def_block);
+    findDefs();
+    for (size_t i = 0; i < ywvecLen(reduced); i++)
+      replaceTests(ywvecGet(reduced_loops, i), ywvecGet(reduced, i));
+  }
+  free(def);
+  free(def_block);
+  return changed;
+}
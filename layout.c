@@ -0,0 +1,259 @@
+// layout.c
+// jump threading and the order of basic blocks in the emitted code
+// Copyright (C) 2018: see LICENSE
+#include "pass.h"
+#include "ir.h"
+#include "util.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+static bool isOnly(IrBlock* block, int op) {
+  return 1 == ywvecLen(block->insns) && op == ((IrInsn*)ywvecGet(block->insns, 0))->op;
+}
+
+// where an edge of from ends once it skips blocks that only jump, or only
+// branch again on cond, whose value along the edge is taken
+static IrBlock* threadEdge(IrFun* fun, IrBlock* from, IrBlock* to, IrValue* cond, bool taken) {
+  ywbits* seen = ywbitsCreate(fun->block_seq);
+  IrBlock* block = to;
+  for (;;) {
+    if (ywbitsGet(seen, block->id))
+      return to;  // a loop of empty blocks, leave it alone
+    ywbitsSet(seen, block->id);
+    IrInsn* term = irTerminator(block);
+    IrBlock* next = NULL;
+    if (isOnly(block, IR_JMP))
+      next = term->target;
+    else if (cond && isOnly(block, IR_BR) && irIsReg(term->a) && term->a->reg == cond->reg)
+      next = taken ? term->target : term->els;
+    if (!next || next == from)
+      return block;
+    block = next;
+  }
+}
+
+static bool threadJumps(IrFun* fun) {
+  bool changed = false;
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    IrInsn* term = irTerminator(block);
+    for (size_t k = 0; term && term->cases && k < ywvecLen(term->cases); k++) {
+      IrBlock* target = ywvecGet(term->cases, k);
+      IrBlock* threaded = threadEdge(fun, block, target, NULL, false);
+      changed |= threaded != target;
+      ywvecSet(term->cases, k, threaded);
+    }
+    if (!term || IR_RET == term->op || IR_CALL == term->op)
+      continue;
+    IrValue* cond = (IR_BR == term->op && irIsReg(term->a)) ? term->a : NULL;
+    IrBlock* target = term->target ? threadEdge(fun, block, term->target, cond, true) : NULL;
+    IrBlock* els = term->els ? threadEdge(fun, block, term->els, cond, false) : NULL;
+    changed |= target != term->target || els != term->els;
+    term->target = target;
+    term->els = els;
+  }
+  return changed;
+}
+
+// 1 when cond is true at block, -1 when false, as decided by a dominating
+// branch on it that only reaches block through one of its edges
+static int knownCondition(IrBlock* block, IrValue* cond) {
+  for (IrBlock* child = block; child->idom && child->idom != child; child = child->idom) {
+    IrInsn* term = irTerminator(child->idom);
+    if (!term || IR_BR != term->op || term->target == term->els || !irIsReg(term->a) ||
+        term->a->reg != cond->reg || 1 != ywvecLen(child->preds))
+      continue;
+    if (child == term->target)
+      return 1;
+    if (child == term->els)
+      return -1;
+  }
+  return 0;
+}
+
+static bool foldKnownBranches(IrFun* fun) {
+  irRequire(fun, ANALYSIS_CFG | ANALYSIS_DOM);
+  bool changed = false;
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    IrInsn* term = irTerminator(block);
+    if (!term || IR_BR != term->op || !irIsReg(term->a))
+      continue;
+    int known = knownCondition(block, term->a);
+    if (known) {
+      term->a = irImm(IRT_I32, 0 < known);
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+// append to a block ending in a jump the block it jumps to when nothing
+// else reaches that one
+static bool mergeBlocks(IrFun* fun) {
+  IrBlock* entry = ywvecGet(fun->blocks, 0);
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    IrInsn* term = irTerminator(block);
+    if (!term || IR_JMP != term->op)
+      continue;
+    IrBlock* next = term->target;
+    if (next == block || next == entry || 1 != ywvecLen(next->preds))
+      continue;
+    ywvecPop(block->insns);
+    for (size_t j = 0; j < ywvecLen(next->insns); j++)
+      ywvecPush(block->insns, ywvecGet(next->insns, j));
+    for (size_t j = 0; j < ywvecLen(fun->blocks); j++)
+      if (ywvecGet(fun->blocks, j) == next) {
+        ywvecRemove(fun->blocks, j);
+        break;
+      }
+    return true;
+  }
+  return false;
+}
+
+/**
+ * Decide branches on a condition a dominating branch already tested, send
+ * branches and jumps straight to where the blocks they reach only jump on,
+ * or branch again on the same condition, drop the blocks left unreachable
+ * and merge blocks with the only block jumping to them.
+ */
+bool runJumpThreading(IrFun* fun) {
+  bool changed = false;
+  for (;;) {
+    bool threaded = foldKnownBranches(fun);
+    threaded |= threadJumps(fun);
+    if (threaded)
+      irInvalidate(fun, 0);
+    // branches on constants or threaded to one place become jumps, skipped
+    // blocks go away
+    if (runSimplifyCfg(fun)) {
+      threaded = true;
+      irInvalidate(fun, 0);
+    }
+    irRequire(fun, ANALYSIS_CFG);
+    bool merged = mergeBlocks(fun);
+    if (merged)
+      irInvalidate(fun, 0);
+    if (!threaded && !merged)
+      return changed;
+    changed = true;
+  }
+}
+
+static ywbits* cold;
+
+static IrLoop* innermostLoop(IrFun* fun, IrBlock* block) {
+  for (size_t i = 0; i < ywvecLen(fun->loops); i++) {
+    IrLoop* loop = ywvecGet(fun->loops, i);
+    if (irLoopContains(loop, block))
+      return loop;
+  }
+  return NULL;
+}
+
+static bool isLoopHeader(IrFun* fun, IrBlock* block) {
+  IrLoop* loop = innermostLoop(fun, block);
+  return loop && loop->header == block;
+}
+
+static bool returns(IrBlock* block) {
+  IrInsn* term = irTerminator(block);
+  return term && (IR_RET == term->op || IR_CALL == term->op);
+}
+
+// 1 when a branch of block more likely goes to target, -1 to els, by its
+// hint, then staying in or entering a loop, then not returning
+static int guess(IrFun* fun, IrBlock* block, IrInsn* br) {
+  if (br->likely)
+    return br->likely;
+  IrLoop* loop = innermostLoop(fun, block);
+  if (loop) {
+    bool in_target = irLoopContains(loop, br->target);
+    bool in_els = irLoopContains(loop, br->els);
+    if (in_target != in_els)
+      return in_target ? 1 : -1;
+  }
+  bool enter_target = isLoopHeader(fun, br->target) && !irDominates(br->target, block);
+  bool enter_els = isLoopHeader(fun, br->els) && !irDominates(br->els, block);
+  if (enter_target != enter_els)
+    return enter_target ? 1 : -1;
+  if (returns(br->target) != returns(br->els))
+    return returns(br->target) ? -1 : 1;
+  return 0;
+}
+
+// the successor of block to place right after it, if any is left
+static IrBlock* fallThrough(IrFun* fun, IrBlock* block, ywbits* placed) {
+  IrInsn* term = irTerminator(block);
+  IrBlock* order[2] = {NULL, NULL};
+  if (term && IR_JMP == term->op) {
+    order[0] = term->target;
+  } else if (term && IR_BR == term->op) {
+    bool els_first = guess(fun, block, term) < 0;
+    order[0] = els_first ? term->els : term->target;
+    order[1] = els_first ? term->target : term->els;
+  }
+  for (int k = 0; k < 2; k++) {
+    IrBlock* next = order[k];
+    if (next && !ywbitsGet(placed, next->id) &&
+        ywbitsGet(cold, block->id) == ywbitsGet(cold, next->id))
+      return next;
+  }
+  return NULL;
+}
+
+// mark cold the blocks a branch unlikely reaches and those they dominate
+static void markCold(IrBlock* block) {
+  ywbitsSet(cold, block->id);
+  for (size_t i = 0; i < ywvecLen(block->dom_children); i++)
+    markCold(ywvecGet(block->dom_children, i));
+}
+
+/**
+ * Order the blocks in chains that fall through to the likely successor of
+ * each, guessed by branch hints and the shape of loops, and move the blocks
+ * only reached through a branch hinted unlikely to the end of the function.
+ * Loop headers are aligned to start the loop at a fetch boundary.
+ */
+bool runLayout(IrFun* fun) {
+  irRequire(fun, ANALYSIS_CFG | ANALYSIS_DOM | ANALYSIS_LOOPS);
+  cold = ywbitsCreate(fun->block_seq);
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++)
+    ((IrBlock*)ywvecGet(fun->blocks, i))->align = false;
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    IrInsn* term = irTerminator(block);
+    if (!term || IR_BR != term->op || !term->likely || term->target == term->els)
+      continue;
+    IrBlock* unlikely = 0 < term->likely ? term->els : term->target;
+    if (1 == ywvecLen(unlikely->preds))
+      markCold(unlikely);
+  }
+  ywvec* order = ywvecCreate();
+  ywbits* placed = ywbitsCreate(fun->block_seq);
+  for (int pass = 0; pass < 2; pass++) {
+    for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+      IrBlock* block = ywvecGet(fun->blocks, i);
+      if (ywbitsGet(placed, block->id) || ywbitsGet(cold, block->id) != (1 == pass))
+        continue;
+      for (; block; block = fallThrough(fun, block, placed)) {
+        ywbitsSet(placed, block->id);
+        ywvecPush(order, block);
+      }
+    }
+  }
+  bool changed = false;
+  for (size_t i = 0; i < ywvecLen(order); i++) {
+    IrBlock* block = ywvecGet(order, i);
+    changed |= block != ywvecGet(fun->blocks, i);
+    fun->blocks->elements[i] = block;
+  }
+  for (size_t i = 0; i < ywvecLen(fun->loops); i++) {
+    IrLoop* loop = ywvecGet(fun->loops, i);
+    if (loop->header != ywvecGet(fun->blocks, 0))
+      loop->header->align = true;
+  }
+  return changed;
+}
@@ -0,0 +1,202 @@
+// loop.c
+// loop canonicalization, invariant code motion and loop rotation
+// Copyright (C) 2018: see LICENSE
+#include "pass.h"
+#include "ir.h"
+#include "util.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+// put block right before before in the layout
+static void moveBefore(IrFun* fun, IrBlock* block, IrBlock* before) {
+  ywvecRemove(fun->blocks, ywvecIndex(fun->blocks, block));
+  ywvecInsert(fun->blocks, ywvecIndex(fun->blocks, before), block);
+}
+
+static void retarget(IrBlock* block, IrBlock* from, IrBlock* to) {
+  IrInsn* term = irTerminator(block);
+  if (term->target == from)
+    term->target = to;
+  if (term->els == from)
+    term->els = to;
+  for (size_t k = 0; term->cases && k < ywvecLen(term->cases); k++)
+    if (ywvecGet(term->cases, k) == from)
+      ywvecSet(term->cases, k, to);
+}
+
+/**
+ * Give every loop a preheader: a block outside the loop that jumps to
+ * the header and is its only predecessor outside the loop.
+ */
+bool runLoopSimplify(IrFun* fun) {
+  bool changed = false;
+  for (bool again = true; again;) {
+    again = false;
+    irRequire(fun, ANALYSIS_LOOPS);
+    for (size_t i = 0; i < ywvecLen(fun->loops) && !again; i++) {
+      IrLoop* loop = ywvecGet(fun->loops, i);
+      if (loop->preheader)
+        continue;
+      IrBlock* preheader = irNewBlock(fun);
+      IrInsn* jmp = irNewInsn(IR_JMP, IRT_VOID, NULL, NULL, NULL);
+      jmp->target = loop->header;
+      ywvecPush(preheader->insns, jmp);
+      moveBefore(fun, preheader, loop->header);
+      for (size_t j = 0; j < ywvecLen(loop->header->preds); j++) {
+        IrBlock* pred = ywvecGet(loop->header->preds, j);
+        if (!irLoopContains(loop, pred))
+          retarget(pred, loop->header, preheader);
+      }
+      irInvalidate(fun, 0);
+      changed = again = true;
+    }
+  }
+  return changed;
+}
+
+static bool isInvariant(IrValue* v, IrLoop* loop, IrBlock** def_block) {
+  return !irIsReg(v) || !def_block[v->reg] || !irLoopContains(loop, def_block[v->reg]);
+}
+
+static bool canHoist(IrInsn* insn, IrLoop* loop, IrBlock** def_block, ywvec* writes,
+                     ywbits* escaped, int* bases) {
+  if (!insn->dst || IR_PARAM == insn->op || IR_CALL == insn->op || irHasSideEffect(insn))
+    return false;
+  IrValue** uses[IR_MAX_USES];
+  int nuses = irUses(insn, uses);
+  for (int k = 0; k < nuses; k++)
+    if (!isInvariant(*uses[k], loop, def_block))
+      return false;
+  if (IR_LOAD != insn->op)
+    return true;
+  // loads through pointers may fault when the loop is not entered
+  if (IRV_SLOT != insn->a->kind && IRV_SYM != insn->a->kind)
+    return false;
+  for (size_t i = 0; i < ywvecLen(writes); i++) {
+    IrInsn* write = ywvecGet(writes, i);
+    if (irMayClobber(write, insn, escaped) &&
+        (IR_CALL == write->op || !irRestrictDisjoint(bases, write->a, insn->a)))
+      return false;
+  }
+  return true;
+}
+
+/**
+ * Move instructions whose operands do not change in a loop, and loads
+ * of memory the loop does not write, into its preheader. Inner loops
+ * come first, so invariants can move out of a whole loop nest.
+ */
+bool runLicm(IrFun* fun) {
+  irRequire(fun, ANALYSIS_LOOPS);
+  IrBlock** def_block = calloc(ywvecLen(fun->regs) + 1, sizeof(IrBlock*));
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    for (size_t j = 0; j < ywvecLen(block->insns); j++) {
+      IrInsn* insn = ywvecGet(block->insns, j);
+      if (insn->dst)
+        def_block[insn->dst->reg] = block;
+    }
+  }
+  ywbits* escaped = irEscapedSlots(fun);
+  int* bases = irAddressBases(fun);
+  bool changed = false;
+  for (size_t i = 0; i < ywvecLen(fun->loops); i++) {
+    IrLoop* loop = ywvecGet(fun->loops, i);
+    if (!loop->preheader)
+      continue;
+    ywvec* writes = ywvecCreate();
+    for (size_t j = 0; j < ywvecLen(loop->blocks); j++) {
+      IrBlock* block = ywvecGet(loop->blocks, j);
+      for (size_t k = 0; k < ywvecLen(block->insns); k++) {
+        IrInsn* insn = ywvecGet(block->insns, k);
+        if (IR_STORE == insn->op || IR_COPY == insn->op || IR_CALL == insn->op)
+          ywvecPush(writes, insn);
+      }
+    }
+    ywvec* preheader = loop->preheader->insns;
+    for (size_t j = 0; j < ywvecLen(loop->blocks); j++) {
+      IrBlock* block = ywvecGet(loop->blocks, j);
+      for (size_t k = 0; k < ywvecLen(block->insns);) {
+        IrInsn* insn = ywvecGet(block->insns, k);
+        if (!canHoist(insn, loop, def_block, writes, escaped, bases)) {
+          k++;
+          continue;
+        }
+        ywvecRemove(block->insns, k);
+        ywvecInsert(preheader, ywvecLen(preheader) - 1, insn);
+        def_block[insn->dst->reg] = loop->preheader;
+        changed = true;
+      }
+    }
+  }
+  free(def_block);
+  free(bases);
+  return changed;
+}
+
+// the header only computes the exit condition of the loop
+static bool isRotatable(IrFun* fun, IrLoop* loop) {
+  IrBlock* header = loop->header;
+  IrInsn* term = irTerminator(header);
+  if (!loop->preheader || 1 != ywvecLen(loop->latches) || 2 != ywvecLen(header->preds) ||
+      IR_BR != term->op || irLoopContains(loop, term->target) == irLoopContains(loop, term->els))
+    return false;
+  IrBlock* latch = ywvecGet(loop->latches, 0);
+  if (latch == header || IR_JMP != irTerminator(latch)->op)
+    return false;
+  ywbits* defs = ywbitsCreate(ywvecLen(fun->regs));
+  for (size_t i = 0; i + 1 < ywvecLen(header->insns); i++) {
+    IrInsn* insn = ywvecGet(header->insns, i);
+    if (irHasSideEffect(insn) || IR_CALL == insn->op || IR_PARAM == insn->op)
+      return false;
+    if (insn->dst)
+      ywbitsSet(defs, insn->dst->reg);
+  }
+  // values of the header are not used after it
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    if (block == header)
+      continue;
+    for (size_t j = 0; j < ywvecLen(block->insns); j++) {
+      IrValue** uses[IR_MAX_USES];
+      int nuses = irUses(ywvecGet(block->insns, j), uses);
+      for (int k = 0; k < nuses; k++)
+        if (irIsReg(*uses[k]) && ywbitsGet(defs, (*uses[k])->reg))
+          return false;
+    }
+  }
+  return true;
+}
+
+// replace the jump ending block by a copy of the header
+static void copyHeader(IrFun* fun, IrBlock* header, IrBlock* block) {
+  ywvecPop(block->insns);
+  IrValue** map = calloc(ywvecLen(fun->regs) + 1, sizeof(IrValue*));
+  for (size_t i = 0; i < ywvecLen(header->insns); i++)
+    ywvecPush(block->insns, irCloneInsn(fun, ywvecGet(header->insns, i), map));
+  free(map);
+}
+
+/**
+ * Turn `for` loops testing their condition at the top into a guard in
+ * the preheader and a test at the bottom, so an iteration takes one
+ * branch instead of a conditional and an unconditional one.
+ */
+bool runLoopRotate(IrFun* fun) {
+  bool changed = false;
+  for (bool again = true; again;) {
+    again = false;
+    irRequire(fun, ANALYSIS_LOOPS);
+    for (size_t i = 0; i < ywvecLen(fun->loops) && !again; i++) {
+      IrLoop* loop = ywvecGet(fun->loops, i);
+      if (!isRotatable(fun, loop))
+        continue;
+      copyHeader(fun, loop->header, loop->preheader);
+      copyHeader(fun, loop->header, ywvecGet(loop->latches, 0));
+      ywvecRemove(fun->blocks, ywvecIndex(fun->blocks, loop->header));
+      irInvalidate(fun, 0);
+      changed = again = true;
+    }
+  }
+  return changed;
+}
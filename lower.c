@@ -0,0 +1,744 @@
+// lower.c
+// translate the abstract syntax tree of a function into IR
+// Copyright (C) 2018: see LICENSE
+#include "ir.h"
+#include "builtin.h"
+#include "parser.h"
+#include "token.h"
+#include "util.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// function being lowered and the block receiving new instructions
+static IrFun* fun;
+static IrBlock* cur;
+// value of the last __builtin_expect and whether it is expected nonzero
+static IrValue* expected;
+static bool expected_true;
+// where break goes in the innermost loop or switch
+static IrBlock* break_target;
+
+static IrValue* lowerExpr(Ast* ast);
+static void lowerStatement(Ast* ast);
+
+static IrInsn* append(IrInsn* insn) {
+  // code following a jump or return is unreachable and starts a new block
+  if (irTerminator(cur))
+    cur = irNewBlock(fun);
+  ywvecPush(cur->insns, insn);
+  return insn;
+}
+
+static IrValue* appendOp(int op, int type, IrValue* a, IrValue* b) {
+  IrValue* dst = irNewReg(fun, type);
+  append(irNewInsn(op, type, dst, a, b));
+  return dst;
+}
+
+static void appendJmp(IrBlock* target) {
+  IrInsn* insn = irNewInsn(IR_JMP, IRT_VOID, NULL, NULL, NULL);
+  insn->target = target;
+  append(insn);
+}
+
+static void appendBr(IrValue* cond, IrBlock* then, IrBlock* els) {
+  IrInsn* insn = irNewInsn(IR_BR, IRT_VOID, NULL, cond, NULL);
+  insn->target = then;
+  insn->els = els;
+  if (cond == expected)
+    insn->likely = expected_true ? 1 : -1;
+  append(insn);
+}
+
+static void appendStore(int type, IrValue* addr, IrValue* val) {
+  append(irNewInsn(IR_STORE, type, NULL, addr, val));
+}
+
+static IrValue* appendLoad(int type, IrValue* addr) {
+  IrValue* dst = irNewReg(fun, type);
+  append(irNewInsn(IR_LOAD, type, dst, addr, NULL));
+  return dst;
+}
+
+static void jumpTo(IrBlock* block) {
+  if (!irTerminator(cur))
+    appendJmp(block);
+}
+
+// continue in block, laying blocks out in the order they are started
+static void startBlock(IrBlock* block) {
+  jumpTo(block);
+  ywvecRemove(fun->blocks, ywvecIndex(fun->blocks, block));
+  ywvecPush(fun->blocks, block);
+  cur = block;
+}
+
+static IrSlot* slotOf(Ast* var) {
+  for (size_t i = 0; i < ywvecLen(fun->slots); i++) {
+    IrSlot* slot = ywvecGet(fun->slots, i);
+    if (var == slot->var)
+      return slot;
+  }
+  error("Unknown local variable: %s", var->lname);
+}
+
+// address plus a constant number of bytes
+static IrValue* offsetAddr(IrValue* addr, int bytes) {
+  if (IRV_SLOT == addr->kind)
+    return irSlotAddr(addr->slot, addr->slot_offset + bytes);
+  if (IRV_SYM == addr->kind)
+    return irSym(addr->sym, addr->sym_offset + bytes);
+  if (!bytes)
+    return addr;
+  return appendOp(IR_ADD, IRT_PTR, addr, irImm(IRT_I32, bytes));
+}
+
+static IrValue* lowerPtrArith(Ast* ast) {
+  Ast* ptr = ast->left;
+  Ast* idx = ast->right;
+  if (RT_PTR != ptr->rt_type->type && RT_ARRAY != ptr->rt_type->type) {
+    ptr = ast->right;
+    idx = ast->left;
+  }
+  int size = rtTypeSize(ptr->rt_type->ptr);
+  IrValue* base = lowerExpr(ptr);
+  IrValue* index = lowerExpr(idx);
+  if (RT_PTR == idx->rt_type->type || RT_ARRAY == idx->rt_type->type) {
+    // difference of two pointers, counted in elements
+    IrValue* diff = appendOp(IR_SUB, IRT_PTR, base, index);
+    return (1 == size) ? diff : appendOp(IR_DIV, IRT_PTR, diff, irImm(IRT_I32, size));
+  }
+  if (IRV_IMM == index->kind)
+    return offsetAddr(base, ('-' == ast->kind ? -1 : 1) * index->imm * size);
+  if (1 < size)
+    index = appendOp(IR_MUL, IRT_PTR, index, irImm(IRT_I32, size));
+  return appendOp('-' == ast->kind ? IR_SUB : IR_ADD, IRT_PTR, base, index);
+}
+
+static IrValue* lowerAssign(Ast* var, Ast* value) {
+  IrValue* val = lowerExpr(value);
+  int type = irTypeOf(var->rt_type);
+  switch (var->kind) {
+  case AST_LID:
+    appendStore(type, irSlotAddr(slotOf(var), 0), val);
+    break;
+  case AST_DEREFERENCE:
+    appendStore(type, lowerExpr(var->operand), val);
+    break;
+  default:
+    error("Cannot assign to %s", astToS(var));
+  }
+  // the value of an assignment has the type of its left hand side
+  if (IRT_I8 == type && IRT_I8 != val->type && IRV_IMM != val->kind)
+    return appendOp(IR_CAST, IRT_I8, val, NULL);
+  return val;
+}
+
+static int compareOp(int kind) {
+  switch (kind) {
+  case '<':
+    return IR_LT;
+  case '>':
+    return IR_GT;
+  case TK_EQ_OP:
+    return IR_EQ;
+  }
+  return -1;
+}
+
+static IrValue* lowerBinop(Ast* ast) {
+  if ('=' == ast->kind)
+    return lowerAssign(ast->left, ast->right);
+  if (RT_PTR == ast->rt_type->type || RT_ARRAY == ast->rt_type->type)
+    return lowerPtrArith(ast);
+  int op;
+  switch (ast->kind) {
+  case '+':
+    op = IR_ADD;
+    break;
+  case '-':
+    op = IR_SUB;
+    break;
+  case '*':
+    op = IR_MUL;
+    break;
+  case '/':
+    op = IR_DIV;
+    break;
+  default:
+    op = compareOp(ast->kind);
+    if (op < 0)
+      error("Invalid operator %s", astToS(ast));
+  }
+  IrValue* a = lowerExpr(ast->left);
+  IrValue* b = lowerExpr(ast->right);
+  return appendOp(op, IRT_I32, a, b);
+}
+
+// __builtin_expect(e, c) is e, and a hint for the branch testing it
+static IrValue* lowerExpect(Ast* ast) {
+  if (2 != ywlistLen(ast->args))
+    error("__builtin_expect takes two arguments: %s", astToS(ast));
+  ywiter* i = ywlistIter(ast->args);
+  Ast* arg = ywiterNext(i);
+  Ast* hint = ywiterNext(i);
+  if (AST_LITERAL != hint->kind)
+    error("__builtin_expect needs a constant: %s", astToS(ast));
+  IrValue* val = lowerExpr(arg);
+  if (IRT_I32 != val->type && IRV_IMM != val->kind)
+    val = appendOp(IR_CAST, IRT_I32, val, NULL);
+  expected = val;
+  expected_true = 0 != (RT_CHAR == hint->rt_type->type ? hint->cval : hint->ival);
+  return val;
+}
+
+static bool isIntLiteral(Ast* ast) {
+  return AST_LITERAL == ast->kind && RT_INT == ast->rt_type->type;
+}
+
+/**
+ * memcpy and memset of a constant size, memset of a constant byte, copy
+ * or fill the block inline, and give the destination. abs of x is x
+ * times 1 or -1 by the sign x shifted right gives. NULL leaves the call
+ * to the library.
+ */
+static IrValue* lowerBuiltin(Ast* ast) {
+  int nargs = ywlistLen(ast->args);
+  ywiter* i = ywlistIter(ast->args);
+  Ast* args[3] = {NULL, NULL, NULL};
+  for (int k = 0; k < nargs && k < 3; k++)
+    args[k] = ywiterNext(i);
+  if (!strcmp(ast->fun_name, "abs") && 1 == nargs) {
+    IrValue* x = lowerExpr(args[0]);
+    IrValue* sign = appendOp(IR_SAR, IRT_I32, x, irImm(IRT_I32, 31));
+    IrValue* twice = appendOp(IR_SHL, IRT_I32, sign, irImm(IRT_I32, 1));
+    IrValue* factor = appendOp(IR_ADD, IRT_I32, twice, irImm(IRT_I32, 1));
+    return appendOp(IR_MUL, IRT_I32, x, factor);
+  }
+  bool copy = !strcmp(ast->fun_name, "memcpy");
+  if ((!copy && strcmp(ast->fun_name, "memset")) || 3 != nargs || !isIntLiteral(args[2]) ||
+      args[2]->ival < 0 || (!copy && !isIntLiteral(args[1])))
+    return NULL;
+  IrValue* dst = lowerExpr(args[0]);
+  IrValue* src = NULL;
+  if (copy)
+    src = lowerExpr(args[1]);
+  else if (args[1]->ival & 255)
+    src = irImm(IRT_I8, (signed char)args[1]->ival);
+  if (args[2]->ival) {
+    IrInsn* insn = irNewInsn(IR_COPY, IRT_VOID, NULL, dst, src);
+    insn->index = args[2]->ival;
+    append(insn);
+  }
+  return appendOp(IR_CAST, IRT_I32, dst, NULL);
+}
+
+static IrValue* lowerFunCall(Ast* ast) {
+  if (!strcmp(ast->fun_name, "__builtin_expect"))
+    return lowerExpect(ast);
+  IrValue* builtin = isBuiltin(ast->fun_name) ? lowerBuiltin(ast) : NULL;
+  if (builtin)
+    return builtin;
+  ywvec* args = ywvecCreate();
+  for (ywiter* i = ywlistIter(ast->args); !ywiterEnd(i);)
+    ywvecPush(args, lowerExpr(ywiterNext(i)));
+  IrValue* dst = irNewReg(fun, irTypeOf(ast->rt_type));
+  IrInsn* insn = irNewInsn(IR_CALL, dst->type, dst, NULL, NULL);
+  insn->callee = ast->fun_name;
+  insn->args = args;
+  append(insn);
+  return dst;
+}
+
+static IrValue* lowerExpr(Ast* ast) {
+  switch (ast->kind) {
+  case AST_LITERAL:
+    if (RT_CHAR == ast->rt_type->type)
+      return irImm(IRT_I8, ast->cval);
+    return irImm(IRT_I32, ast->ival);
+  case AST_STRING:
+    return irSym(ast->slabel, 0);
+  case AST_LID:
+    if (RT_ARRAY == ast->rt_type->type)
+      return irSlotAddr(slotOf(ast), 0);
+    return appendLoad(irTypeOf(ast->rt_type), irSlotAddr(slotOf(ast), 0));
+  case AST_LREF:
+    return irSlotAddr(slotOf(ast->lref),
+                      ast->lref_offset * rtTypeSize(ast->lref->rt_type->ptr));
+  case AST_GREF:
+    if (AST_STRING != ast->gref->kind)
+      error("Global variables are not supported: %s", astToS(ast));
+    return irSym(ast->gref->slabel, ast->gref_offset);
+  case AST_GID:
+    error("Global variables are not supported: %s", astToS(ast));
+  case AST_FUN_CALL:
+    return lowerFunCall(ast);
+  case AST_ADDRESS:
+    if (AST_LID == ast->operand->kind)
+      return irSlotAddr(slotOf(ast->operand), 0);
+    if (AST_DEREFERENCE == ast->operand->kind)
+      return lowerExpr(ast->operand->operand);
+    error("Cannot take the address of %s", astToS(ast->operand));
+  case AST_DEREFERENCE: {
+    IrValue* addr = lowerExpr(ast->operand);
+    if (RT_ARRAY == ast->rt_type->type)
+      return addr;
+    return appendLoad(irTypeOf(ast->rt_type), addr);
+  }
+  default:
+    return lowerBinop(ast);
+  }
+}
+
+ywvec* ir_rodata = NULL;
+
+// arrays from this size up are initialized by copying an image
+#define MIN_BLOCK_COPY 32
+
+/**
+ * Copy the constant part of an array initializer from an image in
+ * .rodata, then store the other elements one by one. Zeros ending the
+ * image are not kept but cleared in the array.
+ */
+static void lowerBlockInit(IrValue* addr, Ast* var, Ast* init) {
+  int size = rtTypeSize(var->rt_type);
+  IrData* data = malloc(sizeof(IrData));
+  data->label = createNextLabel();
+  data->bytes = calloc(size, 1);
+  data->size = 0;
+  if (AST_STRING == init->kind) {
+    memcpy(data->bytes, init->sval, size);
+  } else {
+    int elem = rtTypeSize(var->rt_type->ptr);
+    int i = 0;
+    for (ywiter* iter = ywlistIter(init->array_init); !ywiterEnd(iter); i++) {
+      Ast* value = ywiterNext(iter);
+      if (AST_LITERAL != value->kind)
+        continue;
+      long v = (RT_CHAR == value->rt_type->type) ? value->cval : value->ival;
+      for (int k = 0; k < elem; k++)
+        data->bytes[i * elem + k] = v >> (8 * k);
+    }
+  }
+  for (int i = 0; i < size; i++)
+    if (data->bytes[i])
+      data->size = i + 1;
+  data->size = ceil8(data->size) < size ? ceil8(data->size) : size;
+  if (data->size) {
+    if (!ir_rodata)
+      ir_rodata = ywvecCreate();
+    ywvecPush(ir_rodata, data);
+    IrInsn* copy = irNewInsn(IR_COPY, IRT_VOID, NULL, addr, irSym(data->label, 0));
+    copy->index = data->size;
+    append(copy);
+  }
+  if (data->size < size) {
+    IrInsn* clear = irNewInsn(IR_COPY, IRT_VOID, NULL, offsetAddr(addr, data->size), NULL);
+    clear->index = size - data->size;
+    append(clear);
+  }
+  if (AST_STRING == init->kind)
+    return;
+  int type = irTypeOf(var->rt_type->ptr);
+  int elem = rtTypeSize(var->rt_type->ptr);
+  int i = 0;
+  for (ywiter* iter = ywlistIter(init->array_init); !ywiterEnd(iter); i++) {
+    Ast* value = ywiterNext(iter);
+    if (AST_LITERAL != value->kind)
+      appendStore(type, offsetAddr(addr, i * elem), lowerExpr(value));
+  }
+}
+
+static void lowerDeclaration(Ast* ast) {
+  Ast* var = ast->decl_var;
+  Ast* init = ast->decl_init;
+  IrValue* addr = irSlotAddr(slotOf(var), 0);
+  if (RT_ARRAY == var->rt_type->type && MIN_BLOCK_COPY <= rtTypeSize(var->rt_type)) {
+    lowerBlockInit(addr, var, init);
+  } else if (AST_ARRAY_INIT == init->kind) {
+    int type = irTypeOf(var->rt_type->ptr);
+    int size = rtTypeSize(var->rt_type->ptr);
+    int i = 0;
+    for (ywiter* iter = ywlistIter(init->array_init); !ywiterEnd(iter); i++)
+      appendStore(type, offsetAddr(addr, i * size), lowerExpr(ywiterNext(iter)));
+  } else if (RT_ARRAY == var->rt_type->type) {
+    int i = 0;
+    for (char* p = init->sval; *p; p++, i++)
+      appendStore(IRT_I8, offsetAddr(addr, i), irImm(IRT_I8, *p));
+    appendStore(IRT_I8, offsetAddr(addr, i), irImm(IRT_I8, 0));
+  } else {
+    appendStore(irTypeOf(var->rt_type), addr, lowerExpr(init));
+  }
+}
+
+static void lowerIf(Ast* ast) {
+  IrValue* cond = lowerExpr(ast->s_cond);
+  IrBlock* then = irNewBlock(fun);
+  IrBlock* els = ast->s_else ? irNewBlock(fun) : NULL;
+  IrBlock* join = irNewBlock(fun);
+  appendBr(cond, then, els ? els : join);
+  startBlock(then);
+  lowerStatement(ast->s_then);
+  if (els) {
+    jumpTo(join);
+    startBlock(els);
+    lowerStatement(ast->s_else);
+  }
+  startBlock(join);
+}
+
+static void lowerFor(Ast* ast) {
+  lowerStatement(ast->forinit);
+  IrBlock* head = irNewBlock(fun);
+  IrBlock* body = irNewBlock(fun);
+  IrBlock* exit = irNewBlock(fun);
+  IrBlock* outer_break = break_target;
+  break_target = exit;
+  startBlock(head);
+  if (ast->forcond)
+    appendBr(lowerExpr(ast->forcond), body, exit);
+  startBlock(body);
+  lowerStatement(ast->forbody);
+  if (ast->forstep)
+    lowerExpr(ast->forstep);
+  appendJmp(head);
+  break_target = outer_break;
+  startBlock(exit);
+}
+
+// a case label of the innermost switch and the block it starts, or the
+// literal it maps its value to in a lookup table
+typedef struct SwitchCase {
+  int value;
+  IrBlock* block;
+  int result;
+} SwitchCase;
+
+// labels of the innermost switch, NULL outside of one
+static ywvec* switch_cases;
+static IrBlock* switch_default;
+
+// switches with up to this many cases compare the value with each in turn
+#define MAX_LINEAR_CASES 3
+// a table has at most this many entries per case
+#define MAX_TABLE_SPREAD 3
+
+static int compareCases(const void* a, const void* b) {
+  int x = (*(SwitchCase**)a)->value;
+  int y = (*(SwitchCase**)b)->value;
+  return (x > y) - (x < y);
+}
+
+// whether cases sorted by value are many and close enough for a table
+static bool isDense(SwitchCase** cases, int n) {
+  long range = (long)cases[n - 1]->value - cases[0]->value + 1;
+  return MAX_LINEAR_CASES < n && range <= (long)MAX_TABLE_SPREAD * n;
+}
+
+static void sortCases(SwitchCase** cases, int n) {
+  qsort(cases, n, sizeof(SwitchCase*), compareCases);
+  for (int i = 1; i < n; i++)
+    if (cases[i - 1]->value == cases[i]->value)
+      error("Duplicate case value: %d", cases[i]->value);
+}
+
+/**
+ * Go from the current block to the block of the case matching val among
+ * cases sorted by value, or to other when none does: through a jump table
+ * when the cases are dense, comparing with each when they are few, and
+ * otherwise by a binary search splitting them around the middle case.
+ */
+static void lowerDispatch(IrValue* val, SwitchCase** cases, int n, IrBlock* other) {
+  if (n <= MAX_LINEAR_CASES) {
+    for (int i = 0; i < n; i++) {
+      IrBlock* next = (i + 1 < n) ? irNewBlock(fun) : other;
+      appendBr(appendOp(IR_EQ, IRT_I32, val, irImm(IRT_I32, cases[i]->value)), cases[i]->block,
+               next);
+      if (i + 1 < n)
+        cur = next;
+    }
+    jumpTo(other);
+    return;
+  }
+  if (isDense(cases, n)) {
+    IrInsn* insn = irNewInsn(IR_SWITCH, IRT_VOID, NULL, val, NULL);
+    insn->index = cases[0]->value;
+    insn->els = other;
+    insn->cases = ywvecCreate();
+    for (int i = 0; i < n; i++) {
+      // values without a case go to other
+      while (insn->index + (long)ywvecLen(insn->cases) < cases[i]->value)
+        ywvecPush(insn->cases, other);
+      ywvecPush(insn->cases, cases[i]->block);
+    }
+    append(insn);
+    return;
+  }
+  int mid = n / 2;
+  IrBlock* low = irNewBlock(fun);
+  IrBlock* high = irNewBlock(fun);
+  appendBr(appendOp(IR_LT, IRT_I32, val, irImm(IRT_I32, cases[mid]->value)), low, high);
+  cur = low;
+  lowerDispatch(val, cases, mid, other);
+  cur = high;
+  lowerDispatch(val, cases + mid, n - mid, other);
+}
+
+// value of an int or char literal
+static bool literalValue(Ast* ast, int* value) {
+  if (!ast || AST_LITERAL != ast->kind)
+    return false;
+  *value = (RT_CHAR == ast->rt_type->type) ? ast->cval : ast->ival;
+  return true;
+}
+
+// the variable an assignment of a literal to a local int or char stores to
+static Ast* assignedVar(Ast* ast, int* value) {
+  if ('=' != ast->kind || AST_LID != ast->left->kind || !literalValue(ast->right, value))
+    return NULL;
+  int type = ast->left->rt_type->type;
+  return (RT_INT == type || RT_CHAR == type) ? ast->left : NULL;
+}
+
+/**
+ * A switch each of whose cases returns a literal, or assigns a literal to
+ * the same variable and breaks, reads the literal from a table in .rodata
+ * indexed by the value instead of branching to the cases. Returns false,
+ * lowering nothing, for any other switch.
+ */
+static bool lowerLookupSwitch(IrValue* val, Ast* body) {
+  if (AST_COMPOUND != body->kind)
+    return false;
+  // the variable the cases assign, NULL when they return
+  Ast* var = NULL;
+  bool returns = false;
+  ywvec* labels = ywvecCreate();
+  ywvec* cases = ywvecCreate();
+  bool has_default = false;
+  int default_value = 0;
+  int ngroups = 0;
+  for (ywiter* i = ywlistIter(body->compound); !ywiterEnd(i);) {
+    Ast* stmt = ywiterNext(i);
+    if (AST_CASE == stmt->kind) {
+      ywvecPush(labels, stmt);
+      continue;
+    }
+    int value;
+    if (!ywvecLen(labels))
+      return false;
+    if (AST_RETURN == stmt->kind && literalValue(stmt->ret, &value)) {
+      if (ngroups++ && !returns)
+        return false;
+      returns = true;
+    } else {
+      Ast* assigned = assignedVar(stmt, &value);
+      if (!assigned || (ngroups++ && assigned != var))
+        return false;
+      var = assigned;
+      // the last case may end without break
+      Ast* next = ywiterEnd(i) ? NULL : ywiterNext(i);
+      if (next && AST_BREAK != next->kind)
+        return false;
+    }
+    for (size_t k = 0; k < ywvecLen(labels); k++) {
+      Ast* label = ywvecGet(labels, k);
+      if (label->case_default) {
+        has_default = true;
+        default_value = value;
+        continue;
+      }
+      SwitchCase* c = malloc(sizeof(SwitchCase));
+      c->value = label->case_val;
+      c->block = NULL;
+      c->result = value;
+      ywvecPush(cases, c);
+    }
+    labels = ywvecCreate();
+  }
+  int n = ywvecLen(cases);
+  if (ywvecLen(labels) || !n)
+    return false;
+  SwitchCase** sorted = (SwitchCase**)cases->elements;
+  sortCases(sorted, n);
+  int first = sorted[0]->value;
+  int range = sorted[n - 1]->value - first + 1;
+  // values without a case are only known when there is a default
+  if (!isDense(sorted, n) || (range != n && !has_default))
+    return false;
+  IrData* data = malloc(sizeof(IrData));
+  data->label = createNextLabel();
+  data->size = range * 4;
+  data->bytes = calloc(data->size, 1);
+  for (int k = 0; k < range; k++) {
+    int result = default_value;
+    for (int c = 0; c < n; c++)
+      if (sorted[c]->value == first + k)
+        result = sorted[c]->result;
+    for (int b = 0; b < 4; b++)
+      data->bytes[k * 4 + b] = result >> (8 * b);
+  }
+  if (!ir_rodata)
+    ir_rodata = ywvecCreate();
+  ywvecPush(ir_rodata, data);
+  IrBlock* above = irNewBlock(fun);
+  IrBlock* inside = irNewBlock(fun);
+  IrBlock* other = irNewBlock(fun);
+  IrBlock* exit = irNewBlock(fun);
+  appendBr(appendOp(IR_LT, IRT_I32, val, irImm(IRT_I32, first)), other, above);
+  startBlock(above);
+  appendBr(appendOp(IR_GT, IRT_I32, val, irImm(IRT_I32, first + range - 1)), other, inside);
+  startBlock(inside);
+  // index from the first case, as a displacement of -4 * first from the
+  // table would not fit in 32 bits for large case values
+  IrValue* index = appendOp(IR_SUB, IRT_PTR, val, irImm(IRT_I32, first));
+  IrValue* offset = appendOp(IR_MUL, IRT_PTR, index, irImm(IRT_I32, 4));
+  IrValue* addr = appendOp(IR_ADD, IRT_PTR, irSym(data->label, 0), offset);
+  IrValue* result = appendLoad(IRT_I32, addr);
+  IrValue* slot = var ? irSlotAddr(slotOf(var), 0) : NULL;
+  if (returns)
+    append(irNewInsn(IR_RET, IRT_VOID, NULL, result, NULL));
+  else
+    appendStore(irTypeOf(var->rt_type), slot, result);
+  jumpTo(exit);
+  startBlock(other);
+  if (has_default && returns)
+    append(irNewInsn(IR_RET, IRT_VOID, NULL, irImm(IRT_I32, default_value), NULL));
+  else if (has_default)
+    appendStore(irTypeOf(var->rt_type), slot, irImm(irTypeOf(var->rt_type), default_value));
+  startBlock(exit);
+  return true;
+}
+
+static void lowerSwitch(Ast* ast) {
+  IrValue* val = lowerExpr(ast->sw_cond);
+  if (IRT_I32 != val->type && IRV_IMM != val->kind)
+    val = appendOp(IR_CAST, IRT_I32, val, NULL);
+  if (lowerLookupSwitch(val, ast->sw_body))
+    return;
+  IrBlock* dispatch = cur;
+  IrBlock* exit = irNewBlock(fun);
+  IrBlock* outer_break = break_target;
+  ywvec* outer_cases = switch_cases;
+  IrBlock* outer_default = switch_default;
+  break_target = exit;
+  switch_cases = ywvecCreate();
+  switch_default = NULL;
+  // statements before the first label are never run
+  cur = irNewBlock(fun);
+  lowerStatement(ast->sw_body);
+  jumpTo(exit);
+  int n = ywvecLen(switch_cases);
+  SwitchCase** cases = (SwitchCase**)switch_cases->elements;
+  sortCases(cases, n);
+  cur = dispatch;
+  lowerDispatch(val, cases, n, switch_default ? switch_default : exit);
+  break_target = outer_break;
+  switch_cases = outer_cases;
+  switch_default = outer_default;
+  startBlock(exit);
+}
+
+static void lowerCase(Ast* ast) {
+  if (!switch_cases)
+    error("Case label not within a switch: %s", astToS(ast));
+  // the statements before the label fall through into it
+  IrBlock* block = irNewBlock(fun);
+  startBlock(block);
+  if (ast->case_default) {
+    if (switch_default)
+      error("Duplicate default label");
+    switch_default = block;
+    return;
+  }
+  SwitchCase* c = malloc(sizeof(SwitchCase));
+  c->value = ast->case_val;
+  c->block = block;
+  ywvecPush(switch_cases, c);
+}
+
+static void lowerStatement(Ast* ast) {
+  if (!ast)
+    return;
+  switch (ast->kind) {
+  case AST_DECLARATION:
+    lowerDeclaration(ast);
+    break;
+  case AST_IF:
+    lowerIf(ast);
+    break;
+  case AST_FOR:
+    lowerFor(ast);
+    break;
+  case AST_COMPOUND:
+    for (ywiter* i = ywlistIter(ast->compound); !ywiterEnd(i);)
+      lowerStatement(ywiterNext(i));
+    break;
+  case AST_RETURN:
+    append(irNewInsn(IR_RET, IRT_VOID, NULL, lowerExpr(ast->ret), NULL));
+    break;
+  case AST_SWITCH:
+    lowerSwitch(ast);
+    break;
+  case AST_CASE:
+    lowerCase(ast);
+    break;
+  case AST_BREAK:
+    if (!break_target)
+      error("break not within a loop or switch");
+    appendJmp(break_target);
+    break;
+  default:
+    lowerExpr(ast);
+  }
+}
+
+static bool isExpressionStatement(Ast* ast) {
+  switch (ast->kind) {
+  case AST_DECLARATION:
+  case AST_IF:
+  case AST_FOR:
+  case AST_COMPOUND:
+  case AST_RETURN:
+  case AST_SWITCH:
+  case AST_CASE:
+  case AST_BREAK:
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Falling off the end of a function returns the value of its last
+ * statement when that is an expression, and 0 otherwise.
+ */
+IrFun* irLowerFun(Ast* ast) {
+  fun = irNewFun(ast->fun_name, ast);
+  cur = irNewBlock(fun);
+  int index = 0;
+  for (ywiter* i = ywlistIter(ast->params); !ywiterEnd(i); index++) {
+    Ast* param = ywiterNext(i);
+    IrSlot* slot = irNewSlot(fun, param->lname, param, rtTypeSize(param->rt_type));
+    IrValue* val = irNewReg(fun, irTypeOf(param->rt_type));
+    IrInsn* insn = irNewInsn(IR_PARAM, val->type, val, NULL, NULL);
+    insn->index = index;
+    append(insn);
+    appendStore(val->type, irSlotAddr(slot, 0), val);
+  }
+  fun->nparams = index;
+  for (ywiter* i = ywlistIter(ast->locals); !ywiterEnd(i);) {
+    Ast* var = ywiterNext(i);
+    irNewSlot(fun, var->lname, var, rtTypeSize(var->rt_type));
+  }
+  IrValue* last = irImm(IRT_I32, 0);
+  for (ywiter* i = ywlistIter(ast->body->compound); !ywiterEnd(i);) {
+    Ast* stmt = ywiterNext(i);
+    if (ywiterEnd(i) && isExpressionStatement(stmt))
+      last = lowerExpr(stmt);
+    else
+      lowerStatement(stmt);
+  }
+  if (!irTerminator(cur))
+    append(irNewInsn(IR_RET, IRT_VOID, NULL, last, NULL));
+  return fun;
+}
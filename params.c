@@ -0,0 +1,92 @@
+// params.c
+// keep parameters in the registers they arrive in
+// Copyright (C) 2018: see LICENSE
+#include "pass.h"
+#include "ir.h"
+#include "util.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+/**
+ * The parameter stored to slot, when that store in the entry block is
+ * the only one and every other access is a whole load after it of the
+ * type of the parameter, so each load can read the parameter instead.
+ */
+static IrValue* promotableParam(IrFun* fun, IrSlot* slot) {
+  IrBlock* entry = ywvecGet(fun->blocks, 0);
+  IrInsn* store = NULL;
+  for (size_t j = 1; j < ywvecLen(entry->insns) && !store; j++) {
+    IrInsn* def = ywvecGet(entry->insns, j - 1);
+    IrInsn* insn = ywvecGet(entry->insns, j);
+    if (IR_PARAM == def->op && IR_STORE == insn->op && IRV_SLOT == insn->a->kind &&
+        insn->a->slot == slot && insn->b == def->dst && insn->type == def->type)
+      store = insn;
+  }
+  if (!store)
+    return NULL;
+  // the entry block runs before any other block
+  bool stored = false;
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    for (size_t j = 0; j < ywvecLen(block->insns); j++) {
+      IrInsn* insn = ywvecGet(block->insns, j);
+      if (insn == store) {
+        stored = true;
+        continue;
+      }
+      if ((IR_LOAD != insn->op && IR_STORE != insn->op) || IRV_SLOT != insn->a->kind ||
+          insn->a->slot != slot)
+        continue;
+      if (IR_STORE == insn->op || insn->a->slot_offset || insn->type != store->type ||
+          (block == entry && !stored))
+        return NULL;
+    }
+  }
+  return store->b;
+}
+
+/**
+ * Replace the loads of parameters from their slots by the parameters
+ * themselves. Parameters then stay in registers and only go to the
+ * stack when their address is taken, or when the register allocator
+ * spills them because they live across calls.
+ */
+bool runPromoteParams(IrFun* fun) {
+  ywbits* escaped = irEscapedSlots(fun);
+  IrValue** params = calloc(fun->slot_seq + 1, sizeof(IrValue*));
+  bool any = false;
+  for (size_t i = 0; i < ywvecLen(fun->slots); i++) {
+    IrSlot* slot = ywvecGet(fun->slots, i);
+    if (!ywbitsGet(escaped, slot->id)) {
+      params[slot->id] = promotableParam(fun, slot);
+      any |= !!params[slot->id];
+    }
+  }
+  if (!any) {
+    free(params);
+    return false;
+  }
+  size_t nregs = ywvecLen(fun->regs);
+  IrValue** repl = calloc(nregs + 1, sizeof(IrValue*));
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    for (size_t j = 0; j < ywvecLen(block->insns); j++) {
+      IrInsn* insn = ywvecGet(block->insns, j);
+      if (IR_LOAD == insn->op && IRV_SLOT == insn->a->kind && params[insn->a->slot->id])
+        repl[insn->dst->reg] = params[insn->a->slot->id];
+    }
+  }
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    for (size_t j = 0; j < ywvecLen(block->insns); j++) {
+      IrValue** uses[IR_MAX_USES];
+      int nuses = irUses(ywvecGet(block->insns, j), uses);
+      for (int k = 0; k < nuses; k++)
+        if (irIsReg(*uses[k]) && repl[(*uses[k])->reg])
+          *uses[k] = repl[(*uses[k])->reg];
+    }
+  }
+  free(params);
+  free(repl);
+  return true;
+}
@@ -2,6 +2,7 @@
 // create abstract syntax tree
 // Copyright (C) 2018: see LICENSE
 #include "parser.h"
+#include "fold.h"
 #include "token.h"
 #include "util.h"
 #include <stdbool.h>
@@ -24,8 +25,6 @@ Ast* parseCompoundStatement();
 static Ast* parseBlockItem();
 static Ast* parseBopRHS(int expr_prec);
 static char* rtToS(rt_t* rt_type);
-static int rtTypeSize(rt_t* rt_type);
-static rt_t* createPtrType(rt_t* rt_type);
 static rt_t* createArrayType(rt_t* rt_type, int size);
 static void astToSBuffer(Ast *ast, ywstr* ys);
 static Ast* parseStatement();
@@ -50,7 +49,7 @@ static Ast* createAstBop(int kind, rt_t* rt_type, Ast* left, Ast* right) {
   return ret;
 }
 
-static Ast* createAstChar(char c) {
+Ast* createAstChar(char c) {
   Ast *ret = malloc(sizeof(Ast));
   ret->kind = AST_LITERAL;
   ret->rt_type = rt_char_t;
@@ -58,7 +57,7 @@ static Ast* createAstChar(char c) {
   return ret;
 }
 
-static Ast* createAstInt(int val) {
+Ast* createAstInt(int val) {
   Ast *ret = malloc(sizeof(Ast));
   ret->kind = AST_LITERAL;
   ret->rt_type = rt_int_t;
@@ -83,7 +82,7 @@ static Ast* createAstLvar(rt_t* rt_type, char* name) {
   return ret;
 }
 
-static Ast* createAstLref(rt_t* rt_type, Ast* lvar, int offset) {
+Ast* createAstLref(rt_t* rt_type, Ast* lvar, int offset) {
   Ast* lref = malloc(sizeof(Ast));
   lref->kind = AST_LREF;
   lref->rt_type = rt_type;
@@ -103,7 +102,7 @@ static Ast* createAstGvar(rt_t* rt_type, char* name, bool filelocal) {
   return ret;
 }
 
-static Ast* createAstGref(rt_t* rt_type, Ast* gvar, int offset) {
+Ast* createAstGref(rt_t* rt_type, Ast* gvar, int offset) {
   Ast* gref = malloc(sizeof(Ast));
   gref->kind = AST_GREF;
   gref->rt_type = rt_type;
@@ -138,6 +137,8 @@ static Ast* createAstFun(rt_t* rt_type, char* fun_name, ywlist* params, Ast* bod
   ret->params = params;
   ret->locals = locals;
   ret->body = body;
+  ret->fun_inline = false;
+  ret->fun_static = false;
   return ret;
 }
 
@@ -165,6 +166,7 @@ static Ast* createAstIf(Ast* s_cond, Ast* s_then, Ast* s_else) {
   ret->s_cond = s_cond;
   ret->s_then = s_then;
   ret->s_else = s_else;
+  return ret;
 }
 
 static Ast* createAstFor(Ast* init, Ast* cond, Ast* step, Ast* body) {
@@ -178,6 +180,31 @@ static Ast* createAstFor(Ast* init, Ast* cond, Ast* step, Ast* body) {
   return ret;
 }
 
+static Ast* createAstSwitch(Ast* cond, Ast* body) {
+  Ast* ret = malloc(sizeof(Ast));
+  ret->kind = AST_SWITCH;
+  ret->rt_type = rt_void_t;
+  ret->sw_cond = cond;
+  ret->sw_body = body;
+  return ret;
+}
+
+static Ast* createAstCase(int val, bool is_default) {
+  Ast* ret = malloc(sizeof(Ast));
+  ret->kind = AST_CASE;
+  ret->rt_type = rt_void_t;
+  ret->case_val = val;
+  ret->case_default = is_default;
+  return ret;
+}
+
+static Ast* createAstBreak() {
+  Ast* ret = malloc(sizeof(Ast));
+  ret->kind = AST_BREAK;
+  ret->rt_type = rt_void_t;
+  return ret;
+}
+
 static Ast* createAstReturn(Ast* r) {
   Ast* ret = malloc(sizeof(Ast));
   ret->kind = AST_RETURN;
@@ -194,10 +221,11 @@ static Ast* createAstCompoundStatement(ywlist* yl) {
   return ret;
 }
 
-static rt_t* createPtrType(rt_t* rt_type) {
+rt_t* createPtrType(rt_t* rt_type) {
   rt_t* ret = malloc(sizeof(rt_t));
   ret->type = RT_PTR;
   ret->ptr = rt_type;
+  ret->restricted = false;
   return ret;
 }
 
@@ -206,9 +234,25 @@ static rt_t* createArrayType(rt_t* rt_type, int size) {
   ret->type = RT_ARRAY;
   ret->ptr = rt_type;
   ret->size = size;
+  ret->restricted = false;
   return ret;
 }
 
+int rtTypeSize(rt_t *rt_type) {
+  switch (rt_type->type) {
+  case RT_CHAR:
+    return 1;
+  case RT_INT:
+    return 4;
+  case RT_PTR:
+    return 8;
+  case RT_ARRAY:
+    return rtTypeSize(rt_type->ptr) * rt_type->size;
+  default:
+    error("internal error");
+  }
+}
+
 static Ast* findVarSub(ywlist* yl, char* name) {
   for (ywiter* i = ywlistIter(yl); !ywiterEnd(i);) {
     Ast* p = ywiterNext(i);
@@ -471,6 +515,13 @@ static rt_t* parseDeclarationSpecifiers() {
     error("Type expected");
   for (;;) {
     tk = nextToken();
+    if (TK_RESTRICT == tk->kind) {
+      // restrict qualifies the pointer its * declares
+      if (RT_PTR != rt_type->type)
+        error("restrict requires a pointer type, but got %s", rtToS(rt_type));
+      rt_type->restricted = true;
+      continue;
+    }
     if ('*' != tk->kind) {
       ungetToken(tk);
       return rt_type;
@@ -566,6 +617,29 @@ static Ast* parseForStatement() {
   return createAstFor(init, cond, step, body);
 }
 
+static Ast* parseSwitchStatement() {
+  eat('(');
+  Ast* cond = parseBopRHS(0);
+  eat(')');
+  eat('{');
+  Ast* body = parseCompoundStatement();
+  return createAstSwitch(cond, body);
+}
+
+// case values are integer constant expressions, folded here whether or
+// not the folding pass runs
+static Ast* parseCaseLabel() {
+  Ast* expr = parseBopRHS(0);
+  if (!expr)
+    error("Constant expected after case, but got %s", tokenToS(peekToken()->kind));
+  Ast* val = foldExpr(expr);
+  if (AST_LITERAL != val->kind ||
+      (RT_CHAR != val->rt_type->type && RT_INT != val->rt_type->type))
+    error("Constant expected after case, but got %s", astToS(expr));
+  eat(':');
+  return createAstCase(RT_CHAR == val->rt_type->type ? val->cval : val->ival, false);
+}
+
 static Ast* parseReturnStatement() {
   Ast* ret = parseBopRHS(0);
   eat(';');
@@ -585,6 +659,16 @@ static Ast* parseStatement() {
     return parseForStatement();
   case TK_RETURN:
     return parseReturnStatement();
+  case TK_SWITCH:
+    return parseSwitchStatement();
+  case TK_CASE:
+    return parseCaseLabel();
+  case TK_DEFAULT:
+    eat(':');
+    return createAstCase(0, true);
+  case TK_BREAK:
+    eat(';');
+    return createAstBreak();
   default:
     ungetToken(tk);
     return parseExpressionStatement();
@@ -644,6 +728,17 @@ static Ast* parseFunDeclaration() {
   Token* tk = peekToken();
   if (TK_EOF == tk->kind)
     return NULL;
+  bool is_inline = false;
+  bool is_static = false;
+  for (;; tk = peekToken()) {
+    if (TK_INLINE == tk->kind)
+      is_inline = true;
+    else if (TK_STATIC == tk->kind)
+      is_static = true;
+    else
+      break;
+    nextToken();
+  }
   void* ret_type = parseDeclarationSpecifiers();
   Token* fun_name = nextToken();
   if (TK_IDENTIFIER != fun_name->kind)
@@ -654,6 +749,8 @@ static Ast* parseFunDeclaration() {
   locals = ywlistCreate();
   Ast* body = parseCompoundStatement();
   Ast* ret = createAstFun(ret_type, fun_name->sval, fparams, body, locals);
+  ret->fun_inline = is_inline;
+  ret->fun_static = is_static;
   fparams = locals = NULL;
   return ret;
 }
@@ -679,6 +776,8 @@ char *rtToS(rt_t *rt_type) {
   case RT_PTR:{
     ywstr *ys = ywstrCreate(rtToS(rt_type->ptr));
     ywstrAppend(ys, '*');
+    if (rt_type->restricted)
+      ywstrAppendFormat(ys, "restrict");
     return ywstrGet(ys);
   } break;
   case RT_ARRAY: {
@@ -733,6 +832,10 @@ static void astToSBuffer(Ast* ast, ywstr* ys) {
     ywstrAppend(ys, ')');
     break;
   case AST_FUN_DEFINE:
+    if (ast->fun_static)
+      ywstrAppendFormat(ys, "static ");
+    if (ast->fun_inline)
+      ywstrAppendFormat(ys, "inline ");
     ywstrAppendFormat(ys, "(%s)%s(", rtToS(ast->rt_type), ast->fun_name);
     for (ywiter* i = ywlistIter(ast->params); !ywiterEnd(i);) {
       Ast* param = ywiterNext(i);
@@ -783,6 +886,18 @@ static void astToSBuffer(Ast* ast, ywstr* ys) {
   case AST_RETURN:
     ywstrAppendFormat(ys, "(return %s)", astToS(ast->ret));
     break;
+  case AST_SWITCH:
+    ywstrAppendFormat(ys, "(switch %s %s)", astToS(ast->sw_cond), astToS(ast->sw_body));
+    break;
+  case AST_CASE:
+    if (ast->case_default)
+      ywstrAppendFormat(ys, "(default)");
+    else
+      ywstrAppendFormat(ys, "(case %d)", ast->case_val);
+    break;
+  case AST_BREAK:
+    ywstrAppendFormat(ys, "(break)");
+    break;
   default: {
     char *LHS = astToS(ast->left);
     char *RHS = astToS(ast->right);
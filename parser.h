@@ -4,12 +4,15 @@
 #ifndef _YOWAIC_PARSER_H_
 #define _YOWAIC_PARSER_H_
 #include "util.h"
+#include <stdbool.h>
 #include <stddef.h>
 
 // kind of ast
 enum {
   AST_ADDRESS = 257,
   AST_ARRAY_INIT,
+  AST_BREAK,
+  AST_CASE,
   AST_COMPOUND,
   AST_DECLARATION,
   AST_DEREFERENCE,
@@ -24,6 +27,7 @@ enum {
   AST_LITERAL,
   AST_RETURN,
   AST_STRING,
+  AST_SWITCH,
 };
 
 // kind of run time type
@@ -39,6 +43,8 @@ typedef struct rt_t {
   int type;
   struct rt_t* ptr;
   int size;
+  // a pointer qualified restrict
+  bool restricted;
 } rt_t;
 
 typedef struct Ast {
@@ -93,6 +99,10 @@ typedef struct Ast {
           ywlist* params;
           ywlist* locals;
           struct Ast* body;
+          // declared inline
+          bool fun_inline;
+          // declared static, only called from this file
+          bool fun_static;
         };
       };
     };
@@ -120,20 +130,36 @@ typedef struct Ast {
     struct {
       struct Ast* ret;
     };
+    // Switch statement, whose body holds the case labels
+    struct {
+      struct Ast* sw_cond;
+      struct Ast* sw_body;
+    };
+    // Case label, or default label without a value
+    struct {
+      int case_val;
+      bool case_default;
+    };
     // Compound statement
     ywlist* compound;
   };
 } Ast;
 
-extern rt_t* rt_type_char;
-extern rt_t* rt_type_int;
-extern rt_t* rt_type_void;
+extern rt_t* rt_char_t;
+extern rt_t* rt_int_t;
+extern rt_t* rt_void_t;
 extern ywlist* globals;
 extern ywlist* locals;
 
 ywlist* parseFunList();
 
 char* createNextLabel();
+Ast* createAstChar(char c);
+Ast* createAstInt(int val);
+Ast* createAstLref(rt_t* rt_type, Ast* lvar, int offset);
+Ast* createAstGref(rt_t* rt_type, Ast* gvar, int offset);
+rt_t* createPtrType(rt_t* rt_type);
+int rtTypeSize(rt_t* rt_type);
 // print abstract syntax tree
 char* astToS(Ast *ast);
 
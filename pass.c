@@ -0,0 +1,310 @@
+// pass.c
+// pass manager and the analyses it caches
+// Copyright (C) 2018: see LICENSE
+#include "pass.h"
+#include "ir.h"
+#include "util.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+static void addEdge(IrBlock* from, IrBlock* to) {
+  if (ywvecIndex(from->succs, to) < 0)
+    ywvecPush(from->succs, to);
+  if (ywvecIndex(to->preds, from) < 0)
+    ywvecPush(to->preds, from);
+}
+
+static void postorder(IrBlock* block, ywvec* order, ywbits* seen) {
+  ywbitsSet(seen, block->id);
+  for (size_t i = 0; i < ywvecLen(block->succs); i++) {
+    IrBlock* succ = ywvecGet(block->succs, i);
+    if (!ywbitsGet(seen, succ->id))
+      postorder(succ, order, seen);
+  }
+  ywvecPush(order, block);
+}
+
+/**
+ * Fill preds and succs from the terminators and number the reachable
+ * blocks in reverse postorder.
+ */
+static void computeCfg(IrFun* fun) {
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    block->preds = ywvecCreate();
+    block->succs = ywvecCreate();
+    block->rpo = -1;
+  }
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    IrInsn* term = irTerminator(block);
+    if (!term)
+      error("Block B%d of %s is not terminated", block->id, fun->name);
+    if (term->target)
+      addEdge(block, term->target);
+    if (term->els)
+      addEdge(block, term->els);
+    for (size_t k = 0; term->cases && k < ywvecLen(term->cases); k++)
+      addEdge(block, ywvecGet(term->cases, k));
+  }
+  ywvec* order = ywvecCreate();
+  postorder(ywvecGet(fun->blocks, 0), order, ywbitsCreate(fun->block_seq));
+  for (size_t i = 0; i < ywvecLen(order); i++)
+    ((IrBlock*)ywvecGet(order, i))->rpo = ywvecLen(order) - 1 - i;
+}
+
+static IrBlock* intersect(IrBlock* a, IrBlock* b) {
+  while (a != b) {
+    while (a->rpo > b->rpo)
+      a = a->idom;
+    while (b->rpo > a->rpo)
+      b = b->idom;
+  }
+  return a;
+}
+
+/**
+ * Immediate dominators by the iterative algorithm of Cooper, Harvey and
+ * Kennedy. Unreachable blocks have no dominator.
+ */
+static void computeDominators(IrFun* fun) {
+  size_t n = ywvecLen(fun->blocks);
+  IrBlock** order = calloc(n, sizeof(IrBlock*));
+  for (size_t i = 0; i < n; i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    block->idom = NULL;
+    block->dom_children = ywvecCreate();
+    if (0 <= block->rpo)
+      order[block->rpo] = block;
+  }
+  IrBlock* entry = ywvecGet(fun->blocks, 0);
+  entry->idom = entry;
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (size_t i = 1; i < n && order[i]; i++) {
+      IrBlock* block = order[i];
+      IrBlock* idom = NULL;
+      for (size_t j = 0; j < ywvecLen(block->preds); j++) {
+        IrBlock* pred = ywvecGet(block->preds, j);
+        if (!pred->idom)
+          continue;
+        idom = idom ? intersect(pred, idom) : pred;
+      }
+      if (idom != block->idom) {
+        block->idom = idom;
+        changed = true;
+      }
+    }
+  }
+  for (size_t i = 1; i < n && order[i]; i++)
+    ywvecPush(order[i]->idom->dom_children, order[i]);
+  free(order);
+}
+
+bool irDominates(IrBlock* a, IrBlock* b) {
+  if (!b->idom)
+    return false;
+  for (;;) {
+    if (a == b)
+      return true;
+    if (b->idom == b)
+      return false;
+    b = b->idom;
+  }
+}
+
+/**
+ * Virtual registers live on entry to and on exit from every block.
+ */
+static void computeLiveness(IrFun* fun) {
+  size_t nregs = ywvecLen(fun->regs);
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    block->live_in = ywbitsCreate(nregs);
+    block->live_out = ywbitsCreate(nregs);
+  }
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (size_t i = ywvecLen(fun->blocks); i-- > 0;) {
+      IrBlock* block = ywvecGet(fun->blocks, i);
+      for (size_t j = 0; j < ywvecLen(block->succs); j++)
+        ywbitsUnion(block->live_out, ((IrBlock*)ywvecGet(block->succs, j))->live_in);
+      ywbits* live = ywbitsCopy(block->live_out);
+      for (size_t j = ywvecLen(block->insns); j-- > 0;) {
+        IrInsn* insn = ywvecGet(block->insns, j);
+        if (insn->dst)
+          ywbitsReset(live, insn->dst->reg);
+        IrValue** uses[IR_MAX_USES];
+        int nuses = irUses(insn, uses);
+        for (int k = 0; k < nuses; k++)
+          if (irIsReg(*uses[k]))
+            ywbitsSet(live, (*uses[k])->reg);
+      }
+      if (!ywbitsEqual(live, block->live_in)) {
+        block->live_in = live;
+        changed = true;
+      }
+    }
+  }
+}
+
+static void addToLoop(IrLoop* loop, IrBlock* block) {
+  if (irLoopContains(loop, block))
+    return;
+  ywbitsSet(loop->members, block->id);
+  for (size_t i = 0; i < ywvecLen(block->preds); i++)
+    addToLoop(loop, ywvecGet(block->preds, i));
+}
+
+static int compareLoopSize(const void* a, const void* b) {
+  return ywvecLen((*(IrLoop**)a)->blocks) - ywvecLen((*(IrLoop**)b)->blocks);
+}
+
+/**
+ * Natural loops: a back edge goes to a block dominating its source, and
+ * the loop is the header plus every block reaching the back edge
+ * without passing the header. Back edges to the same header share one
+ * loop.
+ */
+static void computeLoops(IrFun* fun) {
+  fun->loops = ywvecCreate();
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* header = ywvecGet(fun->blocks, i);
+    IrLoop* loop = NULL;
+    for (size_t j = 0; j < ywvecLen(header->preds); j++) {
+      IrBlock* latch = ywvecGet(header->preds, j);
+      if (!irDominates(header, latch))
+        continue;
+      if (!loop) {
+        loop = calloc(1, sizeof(IrLoop));
+        loop->header = header;
+        loop->members = ywbitsCreate(fun->block_seq);
+        loop->latches = ywvecCreate();
+        ywbitsSet(loop->members, header->id);
+      }
+      ywvecPush(loop->latches, latch);
+      addToLoop(loop, latch);
+    }
+    if (!loop)
+      continue;
+    loop->blocks = ywvecCreate();
+    ywvecPush(loop->blocks, header);
+    for (size_t j = 0; j < ywvecLen(fun->blocks); j++) {
+      IrBlock* block = ywvecGet(fun->blocks, j);
+      if (block != header && irLoopContains(loop, block))
+        ywvecPush(loop->blocks, block);
+    }
+    IrBlock* entry = NULL;
+    int nentries = 0;
+    for (size_t j = 0; j < ywvecLen(header->preds); j++) {
+      IrBlock* pred = ywvecGet(header->preds, j);
+      if (!irLoopContains(loop, pred)) {
+        entry = pred;
+        nentries++;
+      }
+    }
+    if (1 == nentries && 1 == ywvecLen(entry->succs))
+      loop->preheader = entry;
+    ywvecPush(fun->loops, loop);
+  }
+  qsort(fun->loops->elements, ywvecLen(fun->loops), sizeof(IrLoop*), compareLoopSize);
+  // the smallest enclosing loop is the first larger loop containing the header
+  for (size_t i = 0; i < ywvecLen(fun->loops); i++) {
+    IrLoop* loop = ywvecGet(fun->loops, i);
+    for (size_t j = i + 1; j < ywvecLen(fun->loops) && !loop->parent; j++) {
+      IrLoop* outer = ywvecGet(fun->loops, j);
+      if (irLoopContains(outer, loop->header))
+        loop->parent = outer;
+    }
+  }
+  for (size_t i = 0; i < ywvecLen(fun->loops); i++) {
+    IrLoop* loop = ywvecGet(fun->loops, i);
+    for (IrLoop* p = loop; p; p = p->parent)
+      loop->depth++;
+  }
+}
+
+void irRequire(IrFun* fun, unsigned analyses) {
+  // every analysis depends on the CFG, dominators need its numbering and
+  // loops the dominators
+  if (!(fun->valid & ANALYSIS_CFG)) {
+    computeCfg(fun);
+    fun->valid |= ANALYSIS_CFG;
+  }
+  if ((analyses & (ANALYSIS_DOM | ANALYSIS_LOOPS)) && !(fun->valid & ANALYSIS_DOM)) {
+    computeDominators(fun);
+    fun->valid |= ANALYSIS_DOM;
+  }
+  if ((analyses & ANALYSIS_LOOPS) && !(fun->valid & ANALYSIS_LOOPS)) {
+    computeLoops(fun);
+    fun->valid |= ANALYSIS_LOOPS;
+  }
+  if ((analyses & ANALYSIS_LIVENESS) && !(fun->valid & ANALYSIS_LIVENESS)) {
+    computeLiveness(fun);
+    fun->valid |= ANALYSIS_LIVENESS;
+  }
+}
+
+void irInvalidate(IrFun* fun, unsigned preserved) {
+  fun->valid &= preserved;
+  // analyses built on top of the CFG go with it, loops with the dominators
+  if (!(fun->valid & ANALYSIS_CFG))
+    fun->valid = 0;
+  if (!(fun->valid & ANALYSIS_DOM))
+    fun->valid &= ~ANALYSIS_LOOPS;
+}
+
+bool irRunPass(IrFun* fun, IrPass* pass) {
+  bool changed = pass->run(fun);
+  if (changed)
+    irInvalidate(fun, pass->preserves);
+  return changed;
+}
+
+static IrPass CONST_PROP = {"constprop", runConstProp, ANALYSIS_CFG | ANALYSIS_DOM};
+
+static IrPass SIMPLIFY_CFG = {"simplifycfg", runSimplifyCfg, 0};
+static IrPass STRENGTH = {"strength", runStrengthReduction, ANALYSIS_CFG | ANALYSIS_DOM};
+static IrPass GVN = {"gvn", runGvn, ANALYSIS_CFG | ANALYSIS_DOM};
+static IrPass DCE = {"dce", runDce, ANALYSIS_CFG | ANALYSIS_DOM};
+
+static IrPass TAIL_RECURSION = {"tailrecursion", runTailRecursion, 0};
+static IrPass PROMOTE_PARAMS = {"promoteparams", runPromoteParams, ANALYSIS_CFG | ANALYSIS_DOM};
+static IrPass TAIL_CALLS = {"tailcalls", runTailCalls, ANALYSIS_CFG | ANALYSIS_DOM};
+static IrPass JUMP_THREADING = {"jumpthreading", runJumpThreading, 0};
+static IrPass LAYOUT = {"layout", runLayout, ANALYSIS_CFG | ANALYSIS_DOM};
+
+static IrPass LOOP_SIMPLIFY = {"loopsimplify", runLoopSimplify, 0};
+static IrPass LICM = {"licm", runLicm, ANALYSIS_CFG | ANALYSIS_DOM | ANALYSIS_LOOPS};
+static IrPass LOOP_ROTATE = {"looprotate", runLoopRotate, 0};
+static IrPass VECTORIZE = {"vectorize", runVectorize, 0};
+static IrPass FULL_UNROLL = {"fullunroll", runFullUnroll, 0};
+static IrPass LOOP_UNROLL = {"loopunroll", runLoopUnroll, 0};
+static IrPass IV_REDUCE = {"ivreduce", runIvStrengthReduction, ANALYSIS_CFG | ANALYSIS_DOM};
+
+static IrPass* O1_PIPELINE[] = {
+  &CONST_PROP, &SIMPLIFY_CFG, &STRENGTH, &DCE, &TAIL_RECURSION, &PROMOTE_PARAMS, &GVN, &CONST_PROP,
+  &SIMPLIFY_CFG, &DCE,
+  &LOOP_SIMPLIFY, &LICM, &LOOP_ROTATE, &LOOP_SIMPLIFY, &VECTORIZE, &LOOP_SIMPLIFY,
+  &FULL_UNROLL, &LOOP_SIMPLIFY,
+  &IV_REDUCE, &GVN, &DCE, &TAIL_CALLS, &JUMP_THREADING, &GVN, &CONST_PROP, &JUMP_THREADING, &GVN,
+  &DCE, &LAYOUT, NULL,
+};
+static IrPass* O2_PIPELINE[] = {
+  &CONST_PROP, &SIMPLIFY_CFG, &STRENGTH, &DCE, &TAIL_RECURSION, &PROMOTE_PARAMS, &GVN, &CONST_PROP,
+  &SIMPLIFY_CFG, &DCE,
+  &LOOP_SIMPLIFY, &LICM, &LOOP_ROTATE, &LOOP_SIMPLIFY, &VECTORIZE, &LOOP_SIMPLIFY,
+  &LOOP_UNROLL, &LOOP_SIMPLIFY,
+  &IV_REDUCE, &GVN, &DCE, &TAIL_CALLS, &JUMP_THREADING, &GVN, &CONST_PROP, &JUMP_THREADING, &GVN,
+  &DCE, &LAYOUT, NULL,
+};
+
+void irRunPipeline(IrFun* fun, int level) {
+  IrPass** pipeline = NULL;
+  if (1 == level)
+    pipeline = O1_PIPELINE;
+  else if (2 <= level)
+    pipeline = O2_PIPELINE;
+  for (; pipeline && *pipeline; pipeline++)
+    irRunPass(fun, *pipeline);
+}
@@ -0,0 +1,73 @@
+// pass.h
+// analyses and optimization passes over the IR
+// Copyright (C) 2018: see LICENSE
+#ifndef _YOWAIC_PASS_H_
+#define _YOWAIC_PASS_H_
+#include "ir.h"
+#include "util.h"
+#include <stdbool.h>
+
+// analyses cached on an IrFun
+enum {
+  ANALYSIS_CFG = 1,
+  ANALYSIS_DOM = 2,
+  ANALYSIS_LIVENESS = 4,
+  ANALYSIS_LOOPS = 8,
+  ANALYSIS_ALL = 15,
+};
+
+typedef struct IrPass {
+  char* name;
+  // returns true when the function was changed
+  bool (*run)(IrFun* fun);
+  // analyses that stay valid when the pass changes the function
+  unsigned preserves;
+} IrPass;
+
+// compute the analyses that are not up to date
+void irRequire(IrFun* fun, unsigned analyses);
+void irInvalidate(IrFun* fun, unsigned preserved);
+bool irRunPass(IrFun* fun, IrPass* pass);
+void irRunPipeline(IrFun* fun, int level);
+bool irDominates(IrBlock* a, IrBlock* b);
+
+// most instructions a loop may grow to by unrolling, 0 disables it
+extern int unroll_limit;
+// copies of the body per iteration of a partially unrolled loop
+extern int unroll_factor;
+
+// -fno-inline turns off inlining
+extern bool inline_enabled;
+
+// -fno-vectorize turns off the vectorizer, --vectorize-report tells on
+// stderr which loops it vectorized and why others were not
+extern bool vectorize_enabled;
+extern bool vectorize_report;
+
+// passes
+bool runConstProp(IrFun* fun);
+bool runSimplifyCfg(IrFun* fun);
+bool runStrengthReduction(IrFun* fun);
+bool runGvn(IrFun* fun);
+bool runLoopSimplify(IrFun* fun);
+bool runLicm(IrFun* fun);
+bool runLoopRotate(IrFun* fun);
+bool runVectorize(IrFun* fun);
+bool runFullUnroll(IrFun* fun);
+bool runLoopUnroll(IrFun* fun);
+bool runIvStrengthReduction(IrFun* fun);
+bool runDce(IrFun* fun);
+bool runTailRecursion(IrFun* fun);
+bool runTailCalls(IrFun* fun);
+bool runPromoteParams(IrFun* fun);
+bool runJumpThreading(IrFun* fun);
+bool runLayout(IrFun* fun);
+
+// inline calls to the small functions of funs, which see the whole file
+bool irInlineCalls(IrFun* fun, ywvec* funs, int level);
+// functions of funs that may be called from outside the file, directly
+// or not, callees first
+ywvec* irLiveFuns(ywvec* funs);
+// calls to the function name from the functions of funs
+int irCallSites(ywvec* funs, char* name);
+#endif
@@ -0,0 +1,378 @@
+// peephole.c
+// instruction stream and peephole optimizer
+// Copyright (C) 2018: see LICENSE
+#include "peephole.h"
+#include "util.h"
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool peephole_enabled = true;
+
+static ywlist* insns = NULL;
+
+static Insn* createInsn(int kind, char* op) {
+  Insn* ret = malloc(sizeof(Insn));
+  ret->kind = kind;
+  ret->op = op;
+  ret->nargs = 0;
+  for (int i = 0; i < INSN_MAX_ARGS; i++)
+    ret->args[i] = "";
+  return ret;
+}
+
+static Insn* createOp(char* op, char* src, char* dst) {
+  Insn* ret = createInsn(INSN_OP, op);
+  if (src)
+    ret->args[ret->nargs++] = src;
+  if (dst)
+    ret->args[ret->nargs++] = dst;
+  return ret;
+}
+
+static char* trim(char* s) {
+  while (' ' == *s || '\t' == *s || '\n' == *s)
+    s++;
+  char* e = s + strlen(s);
+  while (e > s && (' ' == e[-1] || '\t' == e[-1] || '\n' == e[-1]))
+    e--;
+  *e = '\0';
+  return s;
+}
+
+static Insn* parseInsn(char* text) {
+  char* s = trim(text);
+  size_t len = strlen(s);
+  if (len && ':' == s[len - 1]) {
+    s[len - 1] = '\0';
+    return createInsn(INSN_LABEL, ywstrCopy(s));
+  }
+  char* p = s;
+  while (*p && ' ' != *p && '\t' != *p)
+    p++;
+  char* rest = *p ? p + 1 : p;
+  *p = '\0';
+  Insn* ret = createInsn('.' == *s ? INSN_DIRECTIVE : INSN_OP, ywstrCopy(s));
+  rest = trim(rest);
+  if (!*rest)
+    return ret;
+  if (INSN_DIRECTIVE == ret->kind) {
+    ret->args[ret->nargs++] = ywstrCopy(rest);
+    return ret;
+  }
+  // split operands on commas outside of parentheses
+  int depth = 0;
+  char* start = rest;
+  for (char* q = rest;; q++) {
+    if ('(' == *q)
+      depth++;
+    else if (')' == *q)
+      depth--;
+    else if ((',' == *q && 0 == depth) || !*q) {
+      bool end = !*q;
+      *q = '\0';
+      if (INSN_MAX_ARGS == ret->nargs)
+        error("Too many operands: %s", ret->op);
+      ret->args[ret->nargs++] = ywstrCopy(trim(start));
+      if (end)
+        break;
+      start = q + 1;
+    }
+  }
+  return ret;
+}
+
+void emit(char* fmt, ...) {
+  if (!insns)
+    insns = ywlistCreate();
+  va_list ap;
+  va_start(ap, fmt);
+  int len = vsnprintf(NULL, 0, fmt, ap);
+  va_end(ap);
+  char* buf = malloc(len + 1);
+  va_start(ap, fmt);
+  vsnprintf(buf, len + 1, fmt, ap);
+  va_end(ap);
+  ywlistAppend(insns, parseInsn(buf));
+  free(buf);
+}
+
+/**
+ * register names by family, from 8 bytes down to 1 byte
+ */
+static char* REG_NAMES[][4] = {
+  {"rax", "eax", "ax", "al"},
+  {"rbx", "ebx", "bx", "bl"},
+  {"rcx", "ecx", "cx", "cl"},
+  {"rdx", "edx", "dx", "dl"},
+  {"rsi", "esi", "si", "sil"},
+  {"rdi", "edi", "di", "dil"},
+  {"rbp", "ebp", "bp", "bpl"},
+  {"rsp", "esp", "sp", "spl"},
+  {"r8", "r8d", "r8w", "r8b"},
+  {"r9", "r9d", "r9w", "r9b"},
+  {"r10", "r10d", "r10w", "r10b"},
+  {"r11", "r11d", "r11w", "r11b"},
+  {"r12", "r12d", "r12w", "r12b"},
+  {"r13", "r13d", "r13w", "r13b"},
+  {"r14", "r14d", "r14w", "r14b"},
+  {"r15", "r15d", "r15w", "r15b"},
+};
+
+#define NREG_FAMILIES (sizeof(REG_NAMES) / sizeof(*REG_NAMES))
+
+// index of the family of a register name without '%', or -1
+static int regFamilyN(char* name, size_t len) {
+  for (int f = 0; f < NREG_FAMILIES; f++)
+    for (int s = 0; s < 4; s++)
+      if (strlen(REG_NAMES[f][s]) == len && !strncmp(REG_NAMES[f][s], name, len))
+        return f;
+  if (2 == len && !strncmp("ah", name, 2))
+    return 0;
+  return -1;
+}
+
+// family of a plain register operand such as "%eax", or -1
+static int regFamily(char* arg) {
+  if (!arg || '%' != *arg)
+    return -1;
+  return regFamilyN(arg + 1, strlen(arg + 1));
+}
+
+static bool argMentions(char* arg, int family) {
+  for (char* p = strchr(arg, '%'); p; p = strchr(p + 1, '%')) {
+    size_t len = 0;
+    while (('a' <= p[1 + len] && p[1 + len] <= 'z') ||
+           ('0' <= p[1 + len] && p[1 + len] <= '9'))
+      len++;
+    if (regFamilyN(p + 1, len) == family)
+      return true;
+  }
+  return false;
+}
+
+static bool mentions(Insn* insn, int family) {
+  for (int i = 0; i < insn->nargs; i++)
+    if (argMentions(insn->args[i], family))
+      return true;
+  return false;
+}
+
+static bool isOp(Insn* insn, char* op) {
+  return INSN_OP == insn->kind && !strcmp(insn->op, op);
+}
+
+// push and pop are emitted both with and without the q suffix
+static bool isPush(Insn* insn) {
+  return isOp(insn, "push") || isOp(insn, "pushq");
+}
+
+static bool isPop(Insn* insn) {
+  return isOp(insn, "pop") || isOp(insn, "popq");
+}
+
+static bool isMem(char* arg) {
+  return NULL != strchr(arg, '(');
+}
+
+static bool isPlainMove(Insn* insn) {
+  return INSN_OP == insn->kind &&
+    (!strncmp(insn->op, "mov", 3) || !strncmp(insn->op, "lea", 3));
+}
+
+/**
+ * Every rule looks at the last `window` instructions of the output.
+ * On a match it rewrites them in place and returns how many are left,
+ * otherwise it returns -1.
+ */
+typedef struct PeepholeRule {
+  char* name;
+  int window;
+  int (*rewrite)(Insn** w);
+  int hits;
+} PeepholeRule;
+
+// operand that can be moved instead of pushed
+static bool isMovableSource(char* arg) {
+  return !argMentions(arg, regFamily("%rsp"));
+}
+
+// pushq X; popq %Y  =>  movq X, %Y
+static int rewritePushPop(Insn** w) {
+  if (!isPush(w[0]) || !isPop(w[1]) || !isMovableSource(w[0]->args[0]))
+    return -1;
+  int y = regFamily(w[1]->args[0]);
+  if (y < 0)
+    return -1;
+  if (y == regFamily(w[0]->args[0]))
+    return 0;
+  w[0] = createOp("movq", w[0]->args[0], w[1]->args[0]);
+  return 1;
+}
+
+// pushq X; mov...; popq %Y  =>  movq X, %Y; mov...
+static int rewritePushMovePop(Insn** w) {
+  if (!isPush(w[0]) || !isPlainMove(w[1]) || !isPop(w[2]) ||
+      !isMovableSource(w[0]->args[0]))
+    return -1;
+  int y = regFamily(w[2]->args[0]);
+  if (y < 0 || mentions(w[1], y) || mentions(w[1], regFamily("%rsp")))
+    return -1;
+  Insn* mid = w[1];
+  w[0] = createOp("movq", w[0]->args[0], w[2]->args[0]);
+  w[1] = mid;
+  return 2;
+}
+
+// movX %R, M; movX M, %R  =>  movX %R, M
+static int rewriteStoreReload(Insn** w) {
+  if (INSN_OP != w[0]->kind || INSN_OP != w[1]->kind ||
+      strncmp(w[0]->op, "mov", 3) || strcmp(w[0]->op, w[1]->op) ||
+      2 != w[0]->nargs || 2 != w[1]->nargs)
+    return -1;
+  int r = regFamily(w[0]->args[0]);
+  if (r < 0 || !isMem(w[0]->args[1]) || argMentions(w[0]->args[1], r) ||
+      strcmp(w[0]->args[0], w[1]->args[1]) || strcmp(w[0]->args[1], w[1]->args[0]))
+    return -1;
+  return 1;
+}
+
+// movl %eR, M; movslq M, %rS  =>  movl %eR, M; movslq %eR, %rS, and alike for bytes
+static int rewriteStoreReloadExtend(Insn** w) {
+  bool byte = isOp(w[0], "movb") && isOp(w[1], "movsbq");
+  if (!byte && !(isOp(w[0], "movl") && isOp(w[1], "movslq")))
+    return -1;
+  int r = regFamily(w[0]->args[0]);
+  if (r < 0 || regFamily(w[1]->args[1]) < 0 || !isMem(w[0]->args[1]) ||
+      argMentions(w[0]->args[1], r) || strcmp(w[0]->args[1], w[1]->args[0]))
+    return -1;
+  w[1] = createOp(w[1]->op, w[0]->args[0], w[1]->args[1]);
+  return 2;
+}
+
+static char* SETCC_BRANCHES[][3] = {
+  // setcc, jcc taken when set, jcc taken when clear
+  {"setl", "jl", "jge"},
+  {"setg", "jg", "jle"},
+  {"setle", "jle", "jg"},
+  {"setge", "jge", "jl"},
+  {"sete", "je", "jne"},
+  {"setne", "jne", "je"},
+};
+
+// setCC %al; movzb %al, %eax; test %rax, %rax; je L  =>  jNCC L
+static int rewriteSetccBranch(Insn** w) {
+  if (!isOp(w[1], "movzb") || !isOp(w[2], "test") ||
+      strcmp("%al", w[1]->args[0]) || strcmp("%rax", w[2]->args[0]) ||
+      strcmp("%rax", w[2]->args[1]) || INSN_OP != w[0]->kind ||
+      strcmp("%al", w[0]->args[0]))
+    return -1;
+  bool on_set = isOp(w[3], "jne");
+  if (!on_set && !isOp(w[3], "je"))
+    return -1;
+  for (int i = 0; i < sizeof(SETCC_BRANCHES) / sizeof(*SETCC_BRANCHES); i++) {
+    if (strcmp(SETCC_BRANCHES[i][0], w[0]->op))
+      continue;
+    w[0] = createOp(SETCC_BRANCHES[i][on_set ? 1 : 2], w[3]->args[0], NULL);
+    return 1;
+  }
+  return -1;
+}
+
+// setCC %al; movzb %al, %eax; movq %rax, D; test %rax, %rax; je L
+//   =>  setCC %al; movzb %al, %eax; movq %rax, D; jNCC L
+static int rewriteSetccStoreBranch(Insn** w) {
+  if (!isOp(w[2], "movq") || strcmp("%rax", w[2]->args[0]) ||
+      argMentions(w[2]->args[1], regFamily("%rax")))
+    return -1;
+  Insn* fused[] = {w[0], w[1], w[3], w[4]};
+  Insn* setcc = w[0];
+  Insn* movzb = w[1];
+  if (1 != rewriteSetccBranch(fused))
+    return -1;
+  w[3] = fused[0];
+  w[0] = setcc;
+  w[1] = movzb;
+  return 4;
+}
+
+// movq %R, %R  =>  nothing
+static int rewriteSelfMove(Insn** w) {
+  if (!isOp(w[0], "movq") || 2 != w[0]->nargs || regFamily(w[0]->args[0]) < 0 ||
+      strcmp(w[0]->args[0], w[0]->args[1]))
+    return -1;
+  return 0;
+}
+
+// jmp L; L:  =>  L:
+static int rewriteJumpNext(Insn** w) {
+  if (!isOp(w[0], "jmp") || INSN_LABEL != w[1]->kind ||
+      strcmp(w[0]->args[0], w[1]->op))
+    return -1;
+  w[0] = w[1];
+  return 1;
+}
+
+static PeepholeRule RULES[] = {
+  {"push-pop", 2, rewritePushPop, 0},
+  {"push-move-pop", 3, rewritePushMovePop, 0},
+  {"store-reload", 2, rewriteStoreReload, 0},
+  {"store-reload-extend", 2, rewriteStoreReloadExtend, 0},
+  {"setcc-branch", 4, rewriteSetccBranch, 0},
+  {"setcc-store-branch", 5, rewriteSetccStoreBranch, 0},
+  {"self-move", 1, rewriteSelfMove, 0},
+  {"jump-next", 2, rewriteJumpNext, 0},
+};
+
+#define NRULES (sizeof(RULES) / sizeof(*RULES))
+
+// apply the first matching rule to the tail of out, returning the new length
+static int applyRules(Insn** out, int n) {
+  for (int r = 0; r < NRULES; r++) {
+    int k = RULES[r].window;
+    if (k > n)
+      continue;
+    int m = RULES[r].rewrite(out + n - k);
+    if (m < 0)
+      continue;
+    RULES[r].hits++;
+    return n - k + m;
+  }
+  return -1;
+}
+
+static void printInsn(Insn* insn) {
+  if (INSN_LABEL == insn->kind) {
+    printf("%s:\n", insn->op);
+    return;
+  }
+  printf("\t%s", insn->op);
+  for (int i = 0; i < insn->nargs; i++)
+    printf("%s%s", i ? ", " : " ", insn->args[i]);
+  printf("\n");
+}
+
+void emitFlush() {
+  if (!insns)
+    return;
+  Insn** out = malloc(sizeof(Insn*) * (ywlistLen(insns) + 1));
+  int n = 0;
+  for (ywiter* i = ywlistIter(insns); !ywiterEnd(i);) {
+    out[n++] = ywiterNext(i);
+    if (!peephole_enabled)
+      continue;
+    for (int m; 0 <= (m = applyRules(out, n));)
+      n = m;
+  }
+  for (int i = 0; i < n; i++)
+    printInsn(out[i]);
+  free(out);
+  insns = NULL;
+}
+
+void peepholePrintStats() {
+  for (int r = 0; r < NRULES; r++)
+    fprintf(stderr, "peephole: %-20s %d\n", RULES[r].name, RULES[r].hits);
+}
@@ -0,0 +1,34 @@
+// peephole.h
+// instruction stream and peephole optimizer
+// Copyright (C) 2018: see LICENSE
+#ifndef _YOWAIC_PEEPHOLE_H_
+#define _YOWAIC_PEEPHOLE_H_
+#include "util.h"
+#include <stdbool.h>
+
+#define INSN_MAX_ARGS 3
+
+// kind of instruction
+enum {
+  INSN_OP,
+  INSN_LABEL,
+  INSN_DIRECTIVE,
+};
+
+typedef struct Insn {
+  int kind;
+  // mnemonic, label name or directive name
+  char* op;
+  // operands in AT&T order, a directive keeps its argument text in args[0]
+  char* args[INSN_MAX_ARGS];
+  int nargs;
+} Insn;
+
+extern bool peephole_enabled;
+
+// append one instruction or label, written as assembly text
+void emit(char* fmt, ...);
+// optimize and print everything emitted so far
+void emitFlush();
+void peepholePrintStats();
+#endif
@@ -0,0 +1,292 @@
+// regalloc.c
+// assign virtual registers to machine registers or stack slots
+// Copyright (C) 2018: see LICENSE
+#include "regalloc.h"
+#include "ir.h"
+#include "pass.h"
+#include "util.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Registers handed out by the allocator, caller saved ones first.
+ * %rax, %rcx, %rdx and %r11 are kept as scratch registers for the
+ * generator.
+ */
+static char* ALLOCATABLE[] = {
+  "%r10", "%r9", "%r8", "%rsi", "%rdi",
+  "%rbx", "%r12", "%r13", "%r14", "%r15",
+};
+
+#define NALLOCATABLE (sizeof(ALLOCATABLE) / sizeof(*ALLOCATABLE))
+#define FIRST_CALLEE_SAVED 5
+// mask of the caller saved registers of ALLOCATABLE
+#define CALLER_SAVED ((1u << FIRST_CALLEE_SAVED) - 1)
+
+// registers of the arguments of a call, in the order the generator passes them
+static char* ARGUMENT_REGS[] = {"%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9"};
+
+#define NARGUMENT_REGS (sizeof(ARGUMENT_REGS) / sizeof(*ARGUMENT_REGS))
+
+/**
+ * Registers of vector values, which only live inside and around
+ * vectorized loops without calls. %xmm15 is kept as a scratch register.
+ */
+static char* VECTOR_REGS[] = {
+  "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5", "%xmm6", "%xmm7",
+  "%xmm8", "%xmm9", "%xmm10", "%xmm11", "%xmm12", "%xmm13", "%xmm14",
+};
+
+#define NVECTOR_REGS (sizeof(VECTOR_REGS) / sizeof(*VECTOR_REGS))
+
+typedef struct Interval {
+  int reg;
+  int start;
+  int end;
+  // mask of the registers the calls it lives across may change
+  unsigned clobbered;
+  int phys;
+} Interval;
+
+// caller saved registers a static function changes, known once it is
+// allocated, so its callers keep values across calls to it in the others
+typedef struct Clobbers {
+  char* fun_name;
+  unsigned mask;
+} Clobbers;
+
+static ywvec* clobbers = NULL;
+
+bool isCalleeSaved(char* reg) {
+  for (int i = FIRST_CALLEE_SAVED; i < NALLOCATABLE; i++)
+    if (!strcmp(ALLOCATABLE[i], reg))
+      return true;
+  return false;
+}
+
+static unsigned registerMask(char* reg) {
+  for (int i = 0; i < NALLOCATABLE; i++)
+    if (!strcmp(ALLOCATABLE[i], reg))
+      return 1u << i;
+  return 0;
+}
+
+// registers a call may change: its arguments and what the callee changes
+static unsigned callClobbers(IrInsn* call) {
+  unsigned mask = CALLER_SAVED;
+  for (size_t i = 0; clobbers && i < ywvecLen(clobbers); i++) {
+    Clobbers* known = ywvecGet(clobbers, i);
+    if (!strcmp(known->fun_name, call->callee))
+      mask = known->mask;
+  }
+  for (size_t i = 0; i < ywvecLen(call->args) && i < NARGUMENT_REGS; i++)
+    mask |= registerMask(ARGUMENT_REGS[i]);
+  return mask;
+}
+
+static void recordClobbers(IrFun* fun, RegAlloc* ra) {
+  Clobbers* known = malloc(sizeof(Clobbers));
+  known->fun_name = fun->name;
+  known->mask = 0;
+  for (size_t r = 0; r < ywvecLen(fun->regs); r++)
+    if (ra->reg[r])
+      known->mask |= registerMask(ra->reg[r]) & CALLER_SAVED;
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    for (size_t j = 0; j < ywvecLen(block->insns); j++) {
+      IrInsn* insn = ywvecGet(block->insns, j);
+      if (IR_CALL == insn->op)
+        known->mask |= callClobbers(insn);
+    }
+  }
+  if (!clobbers)
+    clobbers = ywvecCreate();
+  ywvecPush(clobbers, known);
+}
+
+static IrSlot* createSpillSlot(RegAlloc* ra, int reg) {
+  IrSlot* slot = malloc(sizeof(IrSlot));
+  slot->id = ywvecLen(ra->slots);
+  slot->name = "spill";
+  slot->var = NULL;
+  slot->size = 8;
+  slot->align = 8;
+  slot->offset = 0;
+  ywvecPush(ra->slots, slot);
+  ra->spill[reg] = slot;
+  return slot;
+}
+
+static void extend(Interval* it, int pos) {
+  if (pos < it->start)
+    it->start = pos;
+  if (pos > it->end)
+    it->end = pos;
+}
+
+static int compareStart(const void* a, const void* b) {
+  return (*(Interval**)a)->start - (*(Interval**)b)->start;
+}
+
+/**
+ * Number the instructions in layout order and build one conservative
+ * live interval per virtual register from the liveness analysis.
+ */
+static Interval* buildIntervals(IrFun* fun) {
+  size_t nregs = ywvecLen(fun->regs);
+  Interval* its = malloc(sizeof(Interval) * (nregs ? nregs : 1));
+  for (size_t r = 0; r < nregs; r++) {
+    its[r].reg = r;
+    its[r].start = 1 << 30;
+    its[r].end = -1;
+    its[r].clobbered = 0;
+    its[r].phys = -1;
+  }
+  // positions of the calls and the registers each changes
+  ywvec* calls = ywvecCreate();
+  ywvec* masks = ywvecCreate();
+  int pos = 0;
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    int first = pos;
+    int last = pos + ywvecLen(block->insns) - 1;
+    for (size_t r = 0; r < nregs; r++) {
+      if (ywbitsGet(block->live_in, r))
+        extend(&its[r], first);
+      if (ywbitsGet(block->live_out, r))
+        extend(&its[r], last);
+    }
+    for (size_t j = 0; j < ywvecLen(block->insns); j++, pos++) {
+      IrInsn* insn = ywvecGet(block->insns, j);
+      // incoming arguments are all moved out of their registers on entry
+      if (IR_PARAM == insn->op)
+        extend(&its[insn->dst->reg], 0);
+      if (insn->dst)
+        extend(&its[insn->dst->reg], pos);
+      IrValue** uses[IR_MAX_USES];
+      int nuses = irUses(insn, uses);
+      for (int k = 0; k < nuses; k++)
+        if (irIsReg(*uses[k]))
+          extend(&its[(*uses[k])->reg], pos);
+      if (IR_CALL == insn->op) {
+        ywvecPush(calls, (void*)(long)pos);
+        ywvecPush(masks, (void*)(long)callClobbers(insn));
+      }
+    }
+  }
+  for (size_t r = 0; r < nregs; r++)
+    for (size_t c = 0; c < ywvecLen(calls); c++) {
+      int call = (long)ywvecGet(calls, c);
+      if (its[r].start < call && call < its[r].end)
+        its[r].clobbered |= (long)ywvecGet(masks, c);
+    }
+  return its;
+}
+
+static void linearScan(IrFun* fun, RegAlloc* ra) {
+  irRequire(fun, ANALYSIS_LIVENESS);
+  size_t nregs = ywvecLen(fun->regs);
+  Interval* its = buildIntervals(fun);
+  Interval** sorted = malloc(sizeof(Interval*) * (nregs ? nregs : 1));
+  int n = 0;
+  for (size_t r = 0; r < nregs; r++)
+    if (0 <= its[r].end)
+      sorted[n++] = &its[r];
+  qsort(sorted, n, sizeof(Interval*), compareStart);
+  Interval* owner[NALLOCATABLE] = {NULL};
+  Interval* vector_owner[NVECTOR_REGS] = {NULL};
+  ywvec* active = ywvecCreate();
+  ywvec* vector_active = ywvecCreate();
+  for (int i = 0; i < n; i++) {
+    Interval* it = sorted[i];
+    for (size_t j = 0; j < ywvecLen(active);) {
+      Interval* other = ywvecGet(active, j);
+      if (other->end < it->start) {
+        owner[other->phys] = NULL;
+        ywvecRemove(active, j);
+      } else {
+        j++;
+      }
+    }
+    for (size_t j = 0; j < ywvecLen(vector_active);) {
+      Interval* other = ywvecGet(vector_active, j);
+      if (other->end < it->start) {
+        vector_owner[other->phys] = NULL;
+        ywvecRemove(vector_active, j);
+      } else {
+        j++;
+      }
+    }
+    if (irIsVector(((IrValue*)ywvecGet(fun->regs, it->reg))->type)) {
+      // the vectorizer keeps the number of vector values of a loop small
+      for (int p = 0; p < NVECTOR_REGS; p++)
+        if (!vector_owner[p]) {
+          it->phys = p;
+          break;
+        }
+      if (it->phys < 0)
+        error("Out of vector registers in %s", fun->name);
+      vector_owner[it->phys] = it;
+      ywvecPush(vector_active, it);
+      continue;
+    }
+    for (int p = 0; p < NALLOCATABLE; p++)
+      if (!owner[p] && !(it->clobbered & 1u << p)) {
+        it->phys = p;
+        break;
+      }
+    if (it->phys < 0) {
+      // take the register of the interval that ends last, if it outlives this one
+      Interval* victim = NULL;
+      for (size_t j = 0; j < ywvecLen(active); j++) {
+        Interval* other = ywvecGet(active, j);
+        if (!(it->clobbered & 1u << other->phys) && (!victim || other->end > victim->end))
+          victim = other;
+      }
+      if (!victim || victim->end <= it->end) {
+        createSpillSlot(ra, it->reg);
+        continue;
+      }
+      it->phys = victim->phys;
+      victim->phys = -1;
+      createSpillSlot(ra, victim->reg);
+      ywvecRemove(active, ywvecIndex(active, victim));
+    }
+    owner[it->phys] = it;
+    ywvecPush(active, it);
+  }
+  for (size_t r = 0; r < nregs; r++) {
+    if (its[r].phys < 0)
+      continue;
+    if (irIsVector(((IrValue*)ywvecGet(fun->regs, r))->type)) {
+      ra->reg[r] = VECTOR_REGS[its[r].phys];
+      continue;
+    }
+    char* reg = ALLOCATABLE[its[r].phys];
+    ra->reg[r] = reg;
+    if (isCalleeSaved(reg) && ywvecIndex(ra->callee_saved, reg) < 0)
+      ywvecPush(ra->callee_saved, reg);
+  }
+  free(sorted);
+  free(its);
+}
+
+RegAlloc* allocateRegisters(IrFun* fun, bool linear_scan) {
+  size_t nregs = ywvecLen(fun->regs);
+  RegAlloc* ra = malloc(sizeof(RegAlloc));
+  ra->reg = calloc(nregs + 1, sizeof(char*));
+  ra->spill = calloc(nregs + 1, sizeof(IrSlot*));
+  ra->slots = ywvecCreate();
+  ra->callee_saved = ywvecCreate();
+  if (linear_scan)
+    linearScan(fun, ra);
+  else
+    for (size_t r = 0; r < nregs; r++)
+      createSpillSlot(ra, r);
+  // nothing outside the file calls a static function
+  if (fun->ast->fun_static)
+    recordClobbers(fun, ra);
+  return ra;
+}
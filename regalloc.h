@@ -0,0 +1,23 @@
+// regalloc.h
+// assign virtual registers to machine registers or stack slots
+// Copyright (C) 2018: see LICENSE
+#ifndef _YOWAIC_REGALLOC_H_
+#define _YOWAIC_REGALLOC_H_
+#include "ir.h"
+#include <stdbool.h>
+
+typedef struct RegAlloc {
+  // machine register of every virtual register, NULL when it is spilled
+  char** reg;
+  // stack slot of every spilled virtual register
+  IrSlot** spill;
+  // spill slots, laid out by the generator next to the locals
+  ywvec* slots;
+  // callee saved registers the function writes
+  ywvec* callee_saved;
+} RegAlloc;
+
+// with linear_scan unset every virtual register is spilled
+RegAlloc* allocateRegisters(IrFun* fun, bool linear_scan);
+bool isCalleeSaved(char* reg);
+#endif
@@ -0,0 +1,144 @@
+// strength.c
+// replace multiplication and division by constants with cheaper operations
+// Copyright (C) 2018: see LICENSE
+#include "pass.h"
+#include "ir.h"
+#include "util.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// log2 of n when it is a power of two, otherwise -1
+static int log2Exact(long n) {
+  if (n <= 0 || (n & (n - 1)))
+    return -1;
+  int k = 0;
+  while (1L << k != n)
+    k++;
+  return k;
+}
+
+/**
+ * Magic number M and shift s such that n / d == ((n * M) >> (32 + s)) + (n < 0)
+ * for every 32-bit n, from Hacker's Delight, figure 10-1. With 64-bit
+ * registers M can be used as an unsigned number and needs no add fixup.
+ */
+static void signedMagic(uint32_t d, uint64_t* magic, int* shift) {
+  const uint32_t two31 = 0x80000000u;
+  uint32_t anc = two31 - 1 - two31 % d;
+  uint32_t q1 = two31 / anc;
+  uint32_t r1 = two31 - q1 * anc;
+  uint32_t q2 = two31 / d;
+  uint32_t r2 = two31 - q2 * d;
+  uint32_t delta;
+  int p = 31;
+  do {
+    p++;
+    q1 *= 2;
+    r1 *= 2;
+    if (r1 >= anc) {
+      q1++;
+      r1 -= anc;
+    }
+    q2 *= 2;
+    r2 *= 2;
+    if (r2 >= d) {
+      q2++;
+      r2 -= d;
+    }
+    delta = d - r2;
+  } while (q1 < delta || (q1 == delta && 0 == r1));
+  *magic = (uint64_t)q2 + 1;
+  *shift = p - 32;
+}
+
+// instructions inserted before the one being rewritten
+static IrFun* fun;
+static IrBlock* block;
+static size_t pos;
+
+static IrValue* insert(int op, int type, IrValue* a, IrValue* b) {
+  IrValue* dst = irNewReg(fun, type);
+  ywvecInsert(block->insns, pos++, irNewInsn(op, type, dst, a, b));
+  return dst;
+}
+
+// turn insn into dst = a op b, keeping its destination
+static void rewrite(IrInsn* insn, int op, IrValue* a, IrValue* b) {
+  insn->op = op;
+  insn->a = a;
+  insn->b = b;
+}
+
+/**
+ * x * 2^k becomes a shift. Multiplication by 3, 5 or 9 times a power of
+ * two keeps the small factor, which the generator emits as lea, and
+ * shifts the rest.
+ */
+static bool reduceMul(IrInsn* insn) {
+  if (IRV_IMM == insn->a->kind) {
+    IrValue* tmp = insn->a;
+    insn->a = insn->b;
+    insn->b = tmp;
+  }
+  if (IRV_IMM != insn->b->kind)
+    return false;
+  long c = insn->b->imm;
+  int k = 0;
+  while (0 < c && 0 == c % 2) {
+    c /= 2;
+    k++;
+  }
+  if (!k || (1 != c && 3 != c && 5 != c && 9 != c))
+    return false;
+  IrValue* x = insn->a;
+  if (1 != c)
+    x = insert(IR_MUL, insn->type, x, irImm(IRT_I32, c));
+  rewrite(insn, IR_SHL, x, irImm(IRT_I32, k));
+  return true;
+}
+
+static bool reduceDiv(IrInsn* insn) {
+  if (IRV_IMM != insn->b->kind || insn->b->imm < 2 || INT32_MAX < insn->b->imm)
+    return false;
+  long d = insn->b->imm;
+  IrValue* n = insn->a;
+  int k = log2Exact(d);
+  // a pointer difference is an exact multiple of the element size
+  if (IRT_PTR == insn->type && 0 < k) {
+    rewrite(insn, IR_SAR, n, irImm(IRT_I32, k));
+    return true;
+  }
+  if (IRT_I32 != insn->type)
+    return false;
+  // n < 0 ? n + d - 1 : n, rounding the quotient toward zero
+  IrValue* sign = insert(IR_SAR, IRT_I32, n, irImm(IRT_I32, 63));
+  if (0 < k) {
+    IrValue* bias = insert(IR_SHR, IRT_I32, sign, irImm(IRT_I32, 64 - k));
+    IrValue* biased = insert(IR_ADD, IRT_I32, n, bias);
+    rewrite(insn, IR_SAR, biased, irImm(IRT_I32, k));
+    return true;
+  }
+  uint64_t magic;
+  int shift;
+  signedMagic(d, &magic, &shift);
+  IrValue* product = insert(IR_MUL, IRT_PTR, n, irImm(IRT_PTR, magic));
+  IrValue* quotient = insert(IR_SAR, IRT_I32, product, irImm(IRT_I32, 32 + shift));
+  rewrite(insn, IR_SUB, quotient, sign);
+  return true;
+}
+
+bool runStrengthReduction(IrFun* ir) {
+  fun = ir;
+  bool changed = false;
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    block = ywvecGet(fun->blocks, i);
+    for (pos = 0; pos < ywvecLen(block->insns); pos++) {
+      IrInsn* insn = ywvecGet(block->insns, pos);
+      if (IR_MUL == insn->op)
+        changed |= reduceMul(insn);
+      else if (IR_DIV == insn->op)
+        changed |= reduceDiv(insn);
+    }
+  }
+  return changed;
+}
@@ -0,0 +1,190 @@
+// tailcall.c
+// turn self recursion in tail position into loops and mark tail calls
+// Copyright (C) 2018: see LICENSE
+#include "pass.h"
+#include "ir.h"
+#include "util.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * A call whose result is returned right away, directly or through a
+ * slot read by a block that only returns it, as inlined code does.
+ * Returns the call and sets the number of instructions after it.
+ */
+static IrInsn* tailCall(IrBlock* block, int* after) {
+  size_t n = ywvecLen(block->insns);
+  IrInsn* ret = n ? ywvecGet(block->insns, n - 1) : NULL;
+  IrInsn* call = (2 <= n) ? ywvecGet(block->insns, n - 2) : NULL;
+  *after = 1;
+  if (call && IR_CALL == call->op && IR_RET == ret->op && call->dst == ret->a)
+    return call;
+  if (n < 3 || IR_JMP != ret->op || 2 != ywvecLen(ret->target->insns))
+    return NULL;
+  IrInsn* store = ywvecGet(block->insns, n - 2);
+  IrInsn* load = ywvecGet(ret->target->insns, 0);
+  IrInsn* next = ywvecGet(ret->target->insns, 1);
+  call = ywvecGet(block->insns, n - 3);
+  *after = 2;
+  if (IR_CALL != call->op || IR_STORE != store->op || IR_LOAD != load->op ||
+      IR_RET != next->op || store->b != call->dst || next->a != load->dst ||
+      store->type != call->type || load->type != call->type || IRV_SLOT != store->a->kind ||
+      IRV_SLOT != load->a->kind || store->a->slot != load->a->slot ||
+      store->a->slot_offset != load->a->slot_offset)
+    return NULL;
+  return call;
+}
+
+/**
+ * A callee may only reuse the frame when it cannot reach the locals of
+ * the caller: no address of a slot is ever taken.
+ */
+static bool hasEscapedSlot(IrFun* fun) {
+  ywbits* escaped = irEscapedSlots(fun);
+  for (size_t i = 0; i < ywvecLen(fun->slots); i++)
+    if (ywbitsGet(escaped, ((IrSlot*)ywvecGet(fun->slots, i))->id))
+      return true;
+  return false;
+}
+
+/**
+ * The entry block starts with the parameters, each stored to its slot
+ * and not used otherwise. Returns the number of those instructions and
+ * fills the slot of every parameter, NULL for unused ones.
+ */
+static int paramPrologue(IrFun* fun, IrSlot** slots, int* types) {
+  IrBlock* entry = ywvecGet(fun->blocks, 0);
+  int* uses = calloc(ywvecLen(fun->regs) + 1, sizeof(int));
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    for (size_t j = 0; j < ywvecLen(block->insns); j++) {
+      IrValue** ops[IR_MAX_USES];
+      int nops = irUses(ywvecGet(block->insns, j), ops);
+      for (int k = 0; k < nops; k++)
+        if (irIsReg(*ops[k]))
+          uses[(*ops[k])->reg]++;
+    }
+  }
+  IrValue** params = calloc(fun->nparams + 1, sizeof(IrValue*));
+  int n = 0;
+  int nstores = 0;
+  for (; n < (int)ywvecLen(entry->insns); n++) {
+    IrInsn* insn = ywvecGet(entry->insns, n);
+    if (IR_PARAM == insn->op) {
+      params[insn->index] = insn->dst;
+      types[insn->index] = insn->type;
+      continue;
+    }
+    if (IR_STORE != insn->op || IRV_SLOT != insn->a->kind || insn->a->slot_offset ||
+        !irIsReg(insn->b))
+      break;
+    int index = -1;
+    for (int k = 0; k < fun->nparams; k++)
+      if (params[k] == insn->b)
+        index = k;
+    if (index < 0 || slots[index])
+      break;
+    slots[index] = insn->a->slot;
+    nstores++;
+  }
+  bool ok = true;
+  for (int k = 0; k < fun->nparams; k++)
+    if (!params[k] || uses[params[k]->reg] != (slots[k] ? 1 : 0))
+      ok = false;
+  free(uses);
+  free(params);
+  return ok ? n : -1;
+}
+
+/**
+ * Rebind the parameters of `return f(args)` in f and jump back to the
+ * code after the prologue instead of calling, so the recursion runs in
+ * constant stack space.
+ */
+bool runTailRecursion(IrFun* fun) {
+  ywvec* calls = ywvecCreate();
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    int after;
+    IrInsn* call = tailCall(ywvecGet(fun->blocks, i), &after);
+    if (call && !call->tail && !strcmp(call->callee, fun->name) &&
+        (int)ywvecLen(call->args) == fun->nparams)
+      ywvecPush(calls, ywvecGet(fun->blocks, i));
+  }
+  if (!ywvecLen(calls) || hasEscapedSlot(fun))
+    return false;
+  IrSlot** slots = calloc(fun->nparams + 1, sizeof(IrSlot*));
+  int* types = calloc(fun->nparams + 1, sizeof(int));
+  int prologue = paramPrologue(fun, slots, types);
+  if (prologue < 0) {
+    free(slots);
+    free(types);
+    return false;
+  }
+  // the body after the prologue becomes a block of its own
+  IrBlock* entry = ywvecGet(fun->blocks, 0);
+  IrBlock* body = irNewBlock(fun);
+  ywvecPop(fun->blocks);
+  ywvecInsert(fun->blocks, 1, body);
+  while ((int)ywvecLen(entry->insns) > prologue) {
+    ywvecPush(body->insns, ywvecGet(entry->insns, prologue));
+    ywvecRemove(entry->insns, prologue);
+  }
+  for (size_t i = 1; i < ywvecLen(fun->blocks); i++) {
+    IrInsn* term = irTerminator(ywvecGet(fun->blocks, i));
+    if (term->target == entry)
+      term->target = body;
+    if (term->els == entry)
+      term->els = body;
+    for (size_t k = 0; term->cases && k < ywvecLen(term->cases); k++)
+      if (ywvecGet(term->cases, k) == entry)
+        ywvecSet(term->cases, k, body);
+  }
+  IrInsn* jmp = irNewInsn(IR_JMP, IRT_VOID, NULL, NULL, NULL);
+  jmp->target = body;
+  ywvecPush(entry->insns, jmp);
+  for (size_t i = 0; i < ywvecLen(calls); i++) {
+    IrBlock* block = ywvecGet(calls, i);
+    if (block == entry)
+      block = body;
+    int after;
+    IrInsn* call = tailCall(block, &after);
+    while (after-- >= 0)
+      ywvecPop(block->insns);
+    // every argument is computed before the first parameter is rebound
+    for (int k = 0; k < fun->nparams; k++)
+      if (slots[k])
+        ywvecPush(block->insns, irNewInsn(IR_STORE, types[k], NULL, irSlotAddr(slots[k], 0),
+                                          ywvecGet(call->args, k)));
+    jmp = irNewInsn(IR_JMP, IRT_VOID, NULL, NULL, NULL);
+    jmp->target = body;
+    ywvecPush(block->insns, jmp);
+  }
+  free(slots);
+  free(types);
+  return true;
+}
+
+/**
+ * Mark the other calls returning their result right away as tail calls:
+ * the generator tears the frame down and jumps to the callee, which
+ * returns to our caller.
+ */
+bool runTailCalls(IrFun* fun) {
+  if (hasEscapedSlot(fun))
+    return false;
+  bool changed = false;
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    int after;
+    IrInsn* call = tailCall(block, &after);
+    if (!call || call->tail)
+      continue;
+    while (after-- > 0)
+      ywvecPop(block->insns);
+    call->tail = true;
+    call->dst = NULL;
+    changed = true;
+  }
+  return changed;
+}
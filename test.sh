@@ -1,7 +1,10 @@
 #!/bin/bash
 
+# arguments, such as an optimization level, are passed on to every compile
+flags="$*"
+
 function compile {
-  echo "$1" | ./yowaic > foo.s
+  echo "$1" | ./yowaic $flags > foo.s
   if [ $? -ne 0 ]; then
     echo "Failed to compile $1"
     exit
@@ -33,6 +36,15 @@ function testast {
   testastf "$1" "int f(){$2}"
 }
 
+function testfoldast {
+  result="$(echo "int f(){$2}" | ./yowaic -A)"
+  if [ $? -ne 0 ]; then
+    echo "Failed to compile $2"
+    exit
+  fi
+  assertequal "$result" "$1"
+}
+
 function testf {
   compile "$2"
   assertequal "$(./foo.out)" "$1"
@@ -42,6 +54,53 @@ function test {
   testf "$1" "int f(){$2}"
 }
 
+function testpeephole {
+  hits="$(echo "$2" | ./yowaic --peephole-stats $3 2>&1 >/dev/null | awk -v rule="$1" '$2 == rule {print $3}')"
+  if [ -z "$hits" ] || [ "$hits" -eq 0 ]; then
+    echo "Peephole rule $1 did not fire: $2"
+    exit
+  fi
+}
+
+function testir {
+  result="$(echo "$2" | ./yowaic --dump-ir $3)"
+  if [ $? -ne 0 ]; then
+    echo "Failed to compile $2"
+    exit
+  fi
+  if ! echo "$result" | grep -qx -- "$1"; then
+    echo "Test failed: $1 expected in the IR of $2"
+    exit
+  fi
+}
+
+function testnoir {
+  if echo "$2" | ./yowaic --dump-ir $3 | grep -q -- "$1"; then
+    echo "Test failed: $1 not expected in the IR of $2"
+    exit
+  fi
+}
+
+function testhoisted {
+  if ! echo "$2" | ./yowaic --dump-ir | sed '/ br /q' | grep -q -- "$1"; then
+    echo "Test failed: $1 expected before the loop of $2"
+    exit
+  fi
+}
+
+function testasmcount {
+  count="$(echo "$2" | ./yowaic $4 | grep -c -- "$1")"
+  assertequal "$count" "$3"
+}
+
+function testvectorized {
+  result="$(echo "$2" | ./yowaic --vectorize-report $3 2>&1 >/dev/null)"
+  if ! echo "$result" | grep -q -- "$1"; then
+    echo "Test failed: $1 expected in the vectorizer report of $2"
+    exit
+  fi
+}
+
 function testfail {
   expr="$1"
   echo "$expr" | ./yowaic > /dev/null 2>&1
@@ -80,6 +139,14 @@ testast '(int)f(){(int)a();}' 'a();'
 testast '(int)f(){(int)a(1,2,3,4,5,6);}' 'a(1,2,3,4,5,6);'
 testast '(int)f(){(return 1);}' 'return 1;'
 
+# Constant folding
+testfoldast '(int)f(){11;}' '1+2*3+4;'
+testfoldast '(int)f(){(decl int a 1);a;a;0;a;}' 'int a=1;a+0;a*1;a*0;a/1;'
+testfoldast '(int)f(){(* (int)g() 0);}' 'g()*0;'
+testfoldast '(int)f(){(/ 1 0);}' '1/0;'
+testfoldast '(int)f(){(decl char* c "ab"[1]);}' 'char *c="ab"+1;'
+testfoldast '(int)f(){(decl int[3] a {1,2,3});(decl int* b a[2]);}' 'int a[]={1,2,3};int *b=a+1+1;'
+
 testastf '(int)f(int c){c;}' 'int f(int c){c;}'
 testastf '(int)f(int c){c;}(int)g(int d){d;}' 'int f(int c){c;} int g(int d){d;}'
 
@@ -106,6 +173,15 @@ test 55 'int a[]={55};int *b=a;*b;'
 test 67 'int a[]={55,67};int *b=a+1;*b;'
 test 30 'int a[]={20,30,40};int *b=a+1;*b;'
 test 20 'int a[]={20,30,40};*a;'
+test 9 'int a[]={1,2,3,4,5,6,7,8,9,10};int *b=a+8;*b;'
+test 5 'int a[]={5,0,0,0,0,0,0,0,0,0,0,0};int *b=a+11;*b+*a;'
+test 4 'int x=4;int a[]={1,2,3,x,5,6,7,8,9};int *b=a+3;*b;'
+test 69 'int a[]={1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,41,42,43,44,45,46,47,48,49,50,51,52,53,54,55,56,57,58,59,60,61,62,63,64,65,66,67,68,69,70};int *b=a+68;*b;'
+testf 'the quick brown fox jumps over the lazy dog0' 'int f(){char s[]="the quick brown fox jumps over the lazy dog";printf("%s",s);0;}'
+testir '  copy 8 &a, &.L[0-9]*' 'int f(){int a[]={5,0,0,0,0,0,0,0,0,0,0,0};*a;}'
+testir '  copy 40 &a+8' 'int f(){int a[]={5,0,0,0,0,0,0,0,0,0,0,0};*a;}'
+testasmcount 'movdqu' 'int f(){int a[]={1,2,3,4,5,6,7,8,9,10};*a;}' 4
+testasmcount 'rep movsb' 'int f(){int a[]={1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,41,42,43,44,45,46,47,48,49,50,51,52,53,54,55,56,57,58,59,60,61,62,63,64,65,66,67,68,69,70};*a;}' 1
 
 # Function call
 test a3 'printf("a");3;'
@@ -117,6 +193,8 @@ test 61 'int a=61;int *b=&a;*b;'
 test 97 'char *c="ab";*c;'
 test 98 'char *c="ab"+1;*c;'
 test 122 'char s[]="xyz";char *c=s+2;*c;'
+test 121 'char s[]="xyz";char *c=s+3-2;*c;'
+test 99 'char *c="abc"+1+1;*c;'
 test 65 'char s[]="xyz";*s=65;*s;'
 
 # If statement
@@ -127,6 +205,57 @@ test 'y1' 'if(0){printf("x");}else{printf("y");}1;'
 
 # For statement
 test 012340 'for(int i=0; i<5; i=i+1){printf("%d",i);}0;'
+test 0123 'for(int i=0; i<5; i=i+1){if(i==3){break;}printf("%d",i);}3;'
+
+# Switch statement
+testf '99 10 23 3 40 99 60 99 0' 'int g(int a){int s=0;switch(a){case 1:s=10;break;case 2:s=20;case 3:s=s+3;break;case 4:s=40;break;case 6:s=60;break;default:s=99;}s;} int f(int n){for(int i=0;i<8;i=i+1){printf("%d ",g(i));}0;}'
+testf '1234500' 'int g(int a){int r=0;switch(a){case 10:r=1;break;case 200:r=2;break;case 3000:r=3;break;case 40000:r=4;break;case 500000:r=5;break;}r;} int f(int n){printf("%d%d%d%d",g(10),g(200),g(3000),g(40000));printf("%d%d",g(500000),g(11));0;}'
+testf 2 'int g(int a){int r=0;switch(a){case 1:r=2;break;case 5:r=3;break;}r;} int f(int n){int r=0;for(int i=0;i<10;i=i+1){if(i==n-98){break;}r=r+g(i);}r;}'
+testf 12 'int f(int n){int s=0;switch(n){case 100:s=1;case 101:s=s+2;case 102:s=s+4;case 103:s=s+8;}s;}'
+testf '11 10 20 0' 'int g(int a,int b){int r=0;switch(a){case 1:switch(b){case 1:r=11;break;default:r=10;}break;case 2:r=20;break;}r;} int f(int n){printf("%d %d %d ",g(1,1),g(1,5),g(2,1));g(3,3);}'
+testf '0 5 7 9 11 0 0' 'int g(int a){switch(a){case 1:return 5;case 2:return 7;case 3:return 9;case 4:return 11;default:return 0;}} int f(int n){for(int i=0;i<6;i=i+1){printf("%d ",g(i));}g(n);}'
+testf '149' "int g(char c){int r=9;switch(c){case 'a':r=1;break;case 'b':r=2;break;case 'c':r=3;break;case 'd':r=4;break;}r;} int f(int n){printf(\"%d%d\",g('a'),g('d'));g('e');}"
+testir '  switch %0, B8 \[1: B3 B4 B5 B6 B8 B7\]' 'int f(int a){int s=0;switch(a){case 1:s=10;break;case 2:s=20;case 3:s=s+3;break;case 4:s=40;break;case 6:s=60;break;default:s=99;}s;}'
+testasmcount 'jmp \*%rax' 'int f(int a){int s=0;switch(a){case 1:s=10;break;case 2:s=20;case 3:s=s+3;break;case 4:s=40;break;case 6:s=60;break;default:s=99;}s;}' 1
+testasmcount 'jmp \*%rax' 'int f(int a){int r=0;switch(a){case 10:r=1;break;case 200:r=2;break;case 3000:r=3;break;case 40000:r=4;break;case 500000:r=5;break;}r;}' 0
+testasmcount 'cmp' 'int f(int a){int r=0;switch(a){case 1:r=2;break;case 5:r=3;break;}r;}' 2
+testnoir 'switch' 'int f(int a){switch(a){case 1:return 5;case 2:return 7;case 3:return 9;case 4:return 11;default:return 0;}}'
+testir '  %[0-9]*:i32 = load.i32 %[0-9]*' 'int f(int a){switch(a){case 1:return 5;case 2:return 7;case 3:return 9;case 4:return 11;default:return 0;}}'
+testf '0 5 7 9 11 0' 'int g(int a){switch(a){case 600000001:return 5;case 600000002:return 7;case 600000003:return 9;case 600000004:return 11;default:return 0;}} int f(int n){for(int i=600000000;i<600000005;i=i+1){printf("%d ",g(i));}g(n);}'
+testf '5 7 9 11 0' 'int g(int a){switch(a){case 2147483644:return 5;case 2147483645:return 7;case 2147483646:return 9;case 2147483647:return 11;default:return 0;}} int f(int n){for(int i=2147483644;i<2147483647;i=i+1){printf("%d ",g(i));}printf("%d ",g(2147483647));g(n);}'
+testf '3 2 0' 'int g(int a){int r=0;switch(a){case 0-1:r=3;break;case 2*3-4:r=2;break;}r;} int f(int n){printf("%d %d ",g(0-1),g(2));g(n);}'
+testf '0 5 7 9 11 0 0' 'int g(int a){switch(a){case 0-2:return 5;case 0-1:return 7;case 0:return 9;case 1:return 11;default:return 0;}} int f(int n){for(int i=0-3;i<3;i=i+1){printf("%d ",g(i));}g(n);}'
+testf '99 10 23 3 40 99 60 0' 'int g(int a){int s=0;switch(a){case 0-4:s=10;break;case 0-3:s=20;case 0-2:s=s+3;break;case 0-1:s=40;break;case 1:s=60;break;default:s=99;}s;} int f(int n){for(int i=0-5;i<2;i=i+1){printf("%d ",g(i));}0;}'
+testf '149' "int g(char c){int r=9;switch(c){case 'a':r=1;break;case 'a'+1:r=2;break;case 'b'+1:r=3;break;case 'a'+3:r=4;break;}r;} int f(int n){printf(\"%d%d\",g('a'),g('d'));g('e');}"
+testasmcount 'jmp \*%rax' 'int f(int a){int s=0;switch(a){case 0-4:s=10;break;case 0-3:s=20;case 0-2:s=s+3;break;case 0-1:s=40;break;case 1:s=60;break;default:s=99;}s;}' 1
+testfail 'int f(int a){switch(a){case a:a;}}'
+testfail 'int f(int a){switch(a){case 1/0:a;}}'
+testfail 'int f(int a){switch(a){case 1:a;case 2-1:a;}}'
+testfail 'int f(int a){switch(a){case 1:a;case 1:a;}}'
+testfail 'int f(int a){switch(a){default:a;default:a;}}'
+testfail 'int f(int a){case 1:a;}'
+testfail 'int f(int a){break;}'
+
+# Branch conditions
+testf 2 'int f(int a){if(a==2){return 1;}return 2;}'
+testf 1 'int f(int a){if(a==102){return 1;}return 2;}'
+testf 3 'int f(){char s[]="abc";char *p=s;int n=0;for(;*p;p=p+1){n=n+1;}n;}'
+testf 0 'int f(int a){int n=0;for(;n>a;n=n+1){printf("x");}n;}'
+testasmcount 'set' 'int f(int a){if(a<2){return 1;}return 2;}' 0
+testasmcount 'set' 'int f(int a){if(a<2){return 1;}return 2;}' 1 -O0
+
+# Block layout
+testf 'rare3' 'int f(){int s=0;for(int i=0;i<5;i=i+1){if(__builtin_expect(i==3,0)){printf("rare");s=s+i;}}s;}'
+testf 2 'int f(int a){if(__builtin_expect(a<5,1)){return 1;}return 2;}'
+testf 3 'int f(int a){int b=0;if(a>2){b=1;}if(a>2){b=b+2;}b;}'
+testir '  br %2, B1, B2 likely B2' 'int f(int a){int b=0;if(__builtin_expect(a<2,0)){b=5;}b;}'
+testasmcount 'jl ' 'int f(int a){int b=0;if(__builtin_expect(a<2,0)){b=5;}b;}' 1
+testasmcount 'jge ' 'int f(int a){int b=0;if(__builtin_expect(a<2,0)){b=5;}b;}' 0
+testasmcount 'call' 'int f(int a){if(a<2){printf("x");}if(a<2){printf("y");}1;}' 2
+testasmcount 'cmp' 'int f(int a){if(a<2){printf("x");}if(a<2){printf("y");}1;}' 1
+testasmcount '.p2align 4,,10' 'int f(int n){int s=0;for(int i=0;i<n;i=i+1){s=s+i*i;}s;}' 1
+testasmcount '.p2align 4,,10' 'int f(int n){int s=0;for(int i=0;i<n;i=i+1){s=s+i*i;}s;}' 0 -O0
+testfail 'int f(int a){__builtin_expect(a,a);}'
 
 # Return statement
 test 33 'return 33; return 10;'
@@ -140,6 +269,200 @@ testf 79 'int g(int a){a;} int f(){g(79);}'
 testf 98 'int g(int *p){*p;} int f(){int a[]={98};g(a);}'
 testf '99 98 97 1' 'int g(int *p){printf("%d ",*p);p=p+1;printf("%d ",*p);p=p+1;printf("%d ",*p);1;} int f(){int a[]={1,2,3};int *p=a;*p=99;p=p+1;*p=98;p=p+1;*p=97;g(a);}'
 
+# Register allocation
+testf 852 'int g(int a,int b){a+b;} int f(int n){g(n+1,g(n+2,g(n+3,g(n+4,g(n+5,g(n+6,g(n+7,n+8)))))));}'
+testf 36 'int g(int a){a;} int f(){g(1)+g(2)+g(3)+g(4)+g(5)+g(6)+g(7)+g(8);}'
+testf 103 'int g(int a,int b){b;} int f(int n){g(n+1,n)+1;}'
+
+# IR
+testir '  ret 6' 'int f(){2*3;}' '-fno-fold -O1'
+testir '  %0:i32 = mul 2, 3' 'int f(){2*3;}' '-fno-fold -O0'
+testir '  br %2, B1, B2' 'int f(int a){int b=0;if(a<2){b=5;}b;}'
+
+# Strength reduction
+testf 14 'int f(int n){n/7;}'
+testf -14 'int f(int n){int m=0-n; m/7;}'
+testf -25 'int f(int n){int m=0-n; m/4;}'
+testf 25 'int f(int n){n/4;}'
+testf 1020 'int f(int n){n*10;}'
+testf 816 'int f(int n){8*n;}'
+testf 2 'int f(){int a[]={1,2,3};int *p=a;int *q=p+2;q-p;}'
+testir '  %2:i32 = shl %0, 3' 'int f(int n){n*8;}'
+testnoir 'div' 'int f(int n){n/10;}'
+testir '  %2:i32 = div %1, 10' 'int f(int n){n/10;}' -O0
+
+# String literals
+testf 'abcbcabc0' 'int f(){printf("abc");printf("bc");printf("abc");0;}'
+testf 'xA41y0' 'int f(){printf("x\x41");printf("41");printf("y");0;}'
+testasmcount '\.string' 'int f(){printf("abc");printf("bc");printf("abc");0;}' 1
+testasmcount '\.set' 'int f(){printf("abc");printf("bc");printf("abc");0;}' 2
+testasmcount '\.string' 'int f(){printf("x\x41");printf("41");0;}' 2
+testasmcount 'rodata\.str1\.1' 'int f(){printf("abc");0;}' 1
+
+# Common subexpressions
+testf 12 'int h(int *a,int i){int *p=a+i;int *q=a+i+1;*p=*q+5;*p;} int f(){int a[]={1,2,7};h(a,1);}'
+testf 6 'int f(){int a=1;int *p=&a;int b=a;*p=5;b+a;}'
+testf 10 'int g(int *p){*p=9;0;} int f(){int a=1;int b=a;g(&a);b+a;}'
+testf 26 'int g(int a,int b){int c=a*b;if(a<b){return a*b+c;}c;} int f(){g(3,4)+g(2,1);}'
+testasmcount 'imulq' 'int g(int a,int b){int c=a*b;if(a<b){return a*b+c;}c;}' 1
+testasmcount 'movq -[0-9]*(%rbp)' 'int g(int *a,int i){int *p=a+i;*p=*p+1;*p;}' 0
+
+# Store forwarding
+testf 3 'int f(int a){int b=1;int c=2;int t=b;b=c;c=t;b+c;}'
+testf 5 'int f(){int a=1;int *p=&a;*p=5;a;}'
+testf 9 'int g(int *p){*p=9;0;} int f(){int a=1;g(&a);a;}'
+testf 44 'int f(){char c=300;c;}'
+testf 2 'int g(int *p,int *q){*p=1;*q=2;*p;} int f(){int a=0;g(&a,&a);}'
+testnoir 'load' 'int f(int a,int b){int c=a+b;a=b;b=c;a*b;}'
+testnoir 'load' 'int f(int a){int b=a*3;if(a>1){return b;}0;}'
+testnoir 'slot' 'int f(int a){int *p=&a;int c=*p;*p=c;c;}'
+testir '  ret 6' 'int f(){int a[]={1,2,3};int *p=a+1;*p=6;*p;}'
+testastf '(int)g(int*restrict p,int* q){(* p);}' 'int g(int *restrict p,int *q){*p;}'
+testf 1 'int g(int *restrict p,int *q){*p=1;*q=2;*p;} int f(){int a=0;int b=0;g(&a,&b);}'
+testir '  ret 1' 'int g(int *restrict p,int *q){*p=1;*q=2;*p;}'
+testir '  %[0-9]*:i32 = load.i32 %0' 'int g(int *p,int *q){*p=1;*q=2;*p;}'
+testfail 'int f(int restrict a){a;}'
+
+# Loops
+testf 1242 'int f(int n){int s=0;for(int i=0;i<3;i=i+1){for(int j=0;j<4;j=j+1){s=s+i*j+n;}}s;}'
+testf 6 'int f(int n){int a=1;int *p=&a;int s=0;for(int i=0;i<3;i=i+1){s=s+a;*p=a+1;}s;}'
+testf 5254 'int f(int n){int s=0;for(int i=0;i<n;i=i+1){s=s+i+1;}s+n-101;}'
+testhoisted 'mul %[0-9]*, 3' 'int f(int n){int s=0;for(int i=0;i<n;i=i+1){s=s+n*3;}s;}'
+testasmcount 'jmp' 'int f(int n){int s=0;for(int i=0;i<n;i=i+1){s=s+i;}s;}' 0
+testf 20 'int f(){int a[]={1,2,3,4};int s=0;for(int i=0;i<4;i=i+1){int *p=a+i;s=s+*p*i;}s;}'
+testf ace6 'int f(){char c[]="abcde";int j=0;for(j=0;j<5;j=j+2){char *q=c+j;printf("%c",*q);}j;}'
+testf 26 'int f(int n){int a[]={5,6,7,8};int s=0;for(int i=n;i<n+4;i=i+1){int *p=a+i-n;s=s+*p;}s;}'
+testir '  %[0-9]*:ptr = add %[0-9]*, 4' 'int f(){int a[]={1,2,3,4};int s=0;for(int i=0;i<4;i=i+1){int *p=a+i;s=s+*p;}s;}' '-funroll-limit=0 -fno-vectorize'
+testnoir 'store.i32 &i, %' 'int f(){int a[]={1,2,3,4};int s=0;for(int i=0;i<4;i=i+1){int *p=a+i;s=s+*p;}s;}' '-funroll-limit=0 -fno-vectorize'
+testf 4950 'int f(){int s=0;for(int i=0;i<100;i=i+1){s=s+i;}s;}'
+testf 5253 'int f(){int s=0;for(int i=0;i<103;i=i+1){s=s+i;}s;}'
+testf 459 'int f(){int s=0;for(int i=10;i>0-7;i=i-3){s=s*2+i;}s;}'
+testf 135 'int f(){int s=0;for(int i=0;i<10;i=i+1){for(int j=0;j<3;j=j+1){s=s+i*j;}}s;}'
+testasmcount 'jl\|jge' 'int f(){int s=0;for(int i=0;i<5;i=i+1){s=s+i;}s;}' 0
+testasmcount 'jl\|jge' 'int f(){int s=0;for(int i=0;i<5;i=i+1){s=s+i;}s;}' 1 -funroll-limit=0
+testasmcount 'jne' 'int f(){int s=0;for(int i=0;i<103;i=i+1){s=s+i;}s;}' 1 -O2
+
+# Vectorization
+testf 190 'int sum(int *a,int n){int s=0;for(int i=0;i<n;i=i+1){int *p=a+i;s=s+*p;}s;} int f(){int a[]={1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19};sum(a,19);}'
+testf 2 'int sum(int *a,int n){int s=0;for(int i=0;i<n;i=i+1){int *p=a+i;s=s+*p;}s;} int f(){int a[]={1,1};sum(a,2);}'
+testf 285 'int sum(int *a,int n){int s=0;for(int i=0;i<n;i=i+1){int *p=a+i;s=s+*p;}s;} int add(int *a,int *b,int *c,int n){for(int i=0;i<n;i=i+1){int *p=a+i;int *q=b+i;int *r=c+i;*r=*p+*q;}0;} int f(){int a[]={1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19};int b[]={5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5};int c[]={0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};add(a,b,c,19);sum(c,20);}'
+testf 1330 'int sum(int *a,int n){int s=0;for(int i=0;i<n;i=i+1){int *p=a+i;s=s+*p;}s;} int add(int *a,int *b,int *c,int n){for(int i=0;i<n;i=i+1){int *p=a+i;int *q=b+i;int *r=c+i;*r=*p+*q;}0;} int f(){int a[]={1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19};add(a,a+1,a+1,18);sum(a,19);}'
+testf 4 'int sum(int *a,int n){int s=0;for(int i=0;i<n;i=i+1){int *p=a+i;s=s+*p;}s;} int f(){int a[]={1,9,3,9,5,9,7,9,9,9};int b[]={5,5,5,5,5,5,5,5,5,5};for(int i=0;i<10;i=i+1){int *p=a+i;int *q=b+i;int *r=a+i;*r=*p<*q;}sum(a,10)+2;}'
+testf 52 'int sum(int *a,int n){int s=0;for(int i=0;i<n;i=i+1){int *p=a+i;s=s+*p;}s;} int f(){int a[]={1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1};for(int i=0;i<17;i=i+1){int *p=a+i;*p=3;}sum(a,18);}'
+testf 'bcdefghijklmnopqrstuvwxyz{0' 'int f(){char s[]="abcdefghijklmnopqrstuvwxyz";char t[]="bbbbbbbbbbbbbbbbbbbbbbbbbb";for(int i=0;i<26;i=i+1){char *p=s+i;char *q=t+i;*p=*p+*q-97;}printf("%s",s);0;}'
+testf 'bbaaaaaaaaaaaaaaaaba0' 'int f(){char s[]="zzaaaaaaaaaaaaaaaaza";char t[]="bbbbbbbbbbbbbbbbbbbb";for(int i=0;i<20;i=i+1){char *p=s+i;char *q=t+i;*p=*q<*p;}for(int j=0;j<20;j=j+1){char *u=s+j;*u=*u+97;}printf("%s",s);0;}'
+testvectorized 'sum: loop B[0-9]* vectorized, 4 lanes of int' 'int sum(int *a,int n){int s=0;for(int i=0;i<n;i=i+1){int *p=a+i;s=s+*p;}s;}'
+testvectorized 'vectorized, 16 lanes of char' 'int f(char *s,int n){for(int i=0;i<n;i=i+1){char *p=s+i;*p=*p+1;}0;}'
+testvectorized 'not vectorized: call in the loop' 'int f(int n){for(int i=0;i<n;i=i+1){printf("");}0;}'
+testvectorized 'not vectorized: comparison of chars' 'int f(char *s,int n){for(int i=0;i<n;i=i+1){char *p=s+i;*p=*p+1<5;}0;}'
+testir '  %[0-9]*:v4i32 = add %[0-9]*, %[0-9]*' 'int sum(int *a,int n){int s=0;for(int i=0;i<n;i=i+1){int *p=a+i;s=s+*p;}s;}'
+testnoir 'v4i32' 'int sum(int *a,int n){int s=0;for(int i=0;i<n;i=i+1){int *p=a+i;s=s+*p;}s;}' -fno-vectorize
+testasmcount 'paddd' 'int sum(int *a,int n){int s=0;for(int i=0;i<n;i=i+1){int *p=a+i;s=s+*p;}s;}' 2
+testasmcount 'pcmpgtb' 'int f(char *s,char *t,int n){for(int i=0;i<n;i=i+1){char *p=s+i;char *q=t+i;*p=*p<*q;}0;}' 1
+testf 9 'int inc(int *restrict a,int *restrict b,int n){for(int i=0;i<n;i=i+1){int *p=a+i;int *q=b+i;*p=*q+1;}0;} int f(){int a[]={0,0,0,0,0,0};int b[]={1,2,3,4,5,6};inc(a,b,6);int *r=a+5;*r+*a;}'
+testir '  %[0-9]*:i32 = ge %[0-9]*, 16' 'int inc(int *a,int *b,int n){for(int i=0;i<n;i=i+1){int *p=a+i;int *q=b+i;*p=*q+1;}0;}'
+testnoir ' ge ' 'int inc(int *restrict a,int *restrict b,int n){for(int i=0;i<n;i=i+1){int *p=a+i;int *q=b+i;*p=*q+1;}0;}'
+
+# Inlining
+testastf 'inline (int)g(int a){a;}' 'inline int g(int a){a;}'
+testf 13 'int g(int a){a*2;} int f(){int s=0;for(int i=0;i<3;i=i+1){s=s+g(i);}g(s)+1;}'
+testf 44 'int g(char c){c;} int f(){g(300);}'
+testf 107 'int g(int a){if(a<3){return 1;}return a;} int f(){g(1)*100+g(7);}'
+testf 6 'int h(int *p){*p=*p+1;0;} int f(){int a=4;h(&a);h(&a);a;}'
+testf 55 'int g(int n){if(n<1){return 0;}n+g(n-1);} int f(){g(10);}'
+testf 74 'inline int g(int a){int s=0;for(int i=0;i<a;i=i+1){s=s+i*a;}s;} int f(){g(4)+g(5);}'
+testnoir 'call g' 'int g(int a){a*2;} int f(){g(3);}'
+testir '  tail call g(3)' 'int g(int a){a*2;} int f(){g(3);}' -fno-inline
+testir '  %[0-9]*:i32 = call g(.*)' 'int g(int n){if(n<1){return 0;}n+g(n-1);} int f(){g(10);}'
+testnoir 'call g' 'inline int g(int a){int s=0;for(int i=0;i<a;i=i+1){s=s+i*a;}s;} int f(){g(4);}'
+testir '  tail call g(4)' 'int g(int a){int s=0;for(int i=0;i<a;i=i+1){s=s+i*a;}s;} int f(){g(4);}'
+
+# Tail calls
+testf 50005000 'int g(int n,int acc){if(n<1){return acc;}return g(n-1,acc+n);} int f(){g(10000,0);}'
+testf 14 'int h(int a){a*3;} int g(int n){if(n<1){return 5;} return h(n);} int f(){g(3)+g(0);}'
+testf -126 'int g(char c,int n){if(n<1){return c;}return g(c+1,n-1);} int f(){g(120,10);}'
+testf 0 'int even(int n){if(n<1){return 1;}return odd(n-1);} int odd(int n){if(n<1){return 0;}return even(n-1);} int f(){even(10001);}'
+testasmcount 'call' 'int g(int n,int acc){if(n<1){return acc;}return g(n-1,acc+n);} int f(){g(10000,0);}' 0
+testasmcount 'jmp even' 'int even(int n){if(n<1){return 1;}return odd(n-1);} int odd(int n){if(n<1){return 0;}return even(n-1);}' 1 -fno-inline
+testir '  %[0-9]*:i32 = call g(%[0-9]*)' 'int g(int n){if(n<1){return 0;}n+g(n-1);} int f(){g(10);}'
+testir '  %[0-9]*:i32 = call g(%[0-9]*, 1)' 'int h(int *p){*p;} int g(int n,int acc){int *p=&acc;if(n<1){return h(p);}return g(n-1,1);}' -fno-inline
+
+# Calls
+testf 321 'int g(int a,int b,int c){a*100+b*10+c;} int h(int a,int b,int c){g(c,b,a);} int f(){h(1,2,3);}'
+testf 12 'int g(int a,int b){a-b;} int h(int a,int b){g(b,a)+g(b,a)*2;} int f(){h(1,5);}'
+testf 6 'int g(int a,int b,int c,int d,int e,int x){x;} int h(int a,int b,int c,int d,int e,int x){g(x,a,b,c,d,e)+g(b,c,d,e,x,a);} int f(){h(1,2,3,4,5,6);}'
+testasmcount 'pop' 'int g(int a,int b){a-b;} int f(){int x=3;g(x,2)+g(2,x);}' 0 -fno-inline
+testasmcount '%eax$' 'int g(){1;} int f(){g()+1;}' 0 -fno-inline
+testasmcount 'movl \$0, %eax' 'int f(){printf("");1;}' 1
+testastf 'static inline (int)g(int a){a;}' 'static inline int g(int a){a;}'
+testf 308 'static int sq(int x){int s=0;for(int i=0;i<x;i=i+1){s=s+x;}s;} int f(int n){int a=n+1;int c=sq(a);a+c-n*n;}'
+testasmcount '\.global sq' 'static int sq(int x){x*x;} int f(int n){sq(n)+sq(n+1);}' 0 -fno-inline
+testasmcount '\.global f' 'static int sq(int x){x*x;} int f(int n){sq(n)+sq(n+1);}' 1 -fno-inline
+testnoir 'fun g' 'static int g(int a){a;} int f(){1;}'
+testnoir 'call g' 'static int g(int a){int s=0;for(int i=0;i<a;i=i+1){s=s+i*a;}s;} int f(int a){g(a);}'
+testir '  tail call g(%0)' 'int g(int a){int s=0;for(int i=0;i<a;i=i+1){s=s+i*a;}s;} int f(int a){g(a);}'
+testasmcount 'rbx' 'static int sq(int x){int s=0;for(int i=0;i<x;i=i+1){s=s+x;}s;} int f(int n){int a=n+1;int c=sq(a);a+c;}' 0 -fno-inline
+testasmcount 'rbx' 'int sq(int x){int s=0;for(int i=0;i<x;i=i+1){s=s+x;}s;} int f(int n){int a=n+1;int c=sq(a);a+c;}' 5 -fno-inline
+
+# Builtins
+testfoldast '(int)f(){3;}' 'strlen("abc");'
+testfoldast '(int)f(){2;}' 'strlen("abcd"+2);'
+testfoldast '(int)f(){-1;1;0;}' 'strcmp("ab","ac");strcmp("b","a");strcmp("x","x");'
+testfoldast '(int)f(){5;}' 'abs(0-5);'
+testf 7 'int strlen(char *s){7;} int f(){strlen("abc");}'
+testf 'hello 5' 'int f(){char a[]="hello";char b[]="world";memcpy(b,a,6);printf("%s ",b);strlen(b);}'
+testf 'AAAAAAA 0' 'int f(){char b[]="0123456789";memset(b,65,7);char *p=b+7;memset(p,0,3);printf("%s ",b);0;}'
+testf '7 3 0' 'int f(int n){printf("%d %d ",abs(n-109),abs(105-n));abs(n-102);}'
+testasmcount 'call' 'int g(char *d,char *s){memcpy(d,s,24);memset(s,0,300);abs(*d);}' 0
+testasmcount 'movdqu' 'int g(char *d,char *s){memcpy(d,s,24);0;}' 2
+testasmcount 'call strlen' 'int g(char *s){strlen(s)+1;}' 1
+testasmcount 'call memcpy' 'int g(char *d,char *s,int n){memcpy(d,s,n);0;}' 1
+testasmcount 'call abs' 'int g(int n){abs(n)+1;}' 1 -fno-builtin
+
+# Frames
+testnoir 'slot' 'int f(int a,int b){if(a<b){return b-a;}a-b;}'
+testir '  slot a\[4\]' 'int g(int *p){*p;} int f(int a){int *p=&a;g(p);}' -fno-inline
+testir '  slot s\[4\]' 'int g(int *p){*p=*p+1;} int f(int n){int s=0;for(int i=0;i<n;i=i+1){g(&s);}s;}' -fno-inline
+testf '6765 21 -11 7080' 'int fib(int n){int a=0;int b=1;for(int i=0;i<n;i=i+1){int t=a;a=b;b=t+b;}a;} int sw(int n){int a=1;int b=2;for(int i=0;i<n;i=i+1){int t=a;a=b;b=t;}a*10+b;} int ch(int n){char c=n;int s=0;for(int i=0;i<n;i=i+1){c=c+100;s=s+c;}s;} int old(int n){int x=n;int y=x;x=x+1;y*100+x;} int f(){printf("%d %d %d %d",fib(20),sw(3),ch(5),old(7));0;}'
+testf 1 'static int g1(int x0,int x1){if(x0<1){return 1;}return g1(x0-1,x1>10);} int f(int n){int v6=g1(n,n);return g1(6,v6);}'
+testasmcount 'subq' 'int f(){int a[]={1,2,3,4};int *p=a+2;*p;}' 0
+testasmcount 'subq' 'int f(){int a[]={1,2,3,4};int *p=a+2;*p;}' 1 -O0
+testasmcount 'rbp' 'int g(int a,int b){a-b;} int f(){g(5,3)+g(1,2);}' 0 '-fomit-frame-pointer -fno-inline'
+testasmcount 'push' 'int g(int a,int b,int c){c-b-a;}' 0 -fomit-frame-pointer
+testasmcount 'rsp' 'int g(int a){a;} int f(){g(1);}' 0 '-fomit-frame-pointer -fno-inline'
+saved="$flags"
+flags="$flags -fomit-frame-pointer"
+test 3 'int a[]={1,2,3,4};int *p=a+2;*p;'
+testf 7 'int g(int a,int b){a-b;} int f(){int x=g(10,3);printf("");x;}'
+testf 2 'int g(int a,int b,int c){if(a<1){return b;}g(a-1,c,b);} int f(){g(5,1,2)+g(0,0,0);}'
+testf 55 'int g(int n){if(n<2){return n;}g(n-1)+g(n-2);} int f(){g(10);}'
+flags="$saved"
+
+# Instruction selection
+testf 9 'int g(int *a,int i){int *p=a+i;*p;} int f(){int a[]={7,8,9};g(a,2);}'
+testf 17 'int g(int a,int b){a*5+b;} int f(){g(3,2);}'
+testf 3 'int f(){int i=2;int a[]={1,2,3,4};int *p=a+i;*p;}'
+testasmcount 'leaq (%r[0-9a-z]*,%r[0-9a-z]*,4)' 'int g(int *a,int i){int *p=a+i;*p=*p+1;*p;}' 1
+testasmcount 'shlq\|imulq' 'int g(int *a,int i){int *p=a+i;*p;}' 0
+testasmcount 'leaq (%r[0-9a-z]*,%r[0-9a-z]*,4)' 'int g(int a,int b){a*5+b;}' 1
+testasmcount 'movslq -[0-9]*(%rbp,%r[0-9a-z]*,4)' 'int f(int i){int a[]={1,2,3,4};int *p=a+i;*p;}' 1
+testasmcount 'movl %r[0-9]*d, ' 'int g(int *p,int *q){*p+*q;} int f(int a){int b=a+1;int c=b*2;g(&b,&c);}' 2 -fno-inline
+
+# Dead code
+testnoir 'ret 10' 'int f(){return 33; return 10;}'
+testnoir 'printf' 'int f(){if(0){printf("x");}1;}'
+testir '  ret 1' 'int f(int a){a; 2*a; 1;}'
+testnoir 'slot' 'int f(int a){int b=a; b=2; 1;}'
+testnoir 'store.i32 &b, 1' 'int f(){int b=1; b=2; b;}'
+testasmcount 'leave' 'int f(int a){if(a<2){return 1;}return 2;}' 1
+test 2 'int b=1; b=2; b;'
+test 5 'int a=5; int *p=&a; a;'
+
+# Peephole
+testpeephole store-reload 'int f(){int a=1;int *b=&a;*b;}' -O0
+testpeephole store-reload-extend 'int f(int a){int b=a;b;}' -O0
+testpeephole setcc-store-branch 'int f(int a){if(a<2){1;}}' -O0
+
 testfail '0abc;'
 testfail '1+;'
 testfail '1=2;'
@@ -39,9 +39,44 @@ void test_list() {
   assertEuqal(true, (size_t)ywiterEnd(iter));
 }
 
+void test_vec() {
+  ywvec* yv = ywvecCreate();
+  for (size_t i = 0; i < 20; i++)
+    ywvecPush(yv, (void *)i);
+  assertEuqal(20, ywvecLen(yv));
+  assertEuqal(13, (size_t)ywvecGet(yv, 13));
+  ywvecRemove(yv, 0);
+  assertEuqal(1, (size_t)ywvecGet(yv, 0));
+  ywvecInsert(yv, 1, (void *)100);
+  assertEuqal(100, (size_t)ywvecGet(yv, 1));
+  assertEuqal(2, (size_t)ywvecGet(yv, 2));
+  assertEuqal(1, ywvecIndex(yv, (void *)100));
+  assertEuqal(19, (size_t)ywvecPop(yv));
+  assertEuqal(19, ywvecLen(yv));
+}
+
+void test_bits() {
+  ywbits* a = ywbitsCreate(100);
+  ywbits* b = ywbitsCreate(100);
+  ywbitsSet(a, 3);
+  ywbitsSet(b, 70);
+  assertEuqal(true, ywbitsGet(a, 3));
+  assertEuqal(false, ywbitsGet(a, 70));
+  assertEuqal(true, ywbitsUnion(a, b));
+  assertEuqal(true, ywbitsGet(a, 70));
+  assertEuqal(false, ywbitsUnion(a, b));
+  ywbits* c = ywbitsCopy(a);
+  assertEuqal(true, ywbitsEqual(a, c));
+  ywbitsReset(c, 3);
+  assertEuqal(false, ywbitsGet(c, 3));
+  assertEuqal(false, ywbitsEqual(a, c));
+}
+
 int main(int argc, char **argv) {
   test_string();
   test_list();
+  test_vec();
+  test_bits();
   printf("Passed\n");
   return 0;
 }
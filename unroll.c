@@ -0,0 +1,356 @@
+// unroll.c
+// unrolling of loops with a constant trip count
+// Copyright (C) 2018: see LICENSE
+#include "pass.h"
+#include "ir.h"
+#include "util.h"
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+int unroll_limit = 64;
+int unroll_factor = 4;
+
+// loops running more iterations than this are not analysed further
+#define MAX_TRIP_COUNT 1000000
+
+// a loop counting a local from init by step while `load &s cmp bound` holds
+typedef struct Counter {
+  IrSlot* slot;
+  long init;
+  long step;
+  long bound;
+  // the test deciding whether to iterate again, in the single latch
+  IrInsn* cmp;
+  long trips;
+} Counter;
+
+static IrFun* fun;
+static IrInsn** def;
+static IrBlock** def_block;
+
+static bool isSlotStore(IrInsn* insn, IrSlot* slot) {
+  return IR_STORE == insn->op && IRV_SLOT == insn->a->kind && insn->a->slot == slot;
+}
+
+static bool isSlotLoad(IrValue* v, IrSlot* slot) {
+  IrInsn* insn = irIsReg(v) ? def[v->reg] : NULL;
+  return insn && IR_LOAD == insn->op && IRT_I32 == insn->type && IRV_SLOT == insn->a->kind &&
+         insn->a->slot == slot && !insn->a->slot_offset;
+}
+
+static bool compare(int op, long a, long b) {
+  switch (op) {
+  case IR_LT:
+    return a < b;
+  case IR_LE:
+    return a <= b;
+  case IR_GT:
+    return a > b;
+  case IR_GE:
+    return a >= b;
+  case IR_EQ:
+    return a == b;
+  default:
+    return a != b;
+  }
+}
+
+// the constant stored to slot on every path into the loop
+static bool findInit(IrLoop* loop, IrSlot* slot, long* init) {
+  IrBlock* block = loop->preheader;
+  for (size_t n = 0; n < ywvecLen(fun->blocks); n++) {
+    for (size_t i = ywvecLen(block->insns); i-- > 0;) {
+      IrInsn* insn = ywvecGet(block->insns, i);
+      if (!isSlotStore(insn, slot))
+        continue;
+      if (IRT_I32 != insn->type || insn->a->slot_offset || IRV_IMM != insn->b->kind)
+        return false;
+      *init = insn->b->imm;
+      return true;
+    }
+    if (1 != ywvecLen(block->preds))
+      return false;
+    block = ywvecGet(block->preds, 0);
+  }
+  return false;
+}
+
+/**
+ * Find the counter of an innermost loop whose only exit is the test at
+ * the end of its single latch, and count the iterations by running the
+ * counter: the loop body has run once when the test is first reached.
+ */
+static bool findCounter(IrLoop* loop, ywbits* escaped, Counter* counter) {
+  if (!loop->preheader || 1 != ywvecLen(loop->latches))
+    return false;
+  IrBlock* latch = ywvecGet(loop->latches, 0);
+  IrInsn* term = irTerminator(latch);
+  if (IR_BR != term->op || (term->target != loop->header && term->els != loop->header))
+    return false;
+  for (size_t i = 0; i < ywvecLen(loop->blocks); i++) {
+    IrBlock* block = ywvecGet(loop->blocks, i);
+    for (size_t j = 0; j < ywvecLen(block->succs); j++) {
+      IrBlock* succ = ywvecGet(block->succs, j);
+      if (block != latch && !irLoopContains(loop, succ))
+        return false;
+      if (succ == loop->header && block != latch)
+        return false;
+    }
+  }
+  IrInsn* cmp = irIsReg(term->a) ? def[term->a->reg] : NULL;
+  if (!cmp || cmp->op < IR_LT || IR_NE < cmp->op || def_block[cmp->dst->reg] != latch ||
+      IRV_IMM != cmp->b->kind || !irIsReg(cmp->a) || !def[cmp->a->reg] ||
+      IR_LOAD != def[cmp->a->reg]->op || IRV_SLOT != def[cmp->a->reg]->a->kind)
+    return false;
+  IrSlot* slot = def[cmp->a->reg]->a->slot;
+  if (!isSlotLoad(cmp->a, slot) || ywbitsGet(escaped, slot->id))
+    return false;
+  // the only store of the counter adds a constant to it on every iteration
+  IrInsn* store = NULL;
+  IrBlock* store_block = NULL;
+  for (size_t i = 0; i < ywvecLen(loop->blocks); i++) {
+    IrBlock* block = ywvecGet(loop->blocks, i);
+    for (size_t j = 0; j < ywvecLen(block->insns); j++) {
+      IrInsn* insn = ywvecGet(block->insns, j);
+      if (!isSlotStore(insn, slot))
+        continue;
+      if (store)
+        return false;
+      store = insn;
+      store_block = block;
+    }
+  }
+  if (!store || IRT_I32 != store->type || store->a->slot_offset || !irIsReg(store->b) ||
+      !irDominates(store_block, latch))
+    return false;
+  IrInsn* add = def[store->b->reg];
+  if (!add || IR_ADD != add->op || !isSlotLoad(add->a, slot) || IRV_IMM != add->b->kind ||
+      !add->b->imm || def_block[add->a->reg] != store_block)
+    return false;
+  IrInsn* load = def[cmp->a->reg];
+  if (store_block == latch &&
+      ywvecIndex(latch->insns, load) < ywvecIndex(latch->insns, store))
+    return false;
+  if (!findInit(loop, slot, &counter->init))
+    return false;
+  counter->slot = slot;
+  counter->step = add->b->imm;
+  counter->bound = cmp->b->imm;
+  counter->cmp = cmp;
+  long value = counter->init;
+  for (counter->trips = 1; counter->trips <= MAX_TRIP_COUNT; counter->trips++) {
+    value += counter->step;
+    if (value < INT_MIN || INT_MAX < value)
+      return false;
+    if (compare(cmp->op, value, counter->bound) != (term->target == loop->header))
+      return true;
+  }
+  return false;
+}
+
+// the loop contains no other loop and its values are not used outside
+static bool isUnrollable(IrLoop* loop) {
+  for (size_t i = 0; i < ywvecLen(fun->loops); i++) {
+    IrLoop* other = ywvecGet(fun->loops, i);
+    if (other != loop && irLoopContains(loop, other->header))
+      return false;
+  }
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    if (irLoopContains(loop, block))
+      continue;
+    for (size_t j = 0; j < ywvecLen(block->insns); j++) {
+      IrValue** uses[IR_MAX_USES];
+      int nuses = irUses(ywvecGet(block->insns, j), uses);
+      for (int k = 0; k < nuses; k++)
+        if (irIsReg(*uses[k]) && def_block[(*uses[k])->reg] &&
+            irLoopContains(loop, def_block[(*uses[k])->reg]))
+          return false;
+    }
+  }
+  return true;
+}
+
+static int loopSize(IrLoop* loop) {
+  int size = 0;
+  for (size_t i = 0; i < ywvecLen(loop->blocks); i++)
+    size += ywvecLen(((IrBlock*)ywvecGet(loop->blocks, i))->insns);
+  return size;
+}
+
+static int compareRpo(const void* a, const void* b) {
+  return (*(IrBlock**)a)->rpo - (*(IrBlock**)b)->rpo;
+}
+
+/**
+ * Lay out ncopies copies of the body in front of the loop, entered from
+ * the preheader. The latch of each copy jumps to the next copy and the
+ * last one to last_next, or back to the first copy when last_next is
+ * NULL. Returns the latch of the last copy and its register map.
+ */
+static IrBlock* copyBody(IrLoop* loop, int ncopies, IrBlock* last_next, IrValue*** last_map) {
+  size_t nblocks = ywvecLen(loop->blocks);
+  IrBlock** order = malloc(nblocks * sizeof(IrBlock*));
+  for (size_t i = 0; i < nblocks; i++)
+    order[i] = ywvecGet(loop->blocks, i);
+  // definitions are copied before their uses
+  qsort(order, nblocks, sizeof(IrBlock*), compareRpo);
+  IrBlock*** copies = malloc(ncopies * sizeof(IrBlock**));
+  int at = ywvecIndex(fun->blocks, loop->header);
+  for (int k = 0; k < ncopies; k++) {
+    copies[k] = calloc(fun->block_seq, sizeof(IrBlock*));
+    for (size_t i = 0; i < nblocks; i++) {
+      IrBlock* block = ywvecGet(loop->blocks, i);
+      copies[k][block->id] = irNewBlock(fun);
+      ywvecPop(fun->blocks);
+      ywvecInsert(fun->blocks, at++, copies[k][block->id]);
+    }
+  }
+  IrBlock* latch = ywvecGet(loop->latches, 0);
+  IrBlock* first = copies[0][loop->header->id];
+  for (int k = 0; k < ncopies; k++) {
+    IrValue** map = calloc(ywvecLen(fun->regs) + 1, sizeof(IrValue*));
+    for (size_t i = 0; i < nblocks; i++) {
+      IrBlock* copy = copies[k][order[i]->id];
+      for (size_t j = 0; j < ywvecLen(order[i]->insns); j++) {
+        IrInsn* insn = irCloneInsn(fun, ywvecGet(order[i]->insns, j), map);
+        if (insn->target && irLoopContains(loop, insn->target))
+          insn->target = copies[k][insn->target->id];
+        if (insn->els && irLoopContains(loop, insn->els))
+          insn->els = copies[k][insn->els->id];
+        for (size_t c = 0; insn->cases && c < ywvecLen(insn->cases); c++) {
+          IrBlock* target = ywvecGet(insn->cases, c);
+          if (irLoopContains(loop, target))
+            ywvecSet(insn->cases, c, copies[k][target->id]);
+        }
+        ywvecPush(copy->insns, insn);
+      }
+    }
+    IrInsn* term = irTerminator(copies[k][latch->id]);
+    IrBlock* next = (k + 1 < ncopies) ? copies[k + 1][loop->header->id] : last_next;
+    if (next) {
+      term->op = IR_JMP;
+      term->a = NULL;
+      term->els = NULL;
+      term->target = next;
+    } else if (term->target == copies[k][loop->header->id]) {
+      term->target = first;
+    } else {
+      term->els = first;
+    }
+    if (k + 1 < ncopies)
+      free(map);
+    else
+      *last_map = map;
+  }
+  irTerminator(loop->preheader)->target = first;
+  IrBlock* last = copies[ncopies - 1][latch->id];
+  for (int k = 0; k < ncopies; k++)
+    free(copies[k]);
+  free(copies);
+  free(order);
+  return last;
+}
+
+static void removeLoop(IrLoop* loop) {
+  for (size_t i = 0; i < ywvecLen(loop->blocks); i++)
+    ywvecRemove(fun->blocks, ywvecIndex(fun->blocks, ywvecGet(loop->blocks, i)));
+}
+
+static IrBlock* exitOf(IrLoop* loop) {
+  IrInsn* term = irTerminator(ywvecGet(loop->latches, 0));
+  return term->target == loop->header ? term->els : term->target;
+}
+
+/**
+ * Replace a loop running trips times by that many copies of its body
+ * when they fit in the unroll limit.
+ */
+static bool unrollFully(IrLoop* loop, Counter* counter, int size) {
+  if (unroll_limit < counter->trips * size)
+    return false;
+  IrValue** map;
+  copyBody(loop, counter->trips, exitOf(loop), &map);
+  free(map);
+  removeLoop(loop);
+  return true;
+}
+
+/**
+ * Run factor copies of the body per iteration while a whole group of
+ * iterations is left, then the original loop for the remaining ones.
+ */
+static bool unrollPartially(IrLoop* loop, Counter* counter, int size) {
+  int factor = unroll_factor;
+  while (1 < factor && unroll_limit < factor * size)
+    factor--;
+  if (factor < 2 || counter->trips < 2 * factor)
+    return false;
+  long rest = counter->trips % factor;
+  IrBlock* exit = exitOf(loop);
+  IrValue** map;
+  IrBlock* latch = copyBody(loop, factor, NULL, &map);
+  // the group loop tests the counter against its value after the last group
+  IrInsn* term = irTerminator(latch);
+  IrValue* test = map[counter->cmp->dst->reg];
+  for (size_t i = 0; i < ywvecLen(latch->insns); i++) {
+    IrInsn* insn = ywvecGet(latch->insns, i);
+    if (insn->dst == test) {
+      insn->op = (term->els == exit) ? IR_NE : IR_EQ;
+      insn->b = irImm(IRT_I32, counter->init + (counter->trips - rest) * counter->step);
+    }
+  }
+  free(map);
+  if (term->els == exit)
+    term->els = rest ? loop->header : exit;
+  else
+    term->target = rest ? loop->header : exit;
+  if (!rest)
+    removeLoop(loop);
+  return true;
+}
+
+static bool unroll(IrFun* ir, bool partial) {
+  fun = ir;
+  bool changed = false;
+  for (bool again = true; again && 0 < unroll_limit;) {
+    again = false;
+    irRequire(fun, ANALYSIS_LOOPS);
+    def = calloc(ywvecLen(fun->regs) + 1, sizeof(IrInsn*));
+    def_block = calloc(ywvecLen(fun->regs) + 1, sizeof(IrBlock*));
+    for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+      IrBlock* block = ywvecGet(fun->blocks, i);
+      for (size_t j = 0; j < ywvecLen(block->insns); j++) {
+        IrInsn* insn = ywvecGet(block->insns, j);
+        if (insn->dst) {
+          def[insn->dst->reg] = insn;
+          def_block[insn->dst->reg] = block;
+        }
+      }
+    }
+    ywbits* escaped = irEscapedSlots(fun);
+    for (size_t i = 0; i < ywvecLen(fun->loops) && !again; i++) {
+      IrLoop* loop = ywvecGet(fun->loops, i);
+      Counter counter;
+      if (!isUnrollable(loop) || !findCounter(loop, escaped, &counter))
+        continue;
+      int size = loopSize(loop);
+      if (unrollFully(loop, &counter, size) || (partial && unrollPartially(loop, &counter, size))) {
+        irInvalidate(fun, 0);
+        changed = again = true;
+      }
+    }
+    free(def);
+    free(def_block);
+  }
+  return changed;
+}
+
+bool runFullUnroll(IrFun* fun) {
+  return unroll(fun, false);
+}
+
+bool runLoopUnroll(IrFun* fun) {
+  return unroll(fun, true);
+}
@@ -26,6 +26,10 @@ void warningf(char *file, int line, char *fmt, ...) {
   va_end(args);
 }
 
+int ceil8(int n) {
+  return (n + 7) / 8 * 8;
+}
+
 char *ywstrCopy(char *s) {
   char *p = malloc(sizeof(char) * (strlen(s) + 1));
   strcpy(p, s);
@@ -35,7 +39,7 @@ char *ywstrCopy(char *s) {
 static void ywstrRealloc(ywstr *ys) {
   ys->size += ys->size >> 1;
   char *new_stack = malloc(sizeof(char) * ys->size);
-  strncpy(new_stack, ys->stack, ys->size);
+  memcpy(new_stack, ys->stack, ys->length + 1);
   free(ys->stack);
   ys->stack = new_stack;
 }
@@ -48,7 +52,7 @@ ywstr *ywstrCreate(char *s) {
     ys->size += ys->size >> 1;
   }
   ys->stack = malloc(sizeof(char) * ys->size);
-  strncpy(ys->stack, s, ys->length);
+  memcpy(ys->stack, s, ys->length + 1);
   return ys;
 }
 char *ywstrGet(ywstr *ys) {
@@ -73,8 +77,8 @@ void ywstrAppendFormat(ywstr *ys, char *fmt, ...) {
   while (ys->length + s2_length + 1 >= ys->size) {
     ywstrRealloc(ys);
   }
-  strncpy(ys->stack + ys->length, s2, s2_length);
-  ys->length += s2_length;  
+  memcpy(ys->stack + ys->length, s2, s2_length + 1);
+  ys->length += s2_length;
 }
 
 ywlist* ywlistCreate() {
@@ -115,3 +119,109 @@ bool ywiterEnd(ywiter* iter) {
   return !iter->ptr;
 }
 
+
+ywvec* ywvecCreate() {
+  ywvec* ret = malloc(sizeof(ywvec));
+  ret->size = 8;
+  ret->length = 0;
+  ret->elements = malloc(sizeof(void*) * ret->size);
+  return ret;
+}
+
+void ywvecPush(ywvec* yv, void* element) {
+  ywvecInsert(yv, yv->length, element);
+}
+
+void* ywvecPop(ywvec* yv) {
+  if (!yv->length)
+    return NULL;
+  return yv->elements[--yv->length];
+}
+
+void* ywvecGet(ywvec* yv, size_t index) {
+  if (index >= yv->length)
+    error("Index out of range: %u", index);
+  return yv->elements[index];
+}
+
+void ywvecSet(ywvec* yv, size_t index, void* element) {
+  if (index >= yv->length)
+    error("Index out of range: %u", index);
+  yv->elements[index] = element;
+}
+
+void ywvecInsert(ywvec* yv, size_t index, void* element) {
+  if (index > yv->length)
+    error("Index out of range: %u", index);
+  if (yv->length == yv->size) {
+    yv->size += yv->size >> 1;
+    yv->elements = realloc(yv->elements, sizeof(void*) * yv->size);
+  }
+  memmove(yv->elements + index + 1, yv->elements + index,
+          sizeof(void*) * (yv->length - index));
+  yv->elements[index] = element;
+  yv->length++;
+}
+
+void ywvecRemove(ywvec* yv, size_t index) {
+  if (index >= yv->length)
+    error("Index out of range: %u", index);
+  memmove(yv->elements + index, yv->elements + index + 1,
+          sizeof(void*) * (yv->length - index - 1));
+  yv->length--;
+}
+
+size_t ywvecLen(ywvec* yv) {
+  return yv->length;
+}
+
+int ywvecIndex(ywvec* yv, void* element) {
+  for (size_t i = 0; i < yv->length; i++)
+    if (yv->elements[i] == element)
+      return i;
+  return -1;
+}
+
+#define BITS_PER_WORD (8 * sizeof(unsigned long))
+
+ywbits* ywbitsCreate(size_t length) {
+  ywbits* ret = malloc(sizeof(ywbits));
+  ret->length = length;
+  ret->words = calloc(length / BITS_PER_WORD + 1, sizeof(unsigned long));
+  return ret;
+}
+
+ywbits* ywbitsCopy(ywbits* yb) {
+  ywbits* ret = ywbitsCreate(yb->length);
+  memcpy(ret->words, yb->words,
+         sizeof(unsigned long) * (yb->length / BITS_PER_WORD + 1));
+  return ret;
+}
+
+void ywbitsSet(ywbits* yb, size_t index) {
+  yb->words[index / BITS_PER_WORD] |= 1UL << (index % BITS_PER_WORD);
+}
+
+void ywbitsReset(ywbits* yb, size_t index) {
+  yb->words[index / BITS_PER_WORD] &= ~(1UL << (index % BITS_PER_WORD));
+}
+
+bool ywbitsGet(ywbits* yb, size_t index) {
+  return yb->words[index / BITS_PER_WORD] & (1UL << (index % BITS_PER_WORD));
+}
+
+bool ywbitsUnion(ywbits* yb, ywbits* other) {
+  bool changed = false;
+  for (size_t i = 0; i <= yb->length / BITS_PER_WORD; i++) {
+    unsigned long w = yb->words[i] | other->words[i];
+    if (w != yb->words[i])
+      changed = true;
+    yb->words[i] = w;
+  }
+  return changed;
+}
+
+bool ywbitsEqual(ywbits* yb, ywbits* other) {
+  return !memcmp(yb->words, other->words,
+                 sizeof(unsigned long) * (yb->length / BITS_PER_WORD + 1));
+}
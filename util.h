@@ -90,9 +90,13 @@ enum {
 #define error(...) do{errorf(__FILE__, __LINE__, __VA_ARGS__);}while(0)
 #define warning(...) do{warningf(__FILE__, __LINE__, __VA_ARGS__);}while(0)
 
-void errorf(char *file, int line, char *fmt, ...);
+// never returns, so functions ending in error() need no return after it
+void errorf(char *file, int line, char *fmt, ...) __attribute__((noreturn));
 void warningf(char *file, int line, char *fmt, ...);
 
+// n rounded up to a multiple of 8
+int ceil8(int n);
+
 /**
  * some function for String
  */
@@ -130,5 +134,33 @@ ywiter* ywlistIter(ywlist* yl);
 void* ywiterNext(ywiter* iter);
 bool ywiterEnd(ywiter* iter);
 
-#endif
+typedef struct ywvec {
+  void** elements;
+  size_t length;
+  size_t size;
+} ywvec;
+
+ywvec* ywvecCreate();
+void ywvecPush(ywvec* yv, void* element);
+void* ywvecPop(ywvec* yv);
+void* ywvecGet(ywvec* yv, size_t index);
+void ywvecSet(ywvec* yv, size_t index, void* element);
+void ywvecInsert(ywvec* yv, size_t index, void* element);
+void ywvecRemove(ywvec* yv, size_t index);
+size_t ywvecLen(ywvec* yv);
+int ywvecIndex(ywvec* yv, void* element);
 
+typedef struct ywbits {
+  size_t length;
+  unsigned long* words;
+} ywbits;
+
+ywbits* ywbitsCreate(size_t length);
+ywbits* ywbitsCopy(ywbits* yb);
+void ywbitsSet(ywbits* yb, size_t index);
+void ywbitsReset(ywbits* yb, size_t index);
+bool ywbitsGet(ywbits* yb, size_t index);
+bool ywbitsUnion(ywbits* yb, ywbits* other);
+bool ywbitsEqual(ywbits* yb, ywbits* other);
+
+#endif
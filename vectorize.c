@@ -0,0 +1,594 @@
+// vectorize.c
+// run counted loops over int and char arrays with SSE2 vectors
+// Copyright (C) 2018: see LICENSE
+#include "pass.h"
+#include "ir.h"
+#include "util.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool vectorize_enabled = true;
+bool vectorize_report = false;
+
+// bytes of a vector register
+#define VECTOR_SIZE 16
+// vector values a loop may keep in registers at once, see regalloc.c
+#define MAX_VECTOR_VALUES 15
+// pairs of arrays whose overlap is checked before entering the vector loop
+#define MAX_ALIAS_CHECKS 6
+
+/**
+ * A loop `for (; i < n; i = i + 1)` of a single block whose memory
+ * accesses are all `*(base + i)` on arrays of one element type, and
+ * whose other locals are either sums `s = s + x` or only read back in
+ * the same iteration after being written.
+ */
+typedef struct VLoop {
+  IrLoop* loop;
+  IrBlock* body;
+  IrBlock* exit;
+  IrSlot* counter;
+  IrValue* bound;
+  // the increment of the counter
+  IrInsn* step;
+  int elem;
+  int lanes;
+  // slots holding sums, the stores of the sums and what they add
+  ywvec* sums;
+  ywvec* sum_stores;
+  ywvec* addends;
+  // bases of the arrays accessed, and of those stored to
+  ywvec* bases;
+  ywvec* stored_bases;
+} VLoop;
+
+static IrFun* fun;
+static IrInsn** def;
+static IrBlock** def_block;
+static int* uses;
+static ywbits* escaped;
+static int* bases;
+// registers, by number, whose value goes into a vector
+static bool* needed;
+// why the last loop analysed cannot be vectorized
+static char* reason;
+
+static bool fail(char* why) {
+  reason = why;
+  return false;
+}
+
+static IrInsn* defOf(IrValue* v) {
+  return irIsReg(v) ? def[v->reg] : NULL;
+}
+
+static bool isInvariant(VLoop* vl, IrValue* v) {
+  return !irIsReg(v) || def_block[v->reg] != vl->body;
+}
+
+static bool isSlotAccess(IrInsn* insn, IrSlot* slot) {
+  return (IR_LOAD == insn->op || IR_STORE == insn->op) && IRV_SLOT == insn->a->kind &&
+         insn->a->slot == slot;
+}
+
+/**
+ * The value a load of a local reads, when it was stored earlier in the
+ * body, which is how `int *p = a + i; *p` reaches the address.
+ */
+static IrValue* resolve(VLoop* vl, IrValue* v) {
+  IrInsn* load = defOf(v);
+  if (!load || IR_LOAD != load->op || IRV_SLOT != load->a->kind || load->a->slot_offset ||
+      def_block[v->reg] != vl->body || ywbitsGet(escaped, load->a->slot->id))
+    return v;
+  IrInsn* store = NULL;
+  for (size_t i = 0; i < ywvecLen(vl->body->insns); i++) {
+    IrInsn* insn = ywvecGet(vl->body->insns, i);
+    if (insn == load)
+      break;
+    if (IR_STORE == insn->op && isSlotAccess(insn, load->a->slot))
+      store = insn;
+  }
+  if (!store || store->a->slot_offset || store->type != load->type)
+    return v;
+  return resolve(vl, store->b);
+}
+
+// a load of the counter before it is incremented
+static bool isIndex(VLoop* vl, IrValue* v) {
+  IrInsn* load = defOf(v);
+  return load && IR_LOAD == load->op && IRV_SLOT == load->a->kind &&
+         load->a->slot == vl->counter && def_block[v->reg] == vl->body &&
+         ywvecIndex(vl->body->insns, load) < ywvecIndex(vl->body->insns, vl->step);
+}
+
+// the base of an address `base + i * size`, NULL for other addresses
+static IrValue* arrayBase(VLoop* vl, IrValue* addr, int size) {
+  IrInsn* add = defOf(resolve(vl, addr));
+  if (!add || IR_ADD != add->op || IRT_PTR != add->type)
+    return NULL;
+  for (int k = 0; k < 2; k++) {
+    IrValue* base = k ? add->b : add->a;
+    IrValue* index = resolve(vl, k ? add->a : add->b);
+    if (!isInvariant(vl, base) || IRT_PTR != base->type)
+      continue;
+    IrInsn* scale = defOf(index);
+    if (1 == size && isIndex(vl, index))
+      return base;
+    if (4 == size && scale && IR_SHL == scale->op && irIsImm(scale->b, 2) &&
+        isIndex(vl, resolve(vl, scale->a)))
+      return base;
+  }
+  return NULL;
+}
+
+static bool sameValue(IrValue* a, IrValue* b) {
+  if (a == b)
+    return true;
+  if (a->kind != b->kind || IRV_REG == a->kind)
+    return false;
+  if (IRV_SLOT == a->kind)
+    return a->slot == b->slot && a->slot_offset == b->slot_offset;
+  if (IRV_SYM == a->kind)
+    return !strcmp(a->sym, b->sym) && a->sym_offset == b->sym_offset;
+  return a->imm == b->imm;
+}
+
+static void addBase(ywvec* bases, IrValue* base) {
+  for (size_t i = 0; i < ywvecLen(bases); i++)
+    if (sameValue(ywvecGet(bases, i), base))
+      return;
+  ywvecPush(bases, base);
+}
+
+/**
+ * Whether v can be computed lane by lane, marking what it is computed
+ * from as needed. Char lanes wrap around, so comparisons of chars need
+ * operands known to fit, which exact tells.
+ */
+static bool canWiden(VLoop* vl, IrValue* v, bool* exact) {
+  v = resolve(vl, v);
+  *exact = true;
+  if (isInvariant(vl, v)) {
+    if (IRT_PTR == v->type || IRV_SYM == v->kind || IRV_SLOT == v->kind)
+      return fail("pointer arithmetic in the loop");
+    if (IRT_I8 == vl->elem && IRT_I32 == v->type)
+      *exact = IRV_IMM == v->kind && -128 <= v->imm && v->imm <= 127;
+    return true;
+  }
+  IrInsn* insn = def[v->reg];
+  bool exact_a;
+  bool exact_b;
+  switch (insn->op) {
+  case IR_LOAD:
+    if (insn->type != vl->elem || !arrayBase(vl, insn->a, irTypeSize(vl->elem)))
+      return fail("load other than from an array indexed by the counter");
+    addBase(vl->bases, arrayBase(vl, insn->a, irTypeSize(vl->elem)));
+    break;
+  case IR_ADD:
+  case IR_SUB:
+    if (!canWiden(vl, insn->a, &exact_a) || !canWiden(vl, insn->b, &exact_b))
+      return false;
+    *exact = IRT_I32 == vl->elem;
+    break;
+  case IR_LT:
+  case IR_LE:
+  case IR_GT:
+  case IR_GE:
+  case IR_EQ:
+  case IR_NE:
+    if (!canWiden(vl, insn->a, &exact_a) || !canWiden(vl, insn->b, &exact_b))
+      return false;
+    if (!exact_a || !exact_b)
+      return fail("comparison of chars that may not fit in a char");
+    break;
+  case IR_CAST:
+    if (!canWiden(vl, insn->a, exact))
+      return false;
+    if (IRT_I8 == insn->type && IRT_I32 == vl->elem)
+      return fail("conversion to char of int lanes");
+    *exact |= IRT_I8 == insn->type;
+    break;
+  default:
+    return fail("operation without a vector form");
+  }
+  needed[v->reg] = true;
+  return true;
+}
+
+// the latch `br (lt (load i), n), body, exit` after the increment of i
+static bool findCounter(VLoop* vl) {
+  IrInsn* term = irTerminator(vl->body);
+  IrInsn* cmp = defOf(term->a);
+  if (IR_BR != term->op || term->target != vl->body || !cmp || IR_LT != cmp->op ||
+      def_block[cmp->dst->reg] != vl->body || !defOf(cmp->a))
+    return fail("loop test other than counter < bound");
+  IrInsn* load = def[cmp->a->reg];
+  if (IR_LOAD != load->op || IRT_I32 != load->type || IRV_SLOT != load->a->kind ||
+      load->a->slot_offset || ywbitsGet(escaped, load->a->slot->id) ||
+      !isInvariant(vl, cmp->b) || IRT_PTR == cmp->b->type)
+    return fail("loop test other than counter < bound");
+  vl->counter = load->a->slot;
+  vl->bound = cmp->b;
+  vl->exit = term->els;
+  vl->step = NULL;
+  for (size_t i = 0; i < ywvecLen(vl->body->insns); i++) {
+    IrInsn* insn = ywvecGet(vl->body->insns, i);
+    if (IR_STORE != insn->op || !isSlotAccess(insn, vl->counter))
+      continue;
+    IrInsn* add = defOf(insn->b);
+    IrInsn* old = add ? defOf(add->a) : NULL;
+    if (vl->step || IRT_I32 != insn->type || !add || IR_ADD != add->op ||
+        !irIsImm(add->b, 1) || !old || IR_LOAD != old->op || !isSlotAccess(old, vl->counter))
+      return fail("counter not incremented by one");
+    vl->step = insn;
+  }
+  if (!vl->step || ywvecIndex(vl->body->insns, load) < ywvecIndex(vl->body->insns, vl->step))
+    return fail("counter not incremented by one");
+  return true;
+}
+
+// whether slot is only read in the body after it is written there
+static bool isTemporary(VLoop* vl, IrSlot* slot) {
+  if (ywbitsGet(escaped, slot->id))
+    return false;
+  for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+    IrBlock* block = ywvecGet(fun->blocks, i);
+    bool stored = false;
+    for (size_t j = 0; j < ywvecLen(block->insns); j++) {
+      IrInsn* insn = ywvecGet(block->insns, j);
+      if (!isSlotAccess(insn, slot))
+        continue;
+      if (IR_STORE == insn->op)
+        stored = true;
+      else if (block != vl->body || !stored)
+        return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * A sum `s = s + x` of int lanes: one load of s used only by the
+ * addition, whose result is only stored back to s.
+ */
+static bool isSum(VLoop* vl, IrInsn* store) {
+  IrSlot* slot = store->a->slot;
+  IrInsn* add = defOf(store->b);
+  if (ywbitsGet(escaped, slot->id) || IRT_I32 != store->type || store->a->slot_offset ||
+      !add || IR_ADD != add->op || 1 != uses[add->dst->reg])
+    return false;
+  IrInsn* load = NULL;
+  for (size_t i = 0; i < ywvecLen(vl->body->insns); i++) {
+    IrInsn* insn = ywvecGet(vl->body->insns, i);
+    if (insn == store || !isSlotAccess(insn, slot))
+      continue;
+    if (IR_STORE == insn->op || load)
+      return false;
+    load = insn;
+  }
+  if (!load || IRT_I32 != load->type || 1 != uses[load->dst->reg] ||
+      (add->a != load->dst && add->b != load->dst))
+    return false;
+  ywvecPush(vl->sums, slot);
+  ywvecPush(vl->sum_stores, store);
+  ywvecPush(vl->addends, (add->a == load->dst) ? add->b : add->a);
+  return true;
+}
+
+// the element type of the arrays the body stores to or loads from
+static int elementType(VLoop* vl) {
+  int elem = IRT_VOID;
+  for (size_t i = 0; i < ywvecLen(vl->body->insns); i++) {
+    IrInsn* insn = ywvecGet(vl->body->insns, i);
+    if ((IR_LOAD != insn->op && IR_STORE != insn->op) ||
+        (IRT_I8 != insn->type && IRT_I32 != insn->type) ||
+        !arrayBase(vl, insn->a, irTypeSize(insn->type)))
+      continue;
+    if (elem && elem != insn->type)
+      return IRT_VOID;
+    elem = insn->type;
+  }
+  return elem;
+}
+
+static bool analyse(VLoop* vl) {
+  IrLoop* loop = vl->loop;
+  vl->body = loop->header;
+  if (1 != ywvecLen(loop->blocks) || !loop->preheader)
+    return fail("loop of several blocks");
+  if (vl->body->no_vectorize)
+    return fail("loop made by vectorization");
+  if (IR_JMP != irTerminator(loop->preheader)->op)
+    return fail("no preheader");
+  if (!findCounter(vl))
+    return false;
+  for (size_t i = 0; i < ywvecLen(vl->body->insns); i++)
+    if (IR_CALL == ((IrInsn*)ywvecGet(vl->body->insns, i))->op)
+      return fail("call in the loop");
+  vl->elem = elementType(vl);
+  if (IRT_VOID == vl->elem)
+    return fail("no arrays of a single element type");
+  vl->lanes = VECTOR_SIZE / irTypeSize(vl->elem);
+  for (size_t i = 0; i < ywvecLen(vl->body->insns); i++) {
+    IrInsn* insn = ywvecGet(vl->body->insns, i);
+    bool exact;
+    if (IR_STORE != insn->op) {
+      if (irHasSideEffect(insn) && IR_BR != insn->op)
+        return fail("operation that may trap");
+      continue;
+    }
+    if (insn == vl->step)
+      continue;
+    if (IRV_SLOT == insn->a->kind && !isTemporary(vl, insn->a->slot)) {
+      if (IRT_I8 == vl->elem || !isSum(vl, insn))
+        return fail("local other than a sum or a temporary");
+      if (!canWiden(vl, ywvecGet(vl->addends, ywvecLen(vl->addends) - 1), &exact))
+        return false;
+      continue;
+    }
+    if (IRV_SLOT == insn->a->kind)
+      continue;
+    IrValue* base = arrayBase(vl, insn->a, irTypeSize(insn->type));
+    if (!base || insn->type != vl->elem)
+      return fail("store other than to an array indexed by the counter");
+    addBase(vl->bases, base);
+    addBase(vl->stored_bases, base);
+    if (!canWiden(vl, insn->b, &exact))
+      return false;
+  }
+  int nvectors = 0;
+  for (size_t r = 0; r < ywvecLen(fun->regs); r++)
+    nvectors += needed[r];
+  // every value may need a splat next to it, and every sum an accumulator
+  if (MAX_VECTOR_VALUES < 2 * nvectors + 3 * (int)ywvecLen(vl->sums))
+    return fail("too many vector values");
+  return true;
+}
+
+/**
+ * Pairs of arrays, one of them stored to, that may overlap: distinct
+ * locals never do, the same local only at distinct offsets, and an array
+ * a restrict qualified parameter points to none not based on it.
+ */
+static ywvec* aliasChecks(VLoop* vl) {
+  ywvec* pairs = ywvecCreate();
+  for (size_t i = 0; i < ywvecLen(vl->stored_bases); i++) {
+    IrValue* stored = ywvecGet(vl->stored_bases, i);
+    for (size_t j = 0; j < ywvecLen(vl->bases); j++) {
+      IrValue* other = ywvecGet(vl->bases, j);
+      if (sameValue(stored, other) || (ywvecIndex(vl->stored_bases, other) >= 0 &&
+                                       ywvecIndex(vl->stored_bases, other) < (int)i))
+        continue;
+      if (irRestrictDisjoint(bases, stored, other))
+        continue;
+      if (IRV_SLOT == stored->kind && IRV_SLOT == other->kind) {
+        int distance = stored->slot_offset - other->slot_offset;
+        if (stored->slot != other->slot || distance <= -VECTOR_SIZE || VECTOR_SIZE <= distance)
+          continue;
+      }
+      if (IRV_SYM == stored->kind && IRV_SYM == other->kind) {
+        int distance = stored->sym_offset - other->sym_offset;
+        if (strcmp(stored->sym, other->sym) || distance <= -VECTOR_SIZE || VECTOR_SIZE <= distance)
+          continue;
+      }
+      ywvecPush(pairs, stored);
+      ywvecPush(pairs, other);
+    }
+  }
+  return pairs;
+}
+
+static IrBlock* newBlockBefore(IrBlock* before) {
+  IrBlock* block = irNewBlock(fun);
+  ywvecPop(fun->blocks);
+  ywvecInsert(fun->blocks, ywvecIndex(fun->blocks, before), block);
+  return block;
+}
+
+static IrValue* append(IrBlock* block, int op, int type, IrValue* a, IrValue* b) {
+  IrValue* dst = (IR_STORE == op) ? NULL : irNewReg(fun, type);
+  ywvecPush(block->insns, irNewInsn(op, type, dst, a, b));
+  return dst;
+}
+
+static void appendBranch(IrBlock* block, IrValue* cond, IrBlock* target, IrBlock* els) {
+  IrInsn* br = irNewInsn(IR_BR, IRT_VOID, NULL, cond, NULL);
+  br->target = target;
+  br->els = els;
+  ywvecPush(block->insns, br);
+}
+
+static void appendJump(IrBlock* block, IrBlock* target) {
+  IrInsn* jmp = irNewInsn(IR_JMP, IRT_VOID, NULL, NULL, NULL);
+  jmp->target = target;
+  ywvecPush(block->insns, jmp);
+}
+
+/**
+ * The vector of v in the vector loop: splats of invariants are made
+ * once before the loop, other values were widened in order before.
+ */
+static IrValue* widened(VLoop* vl, IrValue* v, IrValue** map, IrBlock* pre) {
+  v = resolve(vl, v);
+  if (irIsReg(v) && map[v->reg])
+    return map[v->reg];
+  int vtype = (IRT_I8 == vl->elem) ? IRT_V16I8 : IRT_V4I32;
+  IrValue* splat = append(pre, IR_SPLAT, vtype, v, NULL);
+  if (irIsReg(v))
+    map[v->reg] = splat;
+  return splat;
+}
+
+// the address of element i of the array at base
+static IrValue* widenedAddress(VLoop* vl, IrValue* addr, IrValue* offset, IrBlock* block) {
+  IrValue* base = arrayBase(vl, addr, irTypeSize(vl->elem));
+  return append(block, IR_ADD, IRT_PTR, base, offset);
+}
+
+/**
+ * Put a loop running lanes iterations at a time in front of the loop,
+ * entered when enough iterations are left and the arrays do not
+ * overlap, and leave the iterations left over to the original loop.
+ */
+static void vectorize(VLoop* vl) {
+  IrBlock* body = vl->body;
+  IrBlock* pre = vl->loop->preheader;
+  int vtype = (IRT_I8 == vl->elem) ? IRT_V16I8 : IRT_V4I32;
+  IrBlock* check = newBlockBefore(body);
+  irTerminator(pre)->target = check;
+  IrValue* first = append(check, IR_LOAD, IRT_I32, irSlotAddr(vl->counter, 0), NULL);
+  IrValue* limit = (IRV_IMM == vl->bound->kind)
+                     ? irImm(IRT_I32, vl->bound->imm - (vl->lanes - 1))
+                     : append(check, IR_SUB, IRT_I32, vl->bound, irImm(IRT_I32, vl->lanes - 1));
+  IrValue* enough = append(check, IR_LT, IRT_I32, first, limit);
+  IrBlock* vpre = newBlockBefore(body);
+  IrBlock* vbody = newBlockBefore(body);
+  IrBlock* vexit = newBlockBefore(body);
+  ywvec* pairs = aliasChecks(vl);
+  for (size_t i = 0; i < ywvecLen(pairs); i += 2) {
+    // the arrays are the same or at least a vector apart
+    IrBlock* next = newBlockBefore(vpre);
+    appendBranch(check, enough, next, body);
+    check = next;
+    IrValue* distance = append(check, IR_SUB, IRT_PTR, ywvecGet(pairs, i), ywvecGet(pairs, i + 1));
+    IrValue* after = append(check, IR_GE, IRT_I32, distance, irImm(IRT_PTR, VECTOR_SIZE));
+    IrValue* before = append(check, IR_LE, IRT_I32, distance, irImm(IRT_PTR, -VECTOR_SIZE));
+    IrValue* same = append(check, IR_EQ, IRT_I32, distance, irImm(IRT_PTR, 0));
+    enough = append(check, IR_ADD, IRT_I32, append(check, IR_ADD, IRT_I32, after, before), same);
+  }
+  appendBranch(check, enough, vpre, body);
+
+  IrSlot** accs = calloc(ywvecLen(vl->sums) + 1, sizeof(IrSlot*));
+  for (size_t i = 0; i < ywvecLen(vl->sums); i++) {
+    accs[i] = irNewSlot(fun, "acc", NULL, VECTOR_SIZE);
+    accs[i]->align = VECTOR_SIZE;
+    append(vpre, IR_STORE, vtype, irSlotAddr(accs[i], 0), append(vpre, IR_SPLAT, vtype, irImm(IRT_I32, 0), NULL));
+  }
+  // the body in its order, so loads and stores of an array stay ordered
+  IrValue** map = calloc(ywvecLen(fun->regs) + 1, sizeof(IrValue*));
+  IrValue* index = append(vbody, IR_LOAD, IRT_I32, irSlotAddr(vl->counter, 0), NULL);
+  IrValue* offset = (IRT_I8 == vl->elem) ? index : append(vbody, IR_SHL, IRT_PTR, index, irImm(IRT_I32, 2));
+  for (size_t i = 0; i < ywvecLen(body->insns); i++) {
+    IrInsn* insn = ywvecGet(body->insns, i);
+    int sum = ywvecIndex(vl->sum_stores, insn);
+    if (0 <= sum) {
+      IrValue* acc = append(vbody, IR_LOAD, vtype, irSlotAddr(accs[sum], 0), NULL);
+      IrValue* x = widened(vl, ywvecGet(vl->addends, sum), map, vpre);
+      append(vbody, IR_STORE, vtype, irSlotAddr(accs[sum], 0), append(vbody, IR_ADD, vtype, acc, x));
+    } else if (IR_STORE == insn->op && IRV_SLOT != insn->a->kind) {
+      IrValue* addr = widenedAddress(vl, insn->a, offset, vbody);
+      append(vbody, IR_STORE, vtype, addr, widened(vl, insn->b, map, vpre));
+    } else if (insn->dst && needed[insn->dst->reg]) {
+      IrValue* v;
+      if (IR_LOAD == insn->op)
+        v = append(vbody, IR_LOAD, vtype, widenedAddress(vl, insn->a, offset, vbody), NULL);
+      else if (IR_CAST == insn->op)
+        v = widened(vl, insn->a, map, vpre);
+      else
+        v = append(vbody, insn->op, vtype, widened(vl, insn->a, map, vpre),
+                   widened(vl, insn->b, map, vpre));
+      map[insn->dst->reg] = v;
+    }
+  }
+  IrValue* next = append(vbody, IR_ADD, IRT_I32, index, irImm(IRT_I32, vl->lanes));
+  append(vbody, IR_STORE, IRT_I32, irSlotAddr(vl->counter, 0), next);
+  appendBranch(vbody, append(vbody, IR_LT, IRT_I32, next, limit), vbody, vexit);
+  appendJump(vpre, vbody);
+  vbody->no_vectorize = true;
+
+  // add up the lanes of the sums and run the iterations left
+  for (size_t i = 0; i < ywvecLen(vl->sums); i++) {
+    IrSlot* sum = ywvecGet(vl->sums, i);
+    IrValue* lanes = append(vexit, IR_LOAD, vtype, irSlotAddr(accs[i], 0), NULL);
+    IrValue* total = append(vexit, IR_REDUCE, IRT_I32, lanes, NULL);
+    IrValue* old = append(vexit, IR_LOAD, IRT_I32, irSlotAddr(sum, 0), NULL);
+    append(vexit, IR_STORE, IRT_I32, irSlotAddr(sum, 0), append(vexit, IR_ADD, IRT_I32, old, total));
+  }
+  IrValue* last = append(vexit, IR_LOAD, IRT_I32, irSlotAddr(vl->counter, 0), NULL);
+  appendBranch(vexit, append(vexit, IR_LT, IRT_I32, last, vl->bound), body, vl->exit);
+  body->no_vectorize = true;
+  free(accs);
+  free(map);
+}
+
+static char* LANE_NAMES[] = {"", "char", "int"};
+
+// loops already reported, by header
+static ywvec* reported = NULL;
+
+static void report(VLoop* vl, bool ok) {
+  if (!vectorize_report || (vl->body->no_vectorize && !ok))
+    return;
+  if (!reported)
+    reported = ywvecCreate();
+  if (0 <= ywvecIndex(reported, vl->body))
+    return;
+  ywvecPush(reported, vl->body);
+  if (ok)
+    fprintf(stderr, "%s: loop B%d vectorized, %d lanes of %s\n", fun->name, vl->body->id,
+            vl->lanes, LANE_NAMES[vl->elem]);
+  else
+    fprintf(stderr, "%s: loop B%d not vectorized: %s\n", fun->name, vl->body->id, reason);
+}
+
+/**
+ * Vectorize innermost loops over arrays of ints or chars, see VLoop.
+ * Sums are accumulated lane by lane and added up after the loop.
+ */
+bool runVectorize(IrFun* ir) {
+  if (!vectorize_enabled)
+    return false;
+  fun = ir;
+  bool changed = false;
+  for (bool again = true; again;) {
+    again = false;
+    irRequire(fun, ANALYSIS_LOOPS);
+    size_t nregs = ywvecLen(fun->regs);
+    def = calloc(nregs + 1, sizeof(IrInsn*));
+    def_block = calloc(nregs + 1, sizeof(IrBlock*));
+    uses = calloc(nregs + 1, sizeof(int));
+    for (size_t i = 0; i < ywvecLen(fun->blocks); i++) {
+      IrBlock* block = ywvecGet(fun->blocks, i);
+      for (size_t j = 0; j < ywvecLen(block->insns); j++) {
+        IrInsn* insn = ywvecGet(block->insns, j);
+        if (insn->dst) {
+          def[insn->dst->reg] = insn;
+          def_block[insn->dst->reg] = block;
+        }
+        IrValue** ops[IR_MAX_USES];
+        int nops = irUses(insn, ops);
+        for (int k = 0; k < nops; k++)
+          if (irIsReg(*ops[k]))
+            uses[(*ops[k])->reg]++;
+      }
+    }
+    escaped = irEscapedSlots(fun);
+    bases = irAddressBases(fun);
+    for (size_t i = 0; i < ywvecLen(fun->loops) && !again; i++) {
+      VLoop vl = {ywvecGet(fun->loops, i)};
+      vl.sums = ywvecCreate();
+      vl.sum_stores = ywvecCreate();
+      vl.addends = ywvecCreate();
+      vl.bases = ywvecCreate();
+      vl.stored_bases = ywvecCreate();
+      needed = calloc(nregs + 1, sizeof(bool));
+      bool ok = analyse(&vl);
+      if (ok && MAX_ALIAS_CHECKS < ywvecLen(aliasChecks(&vl)) / 2)
+        ok = fail("too many arrays that may overlap");
+      report(&vl, ok);
+      if (ok) {
+        vectorize(&vl);
+        irInvalidate(fun, 0);
+        changed = again = true;
+      }
+      free(needed);
+    }
+    free(def);
+    free(def_block);
+    free(uses);
+    free(bases);
+  }
+  return changed;
+}
@@ -1,10 +1,17 @@
 // yowaic.c
 // weak c compiler
 // Copyright (C) 2018: see LICENSE
+#include "builtin.h"
 #include "parser.h"
 #include "generator.h"
+#include "fold.h"
+#include "ir.h"
+#include "pass.h"
+#include "peephole.h"
+#include "util.h"
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 
 
@@ -12,18 +19,99 @@ int main(int argc, char **argv) {
   extern FILE *yyin;
   yyin = stdin;
 
-  bool want_ast = (argc > 1 && !strcmp(argv[1], "-a"));
+  // -a prints the tree as parsed, -A the tree handed to the generator
+  bool want_ast = false;
+  bool want_folded_ast = false;
+  bool want_fold = true;
+  bool want_peephole_stats = false;
+  bool want_ir = false;
+  int opt_level = 1;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-a"))
+      want_ast = true;
+    else if (!strcmp(argv[i], "-A"))
+      want_folded_ast = true;
+    else if (!strcmp(argv[i], "-fno-fold"))
+      want_fold = false;
+    else if (!strcmp(argv[i], "-ffold"))
+      want_fold = true;
+    else if (!strcmp(argv[i], "-fno-peephole"))
+      peephole_enabled = false;
+    else if (!strcmp(argv[i], "-fpeephole"))
+      peephole_enabled = true;
+    else if (!strcmp(argv[i], "--peephole-stats"))
+      want_peephole_stats = true;
+    else if (!strcmp(argv[i], "-fomit-frame-pointer"))
+      omit_frame_pointer = true;
+    else if (!strcmp(argv[i], "-fno-omit-frame-pointer"))
+      omit_frame_pointer = false;
+    else if (!strcmp(argv[i], "-fno-inline"))
+      inline_enabled = false;
+    else if (!strcmp(argv[i], "-finline"))
+      inline_enabled = true;
+    else if (!strcmp(argv[i], "-fno-builtin"))
+      builtins_enabled = false;
+    else if (!strcmp(argv[i], "-fbuiltin"))
+      builtins_enabled = true;
+    else if (!strcmp(argv[i], "-fno-vectorize"))
+      vectorize_enabled = false;
+    else if (!strcmp(argv[i], "-fvectorize"))
+      vectorize_enabled = true;
+    else if (!strcmp(argv[i], "--vectorize-report"))
+      vectorize_report = true;
+    else if (!strcmp(argv[i], "--dump-ir"))
+      want_ir = true;
+    else if (!strncmp(argv[i], "-funroll-limit=", 15))
+      unroll_limit = atoi(argv[i] + 15);
+    else if (!strncmp(argv[i], "-funroll-factor=", 16))
+      unroll_factor = atoi(argv[i] + 16);
+    else if (!strncmp(argv[i], "-O", 2) && '0' <= argv[i][2] && argv[i][2] <= '2' && !argv[i][3])
+      opt_level = argv[i][2] - '0';
+    else
+      error("Unknown option: %s", argv[i]);
+  }
 
   ywlist* yl = parseFunList();
-  if (!want_ast)
-    emitDataSection();
+  defineFunList(yl);
+  if (want_fold && !want_ast)
+    foldFunList(yl);
+  if (want_ast || want_folded_ast) {
+    for (ywiter* i = ywlistIter(yl); !ywiterEnd(i);)
+      printf("%s", astToS(ywiterNext(i)));
+    return 0;
+  }
+  // every function is optimized before it is inlined into its callers
+  ywvec* funs = ywvecCreate();
   for (ywiter* i = ywlistIter(yl); !ywiterEnd(i);) {
-    Ast* fun = ywiterNext(i);
-    if (want_ast)
-      printf("%s", astToS(fun));
-    else
-      emitFun(fun);
+    IrFun* fun = irLowerFun(ywiterNext(i));
+    irRunPipeline(fun, opt_level);
+    ywvecPush(funs, fun);
   }
+  for (size_t i = 0; i < ywvecLen(funs); i++) {
+    IrFun* fun = ywvecGet(funs, i);
+    if (irInlineCalls(fun, funs, opt_level))
+      irRunPipeline(fun, opt_level);
+  }
+  // static functions no longer called are dropped, and the others are
+  // emitted after the functions they call
+  funs = irLiveFuns(funs);
+  // --dump-ir prints the IR handed to the generator
+  if (want_ir) {
+    for (size_t i = 0; i < ywvecLen(funs); i++) {
+      IrFun* fun = ywvecGet(funs, i);
+      irRequire(fun, ANALYSIS_CFG);
+      printf("%s", irFunToS(fun));
+    }
+    return 0;
+  }
+  // functions of this file never take variable arguments
+  for (ywiter* i = ywlistIter(yl); !ywiterEnd(i);)
+    emitFixedArity(((Ast*)ywiterNext(i))->fun_name);
+  emitDataSection();
+  for (size_t i = 0; i < ywvecLen(funs); i++)
+    emitFun(ywvecGet(funs, i), 0 < opt_level);
+  emitFlush();
+  if (want_peephole_stats)
+    peepholePrintStats();
   return 0;
 }
-